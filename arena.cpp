@@ -0,0 +1,123 @@
+#include "arena.h"
+
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+#pragma region FrameArena {
+
+    static unsigned char* alignPointer(unsigned char* p, size_t alignment) {
+        return p + ((alignment - reinterpret_cast<uintptr_t>(p) % alignment) % alignment);
+    }
+
+    FrameArena::FrameArena(size_t capacity) : _block(capacity > 0 ? new unsigned char[capacity] : nullptr), _capacity(capacity), _resource(this) {}
+
+    void* FrameArena::allocate(size_t size, size_t alignment) {
+
+        if (_block) {
+
+            unsigned char* base = _block.get();
+            unsigned char* p = alignPointer(base + _offset, alignment);
+
+            if (p + size <= base + _capacity) {
+
+                _used += (size_t) (p - (base + _offset)) + size;
+                _offset = (size_t) (p - base) + size;
+
+                _highWater = _used > _highWater ? _used : _highWater;
+
+                return p;
+            }
+        }
+
+        // Spill to the heap for the rest of the frame; reset() folds the spill into the block.
+        _spills.emplace_back(new unsigned char[size + alignment]);
+        _overflows++;
+
+        _used += size + alignment;
+        _highWater = _used > _highWater ? _used : _highWater;
+
+        return alignPointer(_spills.back().get(), alignment);
+    }
+
+    void FrameArena::reset() {
+
+        if (!_spills.empty()) {
+
+            _spills.clear();
+
+            _capacity = _capacity * 2 > _highWater ? _capacity * 2 : _highWater;
+            _block.reset(new unsigned char[_capacity]);
+        }
+
+        _offset = 0;
+        _used = 0;
+    }
+
+#pragma endregion FrameArena }
+
+#pragma region HeapCounter {
+
+#ifdef PERSEUS_COUNT_ALLOCATIONS
+
+    static std::atomic<uint64_t> heapAllocationCount{0};
+
+    static void* countedAllocate(size_t size, size_t alignment) {
+
+        heapAllocationCount.fetch_add(1, std::memory_order_relaxed);
+
+        size = size > 0 ? size : 1;
+
+        if (alignment <= alignof(std::max_align_t)) {
+            return std::malloc(size);
+        }
+
+        return std::aligned_alloc(alignment, (size + alignment - 1) / alignment * alignment);
+    }
+
+    static void* countedAllocateOrThrow(size_t size, size_t alignment) {
+
+        void* p = countedAllocate(size, alignment);
+
+        if (!p) {
+            throw std::bad_alloc();
+        }
+
+        return p;
+    }
+
+    void* operator new(size_t size) { return countedAllocateOrThrow(size, 0); }
+    void* operator new[](size_t size) { return countedAllocateOrThrow(size, 0); }
+    void* operator new(size_t size, std::align_val_t alignment) { return countedAllocateOrThrow(size, (size_t) alignment); }
+    void* operator new[](size_t size, std::align_val_t alignment) { return countedAllocateOrThrow(size, (size_t) alignment); }
+    void* operator new(size_t size, const std::nothrow_t&) noexcept { return countedAllocate(size, 0); }
+    void* operator new[](size_t size, const std::nothrow_t&) noexcept { return countedAllocate(size, 0); }
+    void* operator new(size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept { return countedAllocate(size, (size_t) alignment); }
+    void* operator new[](size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept { return countedAllocate(size, (size_t) alignment); }
+
+    void operator delete(void* p) noexcept { std::free(p); }
+    void operator delete[](void* p) noexcept { std::free(p); }
+    void operator delete(void* p, size_t) noexcept { std::free(p); }
+    void operator delete[](void* p, size_t) noexcept { std::free(p); }
+    void operator delete(void* p, std::align_val_t) noexcept { std::free(p); }
+    void operator delete[](void* p, std::align_val_t) noexcept { std::free(p); }
+    void operator delete(void* p, size_t, std::align_val_t) noexcept { std::free(p); }
+    void operator delete[](void* p, size_t, std::align_val_t) noexcept { std::free(p); }
+    void operator delete(void* p, const std::nothrow_t&) noexcept { std::free(p); }
+    void operator delete[](void* p, const std::nothrow_t&) noexcept { std::free(p); }
+    void operator delete(void* p, std::align_val_t, const std::nothrow_t&) noexcept { std::free(p); }
+    void operator delete[](void* p, std::align_val_t, const std::nothrow_t&) noexcept { std::free(p); }
+
+    uint64_t heapAllocations() {
+        return heapAllocationCount.load(std::memory_order_relaxed);
+    }
+
+#else
+
+    uint64_t heapAllocations() {
+        return 0;
+    }
+
+#endif
+
+#pragma endregion HeapCounter }
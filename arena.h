@@ -0,0 +1,87 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <memory_resource>
+#include <vector>
+
+// Linear allocator for data that lives for one frame. Allocation bumps an offset and reset()
+// frees everything at once. A frame that outgrows the block spills into separate heap blocks,
+// and the next reset() replaces the block with one that holds the whole frame, so a steady
+// frame loop stops touching the heap after its first frames.
+class FrameArena {
+
+    public:
+
+        struct Stats {
+
+            size_t capacity;
+            size_t used;
+            size_t highWater;
+            uint64_t overflows;
+
+        };
+
+        explicit FrameArena(size_t capacity = 0);
+
+        FrameArena(const FrameArena&) = delete;
+        FrameArena& operator=(const FrameArena&) = delete;
+
+        void* allocate(size_t size, size_t alignment = alignof(std::max_align_t));
+
+        // Frees every allocation. Nothing allocated since the last reset may be used afterwards.
+        void reset();
+
+        // std::pmr adaptor; deallocation is a no-op until reset().
+        std::pmr::memory_resource* resource() {
+            return &_resource;
+        }
+
+        Stats stats() const {
+            return {_capacity, _used, _highWater, _overflows};
+        }
+
+    private:
+
+        class Resource : public std::pmr::memory_resource {
+
+            public:
+
+                explicit Resource(FrameArena* arena) : _arena(arena) {}
+
+            private:
+
+                void* do_allocate(size_t size, size_t alignment) override {
+                    return _arena -> allocate(size, alignment);
+                }
+
+                void do_deallocate(void*, size_t, size_t) override {}
+
+                bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override {
+                    return this == &other;
+                }
+
+                FrameArena* _arena;
+
+        };
+
+        std::unique_ptr<unsigned char[]> _block;
+        std::vector<std::unique_ptr<unsigned char[]>> _spills;
+
+        size_t _capacity;
+        size_t _offset = 0;
+        size_t _used = 0;
+        size_t _highWater = 0;
+        uint64_t _overflows = 0;
+
+        Resource _resource;
+
+};
+
+// Number of global operator new calls so far. Counting is compiled in with
+// -DPERSEUS_COUNT_ALLOCATIONS, which replaces the global allocation functions; otherwise 0.
+uint64_t heapAllocations();
+
+#endif
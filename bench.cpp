@@ -0,0 +1,1141 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <mutex>
+#include <numeric>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <stdlib.h>
+
+#include "bvh.h"
+#include "culling.h"
+#include "instances.h"
+#include "mandelbrot.h"
+#include "mandelbrotcache.h"
+#include "pacer.h"
+#include "picking.h"
+#include "simulation.h"
+#include "taskgraph.h"
+
+// Headless throughput measurements of the parts of the renderer that need no Metal device. Builds
+// on Linux as well as macOS; see todo.txt for the command line. ./bench runs every benchmark,
+// ./bench NAME... only those whose names start with one of the arguments. Results go to stderr.
+
+#pragma region Harness {
+
+    // Seconds taken by the fastest of runs calls of fn, which keeps one-off page faults and
+    // frequency ramps out of the figures.
+    template <typename Fn>
+    static double bestOf(int runs, Fn&& fn) {
+
+        double best = 1e30;
+
+        for (int r = 0; r < runs; r++) {
+
+            const auto start = std::chrono::steady_clock::now();
+
+            fn();
+
+            const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+            if (seconds < best) {
+                best = seconds;
+            }
+        }
+
+        return best;
+    }
+
+    // Keeps results the compiler could otherwise prove unused.
+    static volatile float sink;
+
+#pragma endregion Harness }
+
+#pragma region Math {
+
+    static const char* mathBackend() {
+#if MATH_SIMD_AVX2
+        return "avx2+fma";
+#elif MATH_SIMD_SSE
+        return "sse";
+#elif MATH_SIMD_NEON
+        return "neon";
+#else
+        return "scalar";
+#endif
+    }
+
+    // The product the math layer replaces, one multiply-add at a time.
+    static math::float4x4 plainProduct(const math::float4x4& a, const math::float4x4& b) {
+
+        math::float4x4 r;
+
+        for (int c = 0; c < 4; c++) {
+            for (int i = 0; i < 4; i++) {
+                r.columns[c][i] = a.columns[0][i] * b.columns[c].x + a.columns[1][i] * b.columns[c].y
+                    + a.columns[2][i] * b.columns[c].z + a.columns[3][i] * b.columns[c].w;
+            }
+        }
+
+        return r;
+    }
+
+    static void printRate(const char* what, size_t count, double seconds, double baseline) {
+        fprintf(stderr, "    %-24s %8.2f ms %8.1f M/s %6.2fx\n", what, seconds * 1e3, count / seconds * 1e-6, baseline / seconds);
+    }
+
+    // 1M float4x4 and affine products and 1M sincos of angles in [-8, 8], against plain loops and
+    // libm, over 4096 operands that stay in cache so that memory does not hide the arithmetic. The
+    // backend is fixed at compile time; build with -DMATH_FORCE_SCALAR to measure the scalar one.
+    static void benchMath() {
+
+        constexpr size_t count = 4096;
+        constexpr size_t repeats = 256;
+        constexpr size_t total = count * repeats;
+
+        std::mt19937 random(7);
+        std::uniform_real_distribution<float> angle(-8.f, 8.f);
+
+        std::vector<math::float4x4> a(count), b(count), product(count);
+        std::vector<math::affine> affineA(count), affineB(count), affineProduct(count);
+        std::vector<float> angles(count), sines(count), cosines(count);
+
+        for (size_t i = 0; i < count; i++) {
+
+            a[i] = math::rotateY(angle(random)) * math::translate({angle(random), angle(random), angle(random)});
+            b[i] = math::rotateZ(angle(random)) * math::scale({0.5f, 0.5f, 0.5f});
+
+            affineA[i] = math::toAffine(a[i]);
+            affineB[i] = math::toAffine(b[i]);
+
+            angles[i] = angle(random);
+        }
+
+        fprintf(stderr, "math, %s backend, %zu-lane vfloat, %zu operations\n", mathBackend(), math::vfloat::lanes, total);
+
+        const double plain = bestOf(5, [&]() {
+            for (size_t r = 0; r < repeats; r++) {
+                for (size_t i = 0; i < count; i++) {
+                    product[i] = plainProduct(a[i], b[i]);
+                }
+            }
+        });
+
+        sink = product[count - 1].columns[3].x;
+
+        printRate("float4x4 plain loops", total, plain, plain);
+
+        const double fused = bestOf(5, [&]() {
+            for (size_t r = 0; r < repeats; r++) {
+                for (size_t i = 0; i < count; i++) {
+                    product[i] = a[i] * b[i];
+                }
+            }
+        });
+
+        sink = product[count - 1].columns[3].x;
+
+        printRate("float4x4 operator*", total, fused, plain);
+
+        const double affine = bestOf(5, [&]() {
+            for (size_t r = 0; r < repeats; r++) {
+                for (size_t i = 0; i < count; i++) {
+                    affineProduct[i] = affineA[i] * affineB[i];
+                }
+            }
+        });
+
+        sink = affineProduct[count - 1].rows[0].w;
+
+        printRate("affine operator*", total, affine, plain);
+
+        const double libm = bestOf(5, [&]() {
+            for (size_t r = 0; r < repeats; r++) {
+                for (size_t i = 0; i < count; i++) {
+                    sines[i] = sinf(angles[i]);
+                    cosines[i] = cosf(angles[i]);
+                }
+            }
+        });
+
+        sink = sines[count - 1] + cosines[count - 1];
+
+        printRate("sincos libm", total, libm, libm);
+
+        const double accurate = bestOf(5, [&]() {
+            for (size_t r = 0; r < repeats; r++) {
+                math::sincos<math::Precision::Accurate>(angles.data(), sines.data(), cosines.data(), count);
+            }
+        });
+
+        sink = sines[count - 1] + cosines[count - 1];
+
+        printRate("sincos accurate", total, accurate, libm);
+
+        const double fast = bestOf(5, [&]() {
+            for (size_t r = 0; r < repeats; r++) {
+                math::sincos<math::Precision::Fast>(angles.data(), sines.data(), cosines.data(), count);
+            }
+        });
+
+        sink = sines[count - 1] + cosines[count - 1];
+
+        printRate("sincos fast", total, fast, libm);
+    }
+
+#pragma endregion Math }
+
+#pragma region InstanceKernels {
+
+    static constexpr const char* INSTANCE_KERNEL_NAMES[] = {"scalar", "avx2", "avx512"};
+
+    // The loop draw ran before the kernels: one matrix product per instance, normal transform
+    // taken from the product.
+    static void buildInstanceProducts(const math::float4x4& fullRot, const InstanceBatch& batch, shader::InstanceData* out) {
+
+        for (size_t i = 0; i < batch.count; i++) {
+
+            const math::float4x4 scale = math::scale({batch.scale[i], batch.scale[i], batch.scale[i]});
+            const math::float4x4 rotZ = math::rotateZ(batch.angleZ[i]);
+            const math::float4x4 rotY = math::rotateY(batch.angleY[i]);
+            const math::float4x4 translate = math::translate({batch.x[i], batch.y[i], batch.z[i]});
+
+            out[i].instanceTransform = fullRot * translate * rotY * rotZ * scale;
+            out[i].instanceNormalTransform = math::discard(out[i].instanceTransform);
+        }
+    }
+
+    // Whole-batch buildInstanceTransforms for a record layout and each kernel the CPU supports, in
+    // million records a second against the per-instance matrix products.
+    template <typename Instance>
+    static void benchInstanceLayout(const char* layout, const InstanceBatch& batch, const math::float4x4& fullRot, int runs, double baseline) {
+
+        static constexpr InstanceKernel kernels[] = {InstanceKernel::Scalar, InstanceKernel::AVX2, InstanceKernel::AVX512};
+
+        std::vector<Instance> out(batch.count);
+
+        for (InstanceKernel kernel : kernels) {
+
+            if (!selectInstanceKernel(kernel)) {
+                continue;
+            }
+
+            const double seconds = bestOf(runs, [&]() {
+                buildInstanceTransforms(fullRot, batch, out.data());
+            });
+
+            sink = *reinterpret_cast<const float*>(&out.back());
+
+            const double rate = batch.count / seconds * 1e-6;
+
+            fprintf(stderr, "    %-10s %-7s %3zu B %8.3f ms %8.1f Mrecord/s %6.2fx\n",
+                layout,
+                INSTANCE_KERNEL_NAMES[(size_t) kernel],
+                sizeof(Instance),
+                seconds * 1e3,
+                rate,
+                rate / baseline
+            );
+        }
+    }
+
+    // Grids of 10^3, 47^3 (about 100k) and 100^3 instances, so the kernels are seen from inside
+    // the caches to well past them.
+    static void benchInstanceKernels() {
+
+        const InstanceKernel active = instanceKernel();
+        const math::float4x4 fullRot = math::rotateY(0.3f) * math::rotateZ(0.6f);
+
+        for (size_t side : {10, 47, 100}) {
+
+            InstanceGrid grid(side, side, side, 0.2f, {0.f, 0.f, -10.f});
+
+            grid.animate(0.3f);
+
+            const InstanceBatch batch = grid.batch();
+
+            // About five million records per figure, and never fewer than five runs.
+            const int runs = (int) std::max((size_t) 5, 100000000 / batch.count / 20);
+
+            std::vector<shader::InstanceData> products(batch.count);
+
+            const double seconds = bestOf(runs, [&]() {
+                buildInstanceProducts(fullRot, batch, products.data());
+            });
+
+            sink = *reinterpret_cast<const float*>(&products.back());
+
+            const double baseline = batch.count / seconds * 1e-6;
+
+            fprintf(stderr, "instance kernels, %zu instances, best of %d\n", batch.count, runs);
+            fprintf(stderr, "    %-10s %-7s %3zu B %8.3f ms %8.1f Mrecord/s %6.2fx\n", "matrix", "product", sizeof(shader::InstanceData), seconds * 1e3, baseline, 1.0);
+
+            benchInstanceLayout<shader::InstanceData>("matrix", batch, fullRot, runs, baseline);
+            benchInstanceLayout<shader::AffineInstanceData>("affine", batch, fullRot, runs, baseline);
+            benchInstanceLayout<shader::QuatInstanceData>("quaternion", batch, fullRot, runs, baseline);
+        }
+
+        selectInstanceKernel(active);
+    }
+
+    // The per-frame instance update over a 100x100x100 grid, split as draw splits it: the angles
+    // for the frame, then every record built into a line-aligned array. Pools of 1, 2, 4 and 8
+    // threads and the hardware count print ms per frame and the speedup over one thread.
+    static void benchInstanceUpdate() {
+
+        constexpr size_t grain = std::lcm(cacheLineGrain<shader::InstanceData>(), (size_t) 16);
+
+        InstanceGrid grid(100, 100, 100, 0.2f, {0.f, 0.f, -10.f});
+
+        std::vector<float> angleY(grid.count()), angleZ(grid.count());
+        std::vector<shader::InstanceData> out(grid.count());
+
+        const math::float4x4 fullRot = math::rotateY(0.3f) * math::rotateZ(0.6f);
+        const unsigned hardware = std::thread::hardware_concurrency();
+
+        std::vector<unsigned> sizes = {1, 2, 4, 8};
+
+        if (std::find(sizes.begin(), sizes.end(), hardware) == sizes.end()) {
+            sizes.push_back(hardware);
+        }
+
+        fprintf(stderr, "instance update, %zu instances, %u hardware threads\n", grid.count(), hardware);
+
+        double single = 0.0;
+
+        for (unsigned threads : sizes) {
+
+            ThreadPool pool(threads);
+
+            float angle = 0.f;
+
+            const double seconds = bestOf(5, [&]() {
+
+                angle += 0.01f;
+
+                pool.parallelFor(0, grid.count(), cacheLineGrain<float>(), [&](size_t begin, size_t end) {
+                    grid.animate(angle, begin, end, angleY.data(), angleZ.data());
+                });
+
+                const InstanceBatch batch = grid.batch(angleY.data(), angleZ.data());
+
+                pool.parallelFor(0, batch.count, grain, [&](size_t begin, size_t end) {
+                    buildInstanceTransforms(fullRot, batch, begin, end, out.data());
+                });
+            });
+
+            sink = *reinterpret_cast<const float*>(&out.back());
+
+            if (threads == 1) {
+                single = seconds;
+            }
+
+            fprintf(stderr, "    %2u threads %8.2f ms %8.1f Minstance/s %6.2fx\n", threads, seconds * 1e3, grid.count() / seconds * 1e-6, single / seconds);
+        }
+    }
+
+#pragma endregion InstanceKernels }
+
+#pragma region Upload {
+
+    // Instance records written straight to the destination and through the staged, streamed path,
+    // and plain against streamed copies, with destinations larger than the last-level cache as a
+    // mapped upload buffer would be. Ordinary pages stand in for a write-combined mapping, which
+    // costs partial-line writes more than these figures show.
+    template <typename Instance>
+    static void benchUploadLayout(const char* layout, const InstanceBatch& batch, const math::float4x4& fullRot, void* destination) {
+
+        Instance* out = static_cast<Instance*>(destination);
+
+        const double bytes = (double) batch.count * sizeof(Instance);
+
+        const double direct = bestOf(5, [&]() {
+            buildInstanceTransforms(fullRot, batch, out);
+        });
+
+        const double streamed = bestOf(5, [&]() {
+            streamInstanceTransforms(fullRot, batch, 0, batch.count, out);
+        });
+
+        sink = *reinterpret_cast<const float*>(out + batch.count - 1);
+
+        fprintf(stderr, "    %-10s direct   %8.2f ms %6.2f GB/s\n", layout, direct * 1e3, bytes / direct * 1e-9);
+        fprintf(stderr, "    %-10s streamed %8.2f ms %6.2f GB/s %6.2fx\n", layout, streamed * 1e3, bytes / streamed * 1e-9, direct / streamed);
+    }
+
+    static void benchUpload() {
+
+        constexpr size_t copyBytes = (size_t) 256 << 20;
+
+        InstanceGrid grid(250, 200, 100, 0.2f, {0.f, 0.f, -10.f});
+
+        grid.animate(0.3f);
+
+        const InstanceBatch batch = grid.batch();
+        const math::float4x4 fullRot = math::rotateY(0.3f) * math::rotateZ(0.6f);
+
+        std::vector<unsigned char> source(copyBytes, 1);
+        std::vector<unsigned char> destination(std::max(copyBytes, batch.count * sizeof(shader::InstanceData)));
+
+        fprintf(stderr, "upload, %zu MB copies, %zu instances, %s instance kernel\n", copyBytes >> 20, batch.count, INSTANCE_KERNEL_NAMES[(size_t) instanceKernel()]);
+
+        const double plain = bestOf(5, [&]() {
+            memcpy(destination.data(), source.data(), copyBytes);
+        });
+
+        const double streamed = bestOf(5, [&]() {
+            streamCopy(destination.data(), source.data(), copyBytes);
+        });
+
+        sink = destination[copyBytes - 1];
+
+        fprintf(stderr, "    %-10s memcpy   %8.2f ms %6.2f GB/s\n", "copy", plain * 1e3, copyBytes / plain * 1e-9);
+        fprintf(stderr, "    %-10s streamed %8.2f ms %6.2f GB/s %6.2fx\n", "copy", streamed * 1e3, copyBytes / streamed * 1e-9, plain / streamed);
+
+        benchUploadLayout<shader::InstanceData>("matrix", batch, fullRot, destination.data());
+        benchUploadLayout<shader::AffineInstanceData>("affine", batch, fullRot, destination.data());
+        benchUploadLayout<shader::QuatInstanceData>("quaternion", batch, fullRot, destination.data());
+    }
+
+#pragma endregion Upload }
+
+#pragma region Culling {
+
+    // The renderer's camera over the 100x100x100 grid from a few poses, culled on pools of 1 up to
+    // the hardware's threads: the visible fraction, the cost of a cull, and the matrix records
+    // built for the visible instances against building all of them.
+    static void benchCull() {
+
+        struct Pose {
+
+            const char* name;
+            math::float4x4 world;
+
+        };
+
+        const Pose poses[] = {
+            {"inside", math::identity()},
+            {"turned", math::rotateY(0.6f)},
+            {"behind", math::rotateY((float) M_PI)},
+            {"outside", math::translate({0.f, 0.f, -40.f})},
+        };
+
+        const math::float3 origin = {0.f, 0.f, -10.f};
+        const math::float4x4 perspective = math::perspective(45.f * M_PI / 180.f, 1.f, 0.03f, 500.0f);
+
+        InstanceGrid grid(100, 100, 100, 0.2f, origin);
+        Simulation simulation(origin, 0.12f, 60.0, true);
+        InstanceCuller culler;
+
+        grid.animate(0.7f);
+
+        const InstanceBatch batch = grid.batch();
+        const math::float4x4 model = simulation.model(0.7f);
+
+        std::vector<shader::InstanceData> out(batch.count);
+
+        const double all = bestOf(3, [&]() {
+            buildInstanceTransforms(model, batch, out.data());
+        });
+
+        std::vector<unsigned> threadCounts = {1, 2, 4};
+
+        if (std::thread::hardware_concurrency() > 4) {
+            threadCounts.push_back(std::thread::hardware_concurrency());
+        }
+
+        fprintf(stderr, "cull, %zu instances, matrix records for all of them in %.2f ms\n", batch.count, all * 1e3);
+
+        for (const Pose& pose : poses) {
+
+            const Frustum frustum = extractFrustum(perspective * pose.world);
+
+            size_t visible = 0;
+
+            for (unsigned threads : threadCounts) {
+
+                ThreadPool pool(threads);
+
+                const double seconds = bestOf(5, [&]() {
+                    visible = culler.cull(frustum, model, batch, 0.8660254f, &pool);
+                });
+
+                fprintf(stderr, "    %-8s %2u threads %8.2f ms %6.2f ns/instance\n", pose.name, threads, seconds * 1e3, seconds * 1e9 / batch.count);
+            }
+
+            const InstanceBatch culled = culler.visible();
+
+            const double built = bestOf(3, [&]() {
+                buildInstanceTransforms(model, culled, out.data());
+            });
+
+            sink = (float) visible;
+
+            fprintf(stderr, "    %-8s %5.1f%% visible, records built in %.2f ms\n", pose.name, 100.0 * visible / batch.count, built * 1e3);
+        }
+    }
+
+#pragma endregion Culling }
+
+#pragma region Simulation {
+
+    // One presented frame of draw's CPU path after the angles are known: cull the grid and
+    // stream the visible records. Returns the visible count.
+    static size_t cullAndStream(InstanceCuller& culler, const Frustum& frustum, const math::float4x4& model, const InstanceBatch& batch, ThreadPool& pool, shader::InstanceData* out) {
+
+        const size_t visible = culler.cull(frustum, model, batch, 0.8660254f, &pool);
+        const InstanceBatch culled = culler.visible();
+
+        pool.parallelFor(0, visible, std::lcm(cacheLineGrain<shader::InstanceData>(), (size_t) 16), [&](size_t begin, size_t end) {
+            streamInstanceTransforms(model, culled, begin, end, out);
+        });
+
+        return visible;
+    }
+
+    // A 60x60x60 grid presented at 120 Hz for a second, animated on every frame as draw did before
+    // the fixed timestep, then by the simulation thread at 30, 60 and 120 Hz with draw blending
+    // the two newest steps. Prints the CPU time per frame, the steps taken and their mean cost, and
+    // the largest frame-to-frame change of the model angle against the ideal one.
+    static void benchSimulation() {
+
+        constexpr double presentHz = 120.0;
+        constexpr int frames = 120;
+        constexpr float angularSpeed = 0.12f;
+
+        const math::float3 origin = {0.f, 0.f, -10.f};
+        const auto period = std::chrono::duration_cast<Simulation::Clock::duration>(std::chrono::duration<double>(1.0 / presentHz));
+
+        ThreadPool pool(4);
+        InstanceGrid grid(60, 60, 60, 0.2f, origin);
+        InstanceCuller culler;
+
+        std::vector<float> angleY(grid.count()), angleZ(grid.count());
+        std::vector<shader::InstanceData> out(grid.count());
+
+        const Frustum frustum = extractFrustum(math::perspective(45.f * M_PI / 180.f, 1.f, 0.03f, 500.0f));
+
+        fprintf(stderr, "simulation, %zu instances presented at %.0f Hz for %d frames, ideal step %.4f rad\n", grid.count(), presentHz, frames, angularSpeed / presentHz);
+
+        // hz 0 animates on the presenting thread.
+        for (double hz : {0.0, 30.0, 60.0, 120.0}) {
+
+            Simulation simulation(origin, angularSpeed, hz ? hz : 60.0, true);
+
+            if (hz) {
+                simulation.start(grid);
+            }
+
+            const Simulation::Clock::time_point start = Simulation::Clock::now();
+
+            double busy = 0.0;
+            float lastAngle = 0.f;
+            float largestJump = 0.f;
+
+            for (int f = 0; f < frames; f++) {
+
+                std::this_thread::sleep_until(start + period * f);
+
+                const Simulation::Clock::time_point now = Simulation::Clock::now();
+
+                float angle;
+
+                if (hz) {
+
+                    const float alpha = simulation.sample(now);
+
+                    angle = simulation.angle(alpha);
+
+                    pool.parallelFor(0, grid.count(), cacheLineGrain<float>(), [&](size_t begin, size_t end) {
+                        simulation.interpolate(alpha, begin, end, angleY.data(), angleZ.data());
+                    });
+                } else {
+
+                    angle = angularSpeed * std::chrono::duration<float>(now - start).count();
+
+                    pool.parallelFor(0, grid.count(), cacheLineGrain<float>(), [&](size_t begin, size_t end) {
+                        grid.animate(angle, begin, end, angleY.data(), angleZ.data());
+                    });
+                }
+
+                cullAndStream(culler, frustum, simulation.model(angle), grid.batch(angleY.data(), angleZ.data()), pool, out.data());
+
+                busy += std::chrono::duration<double>(Simulation::Clock::now() - now).count();
+
+                if (f > 0) {
+                    largestJump = std::max(largestJump, std::fabs(angle - lastAngle));
+                }
+
+                lastAngle = angle;
+            }
+
+            if (hz) {
+
+                simulation.stop();
+
+                const Simulation::Stats stats = simulation.stats();
+
+                fprintf(stderr, "    sim %4.0f Hz    %6.3f ms/frame, %3llu steps of %6.3f ms, largest jump %.4f rad\n",
+                    hz,
+                    busy * 1e3 / frames,
+                    (unsigned long long) stats.stepTime.count(),
+                    stats.stepTime.mean() * 1e-3,
+                    largestJump
+                );
+            } else {
+                fprintf(stderr, "    every frame    %6.3f ms/frame, largest jump %.4f rad\n", busy * 1e3 / frames, largestJump);
+            }
+        }
+    }
+
+#pragma endregion Simulation }
+
+#pragma region Pacing {
+
+    static void printHistogram(const char* name, const Histogram& histogram) {
+
+        fprintf(stderr, "        %s: %llu samples, mean %.0f us, p50 %llu us, p95 %llu us, p99 %llu us, max %llu us\n",
+            name,
+            (unsigned long long) histogram.count(),
+            histogram.mean(),
+            (unsigned long long) histogram.percentile(0.50),
+            (unsigned long long) histogram.percentile(0.95),
+            (unsigned long long) histogram.percentile(0.99),
+            (unsigned long long) histogram.max()
+        );
+    }
+
+    // A producer spending 2 ms of CPU per frame against a consumer thread standing in for the GPU,
+    // which completes each frame 4 ms after it starts on it, for 1 to 4 frames in flight. Prints the
+    // frame rate with the pacer's blocked and latency histograms: past the limit the consumer is
+    // already kept busy, so more frames in flight only add latency.
+    static void benchPacing() {
+
+        constexpr int frames = 120;
+        constexpr auto produce = std::chrono::milliseconds(2);
+        constexpr auto consume = std::chrono::milliseconds(4);
+
+        fprintf(stderr, "pacing, %d frames, %lld ms of CPU and %lld ms of GPU per frame\n", frames, (long long) produce.count(), (long long) consume.count());
+
+        for (unsigned framesInFlight = 1; framesInFlight <= FramePacer::MAX_FRAMES_IN_FLIGHT; framesInFlight++) {
+
+            FramePacer pacer(framesInFlight);
+
+            std::mutex lock;
+            std::condition_variable ready;
+            std::vector<uint64_t> queue;
+
+            std::thread consumer([&]() {
+
+                for (int f = 0; f < frames; f++) {
+
+                    uint64_t ticket;
+
+                    {
+                        std::unique_lock<std::mutex> guard(lock);
+
+                        ready.wait(guard, [&]() {
+                            return !queue.empty();
+                        });
+
+                        ticket = queue.front();
+                        queue.erase(queue.begin());
+                    }
+
+                    std::this_thread::sleep_for(consume);
+                    pacer.complete(ticket);
+                }
+            });
+
+            const auto start = std::chrono::steady_clock::now();
+
+            for (int f = 0; f < frames; f++) {
+
+                const uint64_t ticket = pacer.begin();
+
+                std::this_thread::sleep_for(produce);
+
+                {
+                    std::lock_guard<std::mutex> guard(lock);
+                    queue.push_back(ticket);
+                }
+
+                ready.notify_one();
+            }
+
+            pacer.drain();
+            consumer.join();
+
+            const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            const FramePacer::Stats stats = pacer.stats();
+
+            fprintf(stderr, "    %u in flight    %6.1f frames/s\n", framesInFlight, frames / seconds);
+
+            printHistogram("blocked", stats.blocked);
+            printHistogram("latency", stats.latency);
+        }
+    }
+
+#pragma endregion Pacing }
+
+#pragma region FrameGraph {
+
+    // The stages of Render's frame graph with the resources they declare there, over a 60x60x60
+    // grid, with the CPU Mandelbrot renderer at 128x128 standing in for the encoding of the
+    // Mandelbrot pass. 240 frames on pools of 1, 2 and 4 threads print the graph's mean elapsed
+    // time, work and critical path per frame, next to the same stages called one after another.
+    static void benchFrameGraph() {
+
+        enum Resource : uint32_t { Model, Camera, Mandelbrot, Upload, Visible, Commands };
+
+        constexpr int frames = 240;
+        constexpr uint32_t textureSize = 128;
+
+        const math::float3 origin = {0.f, 0.f, -10.f};
+
+        InstanceGrid grid(60, 60, 60, 0.2f, origin);
+        Simulation simulation(origin, 0.12f, 60.0, true);
+        InstanceCuller culler;
+
+        std::vector<float> angleY(grid.count()), angleZ(grid.count());
+        std::vector<shader::InstanceData> out(grid.count());
+        std::vector<uint32_t> texture(textureSize * textureSize);
+
+        struct Frame {
+
+            uint32_t number;
+            float alpha;
+            math::float4x4 model;
+            Frustum frustum;
+            size_t visible;
+
+        } frame = {};
+
+        ThreadPool* pool = nullptr;
+
+        auto simulationStage = [&]() {
+            frame.alpha = simulation.sample(Simulation::Clock::now());
+            frame.model = simulation.model(simulation.angle(frame.alpha));
+        };
+
+        auto cameraStage = [&]() {
+            frame.frustum = extractFrustum(math::perspective(45.f * M_PI / 180.f, 1.f, 0.03f, 500.0f));
+        };
+
+        auto mandelbrotStage = [&]() {
+            renderMandelbrot(textureSize, textureSize, frame.number % MANDELBROT_CYCLE, shader::MandelbrotSkipBulbs | shader::MandelbrotSkipCycles, texture.data(), pool);
+        };
+
+        auto instancesStage = [&]() {
+
+            const float alpha = frame.alpha;
+
+            pool -> parallelFor(0, grid.count(), cacheLineGrain<float>(), [&](size_t begin, size_t end) {
+                simulation.interpolate(alpha, begin, end, angleY.data(), angleZ.data());
+            });
+
+            frame.visible = cullAndStream(culler, frame.frustum, frame.model, grid.batch(angleY.data(), angleZ.data()), *pool, out.data());
+        };
+
+        TaskGraph graph;
+
+        graph.add("simulation", {}, {Model}, simulationStage);
+        graph.add("camera", {}, {Camera, Upload}, cameraStage);
+        graph.add("mandelbrot", {}, {Mandelbrot, Commands}, mandelbrotStage);
+        graph.add("instances", {Model, Camera}, {Upload, Visible}, instancesStage);
+        graph.add("flush", {}, {Upload}, []() {});
+        graph.add("encode", {Upload, Visible, Mandelbrot}, {Commands}, [&]() {
+            sink = (float) frame.visible + (float) texture[0];
+        });
+
+        simulation.start(grid);
+
+        fprintf(stderr, "frame graph, %zu nodes, %zu instances, %ux%u mandelbrot, %d frames\n", graph.size(), grid.count(), textureSize, textureSize, frames);
+
+        for (unsigned threads : {1u, 2u, 4u}) {
+
+            ThreadPool threadPool(threads);
+
+            pool = &threadPool;
+
+            const auto serialStart = std::chrono::steady_clock::now();
+
+            for (int f = 0; f < frames; f++) {
+
+                frame.number = f;
+
+                simulationStage();
+                cameraStage();
+                mandelbrotStage();
+                instancesStage();
+            }
+
+            const double serial = std::chrono::duration<double>(std::chrono::steady_clock::now() - serialStart).count() * 1e6 / frames;
+
+            const TaskGraph::Stats before = graph.stats();
+
+            for (int f = 0; f < frames; f++) {
+
+                frame.number = f;
+
+                graph.execute(threadPool);
+            }
+
+            const TaskGraph::Stats after = graph.stats();
+            const double executions = (double) (after.executions - before.executions);
+
+            fprintf(stderr, "    %u threads: serial %7.0f us, graph %7.0f us elapsed, %7.0f us of work, %7.0f us critical path\n",
+                threads,
+                serial,
+                (after.wall - before.wall) / executions,
+                (after.work - before.work) / executions,
+                (after.criticalPath - before.criticalPath) / executions
+            );
+        }
+
+        simulation.stop();
+    }
+
+#pragma endregion FrameGraph }
+
+#pragma region Mandelbrot {
+
+    // The sizes ./perseus --mandelbrot-bench used: a large image for the kernels, and the texture
+    // the renderer draws for the skip options and the cache.
+    static constexpr uint32_t MANDELBROT_BENCH_SIZE = 1024;
+    static constexpr uint32_t MANDELBROT_BENCH_FRAMES = 8;
+    static constexpr uint32_t MANDELBROT_TEXTURE_SIZE = 128;
+
+    static constexpr uint32_t MANDELBROT_SKIP_ALL = shader::MandelbrotSkipBulbs | shader::MandelbrotSkipCycles;
+
+    static void benchMandelbrotKernels() {
+
+        ThreadPool pool;
+
+        benchmarkMandelbrot(MANDELBROT_BENCH_SIZE, MANDELBROT_BENCH_SIZE, MANDELBROT_BENCH_FRAMES, MANDELBROT_SKIP_ALL, pool);
+    }
+
+    static void benchMandelbrotOptions() {
+
+        ThreadPool pool;
+
+        benchmarkMandelbrotOptions(MANDELBROT_TEXTURE_SIZE, MANDELBROT_TEXTURE_SIZE, 1, pool);
+    }
+
+    // Every tier of the cache, with its stores in a directory of its own that is removed again.
+    static void benchMandelbrotCache() {
+
+        ThreadPool pool;
+
+        std::string directory = (std::filesystem::temp_directory_path() / "perseus-bench-XXXXXX").string();
+
+        if (!mkdtemp(directory.data())) {
+            fprintf(stderr, "mandelbrot cache: cannot create a directory under %s\n", std::filesystem::temp_directory_path().c_str());
+            return;
+        }
+
+        benchmarkMandelbrotCache(MANDELBROT_TEXTURE_SIZE, MANDELBROT_TEXTURE_SIZE, MANDELBROT_SKIP_ALL, directory.c_str(), pool);
+
+        std::filesystem::remove_all(directory);
+    }
+
+#pragma endregion Mandelbrot }
+
+#pragma region Boxes {
+
+    // Each batch box operation over 1M boxes of up to 3 units in a 200-unit cube, in thousands of
+    // boxes a millisecond: an affine transform, a merge, an overlap query and a ray.
+    static void benchBoxes() {
+
+        constexpr size_t count = 1000000;
+
+        std::mt19937 random(9);
+        std::uniform_real_distribution<float> place(-100.f, 100.f);
+        std::uniform_real_distribution<float> size(0.f, 3.f);
+
+        BoxArray in, out;
+
+        in.resize(count);
+        out.resize(count);
+
+        const BoxBatch source = in.batch();
+        const BoxBatch target = out.batch();
+
+        for (size_t i = 0; i < count; i++) {
+
+            source.minX[i] = place(random);
+            source.minY[i] = place(random);
+            source.minZ[i] = place(random);
+            source.maxX[i] = source.minX[i] + size(random);
+            source.maxY[i] = source.minY[i] + size(random);
+            source.maxZ[i] = source.minZ[i] + size(random);
+        }
+
+        std::vector<uint32_t> hits(count);
+        std::vector<float> t(count);
+
+        const math::float4x4 transform = math::translate({1.f, -2.f, 3.f}) * math::rotateY(0.7f) * math::rotateX(-1.1f);
+        const float lo[3] = {-20.f, -20.f, -20.f}, hi[3] = {20.f, 20.f, 20.f};
+        const Box3 query(lo, hi);
+        const math::float3 dir = math::normalize(math::float3(1.f, 0.3f, 0.2f));
+        const math::float3 inv(1.f / dir.x, 1.f / dir.y, 1.f / dir.z);
+
+        fprintf(stderr, "boxes, %zu boxes, %s backend\n", count, mathBackend());
+
+        size_t found = 0;
+
+        // Hits are printed for the queries only.
+        const auto report = [&](const char* name, double seconds, bool query) {
+
+            fprintf(stderr, "    %-10s %8.3f ms %9.0f kbox/ms", name, seconds * 1e3, count / (seconds * 1e3) * 1e-3);
+
+            if (query) {
+                fprintf(stderr, " %8zu hits", found);
+            }
+
+            fprintf(stderr, "\n");
+        };
+
+        report("transform", bestOf(5, [&]() {
+            transformBoxes(transform, source, target);
+        }), false);
+
+        sink = target.maxZ[count - 1];
+
+        report("merge", bestOf(5, [&]() {
+            sink = mergeBoxes(source).getMax(0);
+        }), false);
+
+        report("overlap", bestOf(5, [&]() {
+            found = overlapBoxes(query, source, hits.data());
+        }), true);
+
+        report("ray", bestOf(5, [&]() {
+            found = intersectBoxes({-150.f, 0.f, 0.f}, inv, 0.f, 1000.f, source, hits.data(), t.data());
+        }), true);
+    }
+
+#pragma endregion Boxes }
+
+#pragma region BVH {
+
+    // Boxes of half-width 0.5 scattered over a cube that keeps their density the same at every
+    // count, from 10k to 10M: a full build, alone and on a pool, against a refit after every box
+    // has moved a little, and overlap queries of 2-unit boxes against the refitted tree.
+    static void benchBVH() {
+
+        constexpr size_t queries = 1000;
+
+        ThreadPool pool;
+
+        fprintf(stderr, "bvh, %u threads\n", pool.size());
+
+        for (size_t count : {(size_t) 10000, (size_t) 100000, (size_t) 1000000, (size_t) 10000000}) {
+
+            const float extent = 0.5f * std::cbrt((float) count);
+
+            std::mt19937 random(5);
+            std::uniform_real_distribution<float> place(-extent, extent);
+            std::uniform_real_distribution<float> nudge(-0.25f, 0.25f);
+
+            BoxArray array;
+
+            array.resize(count);
+
+            const BoxBatch boxes = array.batch();
+
+            auto setBox = [&boxes](size_t i, float x, float y, float z) {
+                boxes.minX[i] = x - 0.5f;
+                boxes.minY[i] = y - 0.5f;
+                boxes.minZ[i] = z - 0.5f;
+                boxes.maxX[i] = x + 0.5f;
+                boxes.maxY[i] = y + 0.5f;
+                boxes.maxZ[i] = z + 0.5f;
+            };
+
+            for (size_t i = 0; i < count; i++) {
+                setBox(i, place(random), place(random), place(random));
+            }
+
+            const int runs = count > 1000000 ? 1 : 3;
+
+            BVH bvh;
+
+            const double single = bestOf(runs, [&]() {
+                bvh.build(boxes);
+            });
+
+            const double pooled = bestOf(runs, [&]() {
+                bvh.build(boxes, &pool);
+            });
+
+            for (size_t i = 0; i < count; i++) {
+                setBox(i, boxes.minX[i] + 0.5f + nudge(random), boxes.minY[i] + 0.5f + nudge(random), boxes.minZ[i] + 0.5f + nudge(random));
+            }
+
+            const double refit = bestOf(runs, [&]() {
+                bvh.refit(boxes);
+            });
+
+            std::vector<uint32_t> hits(count);
+            std::vector<Box3> regions(queries);
+
+            for (Box3& region : regions) {
+
+                const float x = place(random), y = place(random), z = place(random);
+                const float min[3] = {x - 1.f, y - 1.f, z - 1.f};
+                const float max[3] = {x + 1.f, y + 1.f, z + 1.f};
+
+                region = Box3(min, max);
+            }
+
+            size_t found = 0;
+
+            const double query = bestOf(3, [&]() {
+
+                found = 0;
+
+                for (const Box3& region : regions) {
+                    found += bvh.overlap(region, boxes, hits.data());
+                }
+            });
+
+            fprintf(stderr, "    %8zu boxes  build %9.2f ms, %9.2f ms on the pool  refit %8.2f ms %7.1fx cheaper  overlap %6.2f us, %.1f hits\n",
+                count,
+                single * 1e3,
+                pooled * 1e3,
+                refit * 1e3,
+                pooled / refit,
+                query * 1e6 / queries,
+                (double) found / queries
+            );
+        }
+    }
+
+#pragma endregion BVH }
+
+#pragma region Picking {
+
+    // A 512x512 view of rays through the 100x100x100 grid from the renderer's camera, traced
+    // one at a time and in packets of math::vfloat::lanes, in million rays a second. The two paths
+    // must agree on every hit.
+    static void benchPicking() {
+
+        constexpr uint32_t view = 512;
+        constexpr size_t rayCount = (size_t) view * view;
+
+        const math::float3 origin = {0.f, 0.f, -10.f};
+
+        ThreadPool pool(4);
+        InstanceGrid grid(100, 100, 100, 0.2f, origin);
+        Simulation simulation(origin, 0.12f, 60.0, true);
+
+        grid.animate(0.7f);
+
+        const InstanceBatch batch = grid.batch();
+        const math::float4x4 model = simulation.model(0.7f);
+
+        shader::CameraData camera = {};
+
+        camera.perspectiveTransform = math::perspective(45.f * M_PI / 180.f, 1.f, 0.03f, 500.0f);
+        camera.worldTransform = math::identity();
+
+        std::vector<Ray> rays(rayCount);
+
+        for (uint32_t y = 0; y < view; y++) {
+            for (uint32_t x = 0; x < view; x++) {
+                rays[(size_t) y * view + x] = screenRay(camera, x + 0.5f, y + 0.5f, view, view);
+            }
+        }
+
+        InstancePicker picker;
+
+        const double build = bestOf(1, [&]() {
+            picker.build(batch, 0.8660254f, 0.5f, &pool);
+        });
+
+        fprintf(stderr, "picking, %zu instances, %ux%u rays, %zu-lane packets, tree built in %.1f ms on %u threads\n", batch.count, view, view, math::vfloat::lanes, build * 1e3, pool.size());
+
+        std::vector<PickHit> single(rayCount), packets(rayCount);
+
+        size_t singleHits = 0;
+
+        const double singleSeconds = bestOf(3, [&]() {
+
+            singleHits = 0;
+
+            for (size_t i = 0; i < rayCount; i++) {
+                if (picker.pick(rays[i], model, batch, single[i])) {
+                    singleHits++;
+                } else {
+                    single[i].id = UINT32_MAX;
+                }
+            }
+        });
+
+        size_t packetHits = 0;
+
+        const double packetSeconds = bestOf(3, [&]() {
+            packetHits = picker.pick(rays.data(), rayCount, model, batch, packets.data());
+        });
+
+        size_t differing = 0;
+
+        for (size_t i = 0; i < rayCount; i++) {
+            differing += single[i].id != packets[i].id;
+        }
+
+        fprintf(stderr, "    single  %8.2f ms %8.2f Mray/s %7zu hits\n", singleSeconds * 1e3, rayCount / singleSeconds * 1e-6, singleHits);
+        fprintf(stderr, "    packets %8.2f ms %8.2f Mray/s %7zu hits %6.2fx, %zu rays differ\n", packetSeconds * 1e3, rayCount / packetSeconds * 1e-6, packetHits, singleSeconds / packetSeconds, differing);
+    }
+
+#pragma endregion Picking }
+
+struct Bench {
+
+    const char* name;
+    void (*run)();
+
+};
+
+static const Bench BENCHES[] = {
+    {"math", benchMath},
+    {"instance kernels", benchInstanceKernels},
+    {"instance update", benchInstanceUpdate},
+    {"upload", benchUpload},
+    {"cull", benchCull},
+    {"simulation", benchSimulation},
+    {"pacing", benchPacing},
+    {"frame graph", benchFrameGraph},
+    {"boxes", benchBoxes},
+    {"bvh", benchBVH},
+    {"picking", benchPicking},
+    {"mandelbrot kernels", benchMandelbrotKernels},
+    {"mandelbrot options", benchMandelbrotOptions},
+    {"mandelbrot cache", benchMandelbrotCache},
+};
+
+int main(int argc, char** argv) {
+
+    for (const Bench& bench : BENCHES) {
+
+        bool selected = argc < 2;
+
+        for (int i = 1; i < argc && !selected; i++) {
+            selected = strncmp(bench.name, argv[i], strlen(argv[i])) == 0;
+        }
+
+        if (selected) {
+            bench.run();
+        }
+    }
+
+    return 0;
+}
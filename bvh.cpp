@@ -0,0 +1,485 @@
+#include "bvh.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cfloat>
+
+#pragma region Builder {
+
+    static constexpr size_t BINS = 16;
+    static constexpr uint32_t MIN_LEAF = 2;
+    static constexpr uint32_t MAX_LEAF = 8;
+    static constexpr size_t MAX_DEPTH = 60;
+
+    static constexpr uint32_t PARALLEL_SUBTREE = 1 << 14;
+    static constexpr uint32_t PARALLEL_PASS = 1 << 18;
+
+    struct Bounds {
+
+        float min[3] = {FLT_MAX, FLT_MAX, FLT_MAX};
+        float max[3] = {-FLT_MAX, -FLT_MAX, -FLT_MAX};
+
+        void grow(const float* lo, const float* hi) {
+            for (size_t a = 0; a < 3; a++) {
+                min[a] = lo[a] < min[a] ? lo[a] : min[a];
+                max[a] = hi[a] > max[a] ? hi[a] : max[a];
+            }
+        }
+
+        void grow(const Bounds& b) {
+            grow(b.min, b.max);
+        }
+
+        float area() const {
+
+            float dx = max[0] - min[0], dy = max[1] - min[1], dz = max[2] - min[2];
+
+            return dx < 0.f ? 0.f : dx * dy + dy * dz + dz * dx;
+        }
+
+    };
+
+    struct Extent {
+
+        Bounds box, centroid;
+
+        void merge(const Extent& e) {
+            box.grow(e.box);
+            centroid.grow(e.centroid);
+        }
+
+    };
+
+    struct Bins {
+
+        Bounds box[3][BINS];
+        uint32_t count[3][BINS] = {};
+
+        void merge(const Bins& b) {
+            for (size_t a = 0; a < 3; a++) {
+                for (size_t k = 0; k < BINS; k++) {
+                    box[a][k].grow(b.box[a][k]);
+                    count[a][k] += b.count[a][k];
+                }
+            }
+        }
+
+    };
+
+    // Box and index packed together so the passes over a node stream through memory.
+    struct Ref {
+
+        float lo[3];
+        uint32_t index;
+        float hi[3];
+        float pad;
+
+        float centroid(size_t a) const {
+            return lo[a] + hi[a];
+        }
+
+    };
+
+    // Runs fn over [begin, end) split into a part per pool thread when the range is large and merges
+    // the results.
+    template <typename Result, typename Fn>
+    static Result reduce(uint32_t begin, uint32_t end, ThreadPool* pool, Fn fn) {
+
+        Result result;
+
+        if (!pool || pool -> size() <= 1 || end - begin < PARALLEL_PASS) {
+            fn(begin, end, result);
+            return result;
+        }
+
+        const unsigned parts = pool -> size();
+        const uint32_t step = (end - begin + parts - 1) / parts;
+
+        std::vector<Result> results(parts);
+
+        pool -> parallelFor(0, parts, 1, [&](size_t first, size_t last) {
+            for (size_t t = first; t < last; t++) {
+
+                uint32_t b = begin + std::min(end - begin, step * (uint32_t) t);
+                uint32_t e = begin + std::min(end - begin, step * (uint32_t) (t + 1));
+
+                fn(b, e, results[t]);
+            }
+        });
+
+        for (const Result& part : results) {
+            result.merge(part);
+        }
+
+        return result;
+    }
+
+    struct Builder {
+
+        Ref* refs;
+        BVHNode* nodes;
+
+        std::atomic<uint32_t> used{1};
+
+        void leaf(uint32_t n, uint32_t begin, uint32_t end) {
+            nodes[n].offset = begin;
+            nodes[n].count = end - begin;
+        }
+
+        void node(uint32_t n, const Extent& extent, uint32_t begin, uint32_t end, size_t depth, ThreadPool* pool) {
+
+            BVHNode& self = nodes[n];
+
+            for (size_t a = 0; a < 3; a++) {
+                self.min[a] = extent.box.min[a];
+                self.max[a] = extent.box.max[a];
+            }
+
+            const uint32_t count = end - begin;
+
+            if (count <= MIN_LEAF || depth >= MAX_DEPTH) {
+                leaf(n, begin, end);
+                return;
+            }
+
+            float scale[3];
+
+            for (size_t a = 0; a < 3; a++) {
+                float size = extent.centroid.max[a] - extent.centroid.min[a];
+                scale[a] = size > 0.f ? (float) BINS * (1.f - 1e-6f) / size : 0.f;
+            }
+
+            const float* cmin = extent.centroid.min;
+
+            auto binOf = [&](size_t a, const Ref& r) {
+                size_t k = (size_t) ((r.centroid(a) - cmin[a]) * scale[a]);
+                return k < BINS ? k : BINS - 1;
+            };
+
+            const Bins bins = reduce<Bins>(begin, end, pool, [&](uint32_t b, uint32_t e, Bins& out) {
+                for (uint32_t k = b; k < e; k++) {
+
+                    const Ref& r = refs[k];
+
+                    for (size_t a = 0; a < 3; a++) {
+                        if (scale[a] > 0.f) {
+                            const size_t bin = binOf(a, r);
+                            out.box[a][bin].grow(r.lo, r.hi);
+                            out.count[a][bin]++;
+                        }
+                    }
+                }
+            });
+
+            float bestCost = FLT_MAX;
+            size_t bestAxis = 0, bestBin = 0;
+
+            for (size_t a = 0; a < 3; a++) {
+
+                if (scale[a] <= 0.f) {
+                    continue;
+                }
+
+                float rightArea[BINS];
+                uint32_t rightCount[BINS];
+
+                Bounds right;
+                uint32_t rc = 0;
+
+                for (size_t k = BINS - 1; k > 0; k--) {
+                    right.grow(bins.box[a][k]);
+                    rc += bins.count[a][k];
+                    rightArea[k] = right.area();
+                    rightCount[k] = rc;
+                }
+
+                Bounds left;
+                uint32_t lc = 0;
+
+                for (size_t k = 0; k + 1 < BINS; k++) {
+
+                    left.grow(bins.box[a][k]);
+                    lc += bins.count[a][k];
+
+                    if (lc == 0 || rightCount[k + 1] == 0) {
+                        continue;
+                    }
+
+                    float cost = left.area() * (float) lc + rightArea[k + 1] * (float) rightCount[k + 1];
+
+                    if (cost < bestCost) {
+                        bestCost = cost;
+                        bestAxis = a;
+                        bestBin = k;
+                    }
+                }
+            }
+
+            // Cost relative to a leaf of the same node, counting one unit per traversal step.
+            const float area = extent.box.area();
+            const bool split = bestCost < FLT_MAX;
+
+            if (count <= MAX_LEAF && (!split || 1.f + bestCost / area >= (float) count)) {
+                leaf(n, begin, end);
+                return;
+            }
+
+            uint32_t mid;
+            Extent leftExtent, rightExtent;
+
+            if (split) {
+
+                // Partition and collect the child centroid bounds in the same pass.
+                uint32_t i = begin, j = end;
+
+                while (i < j) {
+
+                    const Ref& r = refs[i];
+
+                    const float c[3] = {r.centroid(0), r.centroid(1), r.centroid(2)};
+
+                    if (binOf(bestAxis, r) <= bestBin) {
+                        leftExtent.centroid.grow(c, c);
+                        i++;
+                    } else {
+                        rightExtent.centroid.grow(c, c);
+                        std::swap(refs[i], refs[--j]);
+                    }
+                }
+
+                mid = i;
+
+                for (size_t k = 0; k < BINS; k++) {
+                    (k <= bestBin ? leftExtent : rightExtent).box.grow(bins.box[bestAxis][k]);
+                }
+            } else {
+
+                // All centroids coincide: halve the range.
+                mid = begin + count / 2;
+
+                auto gather = [this](uint32_t b, uint32_t e, Extent& out) {
+                    for (uint32_t k = b; k < e; k++) {
+
+                        const Ref& r = refs[k];
+
+                        const float c[3] = {r.centroid(0), r.centroid(1), r.centroid(2)};
+
+                        out.box.grow(r.lo, r.hi);
+                        out.centroid.grow(c, c);
+                    }
+                };
+
+                leftExtent = reduce<Extent>(begin, mid, pool, gather);
+                rightExtent = reduce<Extent>(mid, end, pool, gather);
+            }
+
+            const uint32_t left = used.fetch_add(2, std::memory_order_relaxed);
+
+            self.offset = left;
+            self.count = 0;
+
+            if (pool && pool -> size() > 1 && count >= PARALLEL_SUBTREE) {
+
+                // The two halves as tasks of their own; each forks again until they get small.
+                pool -> parallelFor(0, 2, 1, [&](size_t first, size_t last) {
+                    for (size_t c = first; c < last; c++) {
+                        if (c == 0) {
+                            node(left, leftExtent, begin, mid, depth + 1, pool);
+                        } else {
+                            node(left + 1, rightExtent, mid, end, depth + 1, pool);
+                        }
+                    }
+                });
+            } else {
+                node(left, leftExtent, begin, mid, depth + 1, nullptr);
+                node(left + 1, rightExtent, mid, end, depth + 1, nullptr);
+            }
+        }
+
+    };
+
+#pragma endregion Builder }
+
+#pragma region BVH {
+
+    void BVH::build(const BoxBatch& boxes, ThreadPool* pool) {
+
+        const uint32_t count = (uint32_t) boxes.count;
+
+        _indices.resize(count);
+        _nodes.clear();
+
+        if (count == 0) {
+            return;
+        }
+
+        _nodes.resize(2 * (size_t) count);
+
+        std::vector<Ref> refs(count);
+
+        const Extent root = reduce<Extent>(0, count, pool, [&](uint32_t b, uint32_t e, Extent& out) {
+            for (uint32_t i = b; i < e; i++) {
+
+                Ref& r = refs[i];
+
+                r.lo[0] = boxes.minX[i];
+                r.lo[1] = boxes.minY[i];
+                r.lo[2] = boxes.minZ[i];
+                r.hi[0] = boxes.maxX[i];
+                r.hi[1] = boxes.maxY[i];
+                r.hi[2] = boxes.maxZ[i];
+                r.index = i;
+                r.pad = 0.f;
+
+                const float c[3] = {r.centroid(0), r.centroid(1), r.centroid(2)};
+
+                out.box.grow(r.lo, r.hi);
+                out.centroid.grow(c, c);
+            }
+        });
+
+        Builder builder;
+
+        builder.refs = refs.data();
+        builder.nodes = _nodes.data();
+
+        builder.node(0, root, 0, count, 0, pool);
+
+        _nodes.resize(builder.used.load());
+
+        for (uint32_t i = 0; i < count; i++) {
+            _indices[i] = refs[i].index;
+        }
+    }
+
+    void BVH::refit(const BoxBatch& boxes) {
+
+        // Children are always allocated after their parent, so a reverse sweep visits them first.
+        for (size_t n = _nodes.size(); n-- > 0;) {
+
+            BVHNode& node = _nodes[n];
+
+            Bounds b;
+
+            if (node.count > 0) {
+                for (uint32_t k = node.offset; k < node.offset + node.count; k++) {
+
+                    const uint32_t i = _indices[k];
+
+                    const float lo[3] = {boxes.minX[i], boxes.minY[i], boxes.minZ[i]};
+                    const float hi[3] = {boxes.maxX[i], boxes.maxY[i], boxes.maxZ[i]};
+
+                    b.grow(lo, hi);
+                }
+            } else {
+                b.grow(_nodes[node.offset].min, _nodes[node.offset].max);
+                b.grow(_nodes[node.offset + 1].min, _nodes[node.offset + 1].max);
+            }
+
+            for (size_t a = 0; a < 3; a++) {
+                node.min[a] = b.min[a];
+                node.max[a] = b.max[a];
+            }
+        }
+    }
+
+    size_t BVH::overlap(const Box3& query, const BoxBatch& boxes, uint32_t* hits) const {
+
+        if (_nodes.empty()) {
+            return 0;
+        }
+
+        auto overlaps = [&query](const BVHNode& node) {
+            for (size_t a = 0; a < 3; a++) {
+                if (node.max[a] < query.getMin(a) || node.min[a] > query.getMax(a)) {
+                    return false;
+                }
+            }
+            return true;
+        };
+
+        size_t n = 0;
+
+        uint32_t stack[64];
+        size_t top = 0;
+
+        stack[top++] = 0;
+
+        while (top > 0) {
+
+            const BVHNode& node = _nodes[stack[--top]];
+
+            if (!overlaps(node)) {
+                continue;
+            }
+
+            if (node.count == 0) {
+                stack[top++] = node.offset;
+                stack[top++] = node.offset + 1;
+                continue;
+            }
+
+            for (uint32_t k = node.offset; k < node.offset + node.count; k++) {
+
+                const uint32_t i = _indices[k];
+
+                const float lo[3] = {boxes.minX[i], boxes.minY[i], boxes.minZ[i]};
+                const float hi[3] = {boxes.maxX[i], boxes.maxY[i], boxes.maxZ[i]};
+
+                if (query.overlaps(Box3(lo, hi))) {
+                    hits[n++] = i;
+                }
+            }
+        }
+
+        return n;
+    }
+
+#pragma endregion BVH }
+
+#pragma region Bounds {
+
+    void instanceBounds(const math::float4x4& model, const InstanceBatch& batch, float radius, const BoxBatch& out) {
+
+        using math::vfloat;
+
+        const math::affine m = math::toAffine(model);
+
+        constexpr size_t lanes = vfloat::lanes;
+
+        float* mins[3] = {out.minX, out.minY, out.minZ};
+        float* maxs[3] = {out.maxX, out.maxY, out.maxZ};
+
+        size_t i = 0;
+
+        for (; i + lanes <= batch.count; i += lanes) {
+
+            const vfloat x = vfloat::load(batch.x + i);
+            const vfloat y = vfloat::load(batch.y + i);
+            const vfloat z = vfloat::load(batch.z + i);
+            const vfloat r = vfloat::load(batch.scale + i) * vfloat(radius);
+
+            for (size_t a = 0; a < 3; a++) {
+
+                const math::float4& row = m.rows[a];
+
+                const vfloat c = madd(vfloat(row.x), x, madd(vfloat(row.y), y, madd(vfloat(row.z), z, vfloat(row.w))));
+
+                (c - r).store(mins[a] + i);
+                (c + r).store(maxs[a] + i);
+            }
+        }
+
+        for (; i < batch.count; i++) {
+
+            const math::float3 c = m * math::float3(batch.x[i], batch.y[i], batch.z[i]);
+            const float r = batch.scale[i] * radius;
+
+            for (size_t a = 0; a < 3; a++) {
+                mins[a][i] = c[a] - r;
+                maxs[a][i] = c[a] + r;
+            }
+        }
+    }
+
+#pragma endregion Bounds }
@@ -0,0 +1,170 @@
+#ifndef BVH_H
+#define BVH_H
+
+#include <cfloat>
+#include <cstdint>
+#include <vector>
+
+#include "cube.h"
+#include "instances.h"
+#include "threadpool.h"
+
+// 32 bytes, two nodes per cache line. Children are allocated in pairs, so an interior node
+// stores only its left child; the right one follows it.
+struct BVHNode {
+
+    float min[3];
+    uint32_t offset;    // left child for interior nodes, first index for leaves
+    float max[3];
+    uint32_t count;     // 0 for interior nodes
+
+};
+
+static_assert(sizeof(BVHNode) == 32, "BVHNode must stay 32 bytes");
+
+class BVH {
+
+    public:
+
+        // Binned SAH over the centroids. Large subtrees and passes are spread over pool when one
+        // is given.
+        void build(const BoxBatch& boxes, ThreadPool* pool = nullptr);
+
+        // Recomputes the node bounds bottom-up for moved boxes, keeping the topology.
+        // boxes must have the same count as the last build.
+        void refit(const BoxBatch& boxes);
+
+        // Indices of the boxes overlapping query, with boxes as passed to the last build or refit.
+        // Returns the number written to hits.
+        size_t overlap(const Box3& query, const BoxBatch& boxes, uint32_t* hits) const;
+
+        // Nearest hit along origin + t * dir, t in [0, tMax]. hit(index, limit) is called for every box
+        // in the leaves the ray enters, with the nearest distance found so far, and returns the distance
+        // of an exact hit or a negative value for a miss. Returns the index of the nearest hit or
+        // UINT32_MAX, with its distance in t.
+        template <typename Hit>
+        uint32_t intersect(const math::float3& origin, const math::float3& dir, float tMax, Hit&& hit, float& t) const;
+
+        const std::vector<BVHNode>& nodes() const {
+            return _nodes;
+        }
+
+        const uint32_t* indices() const {
+            return _indices.data();
+        }
+
+        size_t count() const {
+            return _indices.size();
+        }
+
+    private:
+
+        std::vector<BVHNode> _nodes;
+        std::vector<uint32_t> _indices;
+
+};
+
+// World-space boxes of instances bounded by spheres of radius scale * radius around model * (x, y, z).
+// The bounds do not depend on the per-instance rotation.
+void instanceBounds(const math::float4x4& model, const InstanceBatch& batch, float radius, const BoxBatch& out);
+
+template <typename Hit>
+uint32_t BVH::intersect(const math::float3& origin, const math::float3& dir, float tMax, Hit&& hit, float& t) const {
+
+    if (_nodes.empty()) {
+        return UINT32_MAX;
+    }
+
+    const float inv[3] = {1.f / dir.x, 1.f / dir.y, 1.f / dir.z};
+    const float o[3] = {origin.x, origin.y, origin.z};
+
+    // Entry distance is left unclamped so that children containing the origin still sort front to back.
+    auto enter = [&](const BVHNode& node, float limit, float& entry) {
+
+        float near = -FLT_MAX, far = limit;
+
+        for (size_t a = 0; a < 3; a++) {
+
+            float t0 = (node.min[a] - o[a]) * inv[a];
+            float t1 = (node.max[a] - o[a]) * inv[a];
+
+            near = fmaxf(near, fminf(t0, t1));
+            far = fminf(far, fmaxf(t0, t1));
+        }
+
+        entry = near;
+
+        return fmaxf(near, 0.f) <= far;
+    };
+
+    uint32_t best = UINT32_MAX;
+    float bestT = tMax;
+
+    // Nodes are pushed with their entry distance and skipped once a nearer hit is known.
+    uint32_t stack[64];
+    float entry[64];
+    size_t top = 0;
+
+    if (!enter(_nodes[0], bestT, entry[0])) {
+        return UINT32_MAX;
+    }
+
+    stack[top++] = 0;
+
+    while (top > 0) {
+
+        top--;
+
+        if (entry[top] > bestT) {
+            continue;
+        }
+
+        const BVHNode& node = _nodes[stack[top]];
+
+        if (node.count > 0) {
+
+            for (uint32_t k = node.offset; k < node.offset + node.count; k++) {
+
+                const uint32_t index = _indices[k];
+
+                float s = hit(index, bestT);
+
+                if (s >= 0.f && s < bestT) {
+                    bestT = s;
+                    best = index;
+                }
+            }
+
+            continue;
+        }
+
+        const uint32_t left = node.offset;
+
+        float tl, tr;
+
+        const bool hl = enter(_nodes[left], bestT, tl);
+        const bool hr = enter(_nodes[left + 1], bestT, tr);
+
+        if (hl && hr) {
+
+            const bool leftFirst = tl < tr;
+
+            stack[top] = leftFirst ? left + 1 : left;
+            entry[top++] = leftFirst ? tr : tl;
+            stack[top] = leftFirst ? left : left + 1;
+            entry[top++] = leftFirst ? tl : tr;
+        } else if (hl) {
+            stack[top] = left;
+            entry[top++] = tl;
+        } else if (hr) {
+            stack[top] = left + 1;
+            entry[top++] = tr;
+        }
+    }
+
+    t = bestT;
+
+    return best;
+}
+
+#endif
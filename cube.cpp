@@ -1,6 +1,237 @@
 #include "cube.h"
 
-Cube::Cube(int a, int b) {
-    min = a;
-    max = b;
-};
+#include <cfloat>
+
+#pragma region BoxArray {
+
+    void BoxArray::resize(size_t count) {
+        _data.resize(count * 6);
+        _count = count;
+    }
+
+    BoxBatch BoxArray::batch() {
+
+        float* base = _data.data();
+
+        return {base, base + _count, base + _count * 2, base + _count * 3, base + _count * 4, base + _count * 5, _count};
+    }
+
+#pragma endregion BoxArray }
+
+#pragma region Batch {
+
+    void transformBoxes(const math::float4x4& transform, const BoxBatch& in, const BoxBatch& out) {
+
+        using math::vfloat;
+
+        const math::float4* m = transform.columns;
+
+        constexpr size_t lanes = vfloat::lanes;
+
+        size_t i = 0;
+
+        for (; i + lanes <= in.count; i += lanes) {
+
+            const vfloat half(0.5f);
+
+            const vfloat loX = vfloat::load(in.minX + i), hiX = vfloat::load(in.maxX + i);
+            const vfloat loY = vfloat::load(in.minY + i), hiY = vfloat::load(in.maxY + i);
+            const vfloat loZ = vfloat::load(in.minZ + i), hiZ = vfloat::load(in.maxZ + i);
+
+            const vfloat cX = (loX + hiX) * half, eX = (hiX - loX) * half;
+            const vfloat cY = (loY + hiY) * half, eY = (hiY - loY) * half;
+            const vfloat cZ = (loZ + hiZ) * half, eZ = (hiZ - loZ) * half;
+
+            vfloat c[3], e[3];
+
+            for (size_t r = 0; r < 3; r++) {
+                c[r] = madd(vfloat(m[0][r]), cX, madd(vfloat(m[1][r]), cY, madd(vfloat(m[2][r]), cZ, vfloat(m[3][r]))));
+                e[r] = madd(vfloat(fabsf(m[0][r])), eX, madd(vfloat(fabsf(m[1][r])), eY, vfloat(fabsf(m[2][r])) * eZ));
+            }
+
+            (c[0] - e[0]).store(out.minX + i);
+            (c[1] - e[1]).store(out.minY + i);
+            (c[2] - e[2]).store(out.minZ + i);
+            (c[0] + e[0]).store(out.maxX + i);
+            (c[1] + e[1]).store(out.maxY + i);
+            (c[2] + e[2]).store(out.maxZ + i);
+        }
+
+        for (; i < in.count; i++) {
+
+            const float cIn[3] = {(in.minX[i] + in.maxX[i]) * 0.5f, (in.minY[i] + in.maxY[i]) * 0.5f, (in.minZ[i] + in.maxZ[i]) * 0.5f};
+            const float eIn[3] = {(in.maxX[i] - in.minX[i]) * 0.5f, (in.maxY[i] - in.minY[i]) * 0.5f, (in.maxZ[i] - in.minZ[i]) * 0.5f};
+
+            float c[3], e[3];
+
+            for (size_t r = 0; r < 3; r++) {
+                c[r] = m[0][r] * cIn[0] + m[1][r] * cIn[1] + m[2][r] * cIn[2] + m[3][r];
+                e[r] = fabsf(m[0][r]) * eIn[0] + fabsf(m[1][r]) * eIn[1] + fabsf(m[2][r]) * eIn[2];
+            }
+
+            out.minX[i] = c[0] - e[0];
+            out.minY[i] = c[1] - e[1];
+            out.minZ[i] = c[2] - e[2];
+            out.maxX[i] = c[0] + e[0];
+            out.maxY[i] = c[1] + e[1];
+            out.maxZ[i] = c[2] + e[2];
+        }
+    }
+
+    Box3 mergeBoxes(const BoxBatch& boxes) {
+
+        using math::vfloat;
+
+        constexpr size_t lanes = vfloat::lanes;
+
+        vfloat lo[3] = {vfloat(FLT_MAX), vfloat(FLT_MAX), vfloat(FLT_MAX)};
+        vfloat hi[3] = {vfloat(-FLT_MAX), vfloat(-FLT_MAX), vfloat(-FLT_MAX)};
+
+        const float* mins[3] = {boxes.minX, boxes.minY, boxes.minZ};
+        const float* maxs[3] = {boxes.maxX, boxes.maxY, boxes.maxZ};
+
+        size_t i = 0;
+
+        for (; i + lanes <= boxes.count; i += lanes) {
+            for (size_t a = 0; a < 3; a++) {
+                lo[a] = math::fmin(lo[a], vfloat::load(mins[a] + i));
+                hi[a] = math::fmax(hi[a], vfloat::load(maxs[a] + i));
+            }
+        }
+
+        float outMin[3], outMax[3];
+
+        for (size_t a = 0; a < 3; a++) {
+
+            float l[lanes], h[lanes];
+
+            lo[a].store(l);
+            hi[a].store(h);
+
+            outMin[a] = l[0];
+            outMax[a] = h[0];
+
+            for (size_t k = 1; k < lanes; k++) {
+                outMin[a] = fminf(outMin[a], l[k]);
+                outMax[a] = fmaxf(outMax[a], h[k]);
+            }
+
+            for (size_t k = i; k < boxes.count; k++) {
+                outMin[a] = fminf(outMin[a], mins[a][k]);
+                outMax[a] = fmaxf(outMax[a], maxs[a][k]);
+            }
+        }
+
+        return Box3(outMin, outMax);
+    }
+
+    size_t overlapBoxes(const Box3& query, const BoxBatch& boxes, uint32_t* hits) {
+
+        using math::vfloat;
+
+        constexpr size_t lanes = vfloat::lanes;
+
+        const vfloat qMinX(query.getMin(0)), qMinY(query.getMin(1)), qMinZ(query.getMin(2));
+        const vfloat qMaxX(query.getMax(0)), qMaxY(query.getMax(1)), qMaxZ(query.getMax(2));
+
+        size_t n = 0;
+        size_t i = 0;
+
+        for (; i + lanes <= boxes.count; i += lanes) {
+
+            // Separating tests, as Box::overlaps makes them, so NaN bounds count as overlapping in both paths.
+            vfloat miss = (vfloat::load(boxes.maxX + i) < qMinX) | (vfloat::load(boxes.minX + i) > qMaxX);
+            miss = miss | (vfloat::load(boxes.maxY + i) < qMinY) | (vfloat::load(boxes.minY + i) > qMaxY);
+            miss = miss | (vfloat::load(boxes.maxZ + i) < qMinZ) | (vfloat::load(boxes.minZ + i) > qMaxZ);
+
+            for (unsigned bits = ~(unsigned) movemask(miss) & ((1u << lanes) - 1); bits; bits &= bits - 1) {
+                hits[n++] = (uint32_t) (i + (size_t) __builtin_ctz(bits));
+            }
+        }
+
+        for (; i < boxes.count; i++) {
+
+            const float lo[3] = {boxes.minX[i], boxes.minY[i], boxes.minZ[i]};
+            const float hi[3] = {boxes.maxX[i], boxes.maxY[i], boxes.maxZ[i]};
+
+            if (query.overlaps(Box3(lo, hi))) {
+                hits[n++] = (uint32_t) i;
+            }
+        }
+
+        return n;
+    }
+
+    size_t intersectBoxes(const math::float3& origin, const math::float3& invDir, float tMin, float tMax, const BoxBatch& boxes, uint32_t* hits, float* tHit) {
+
+        using math::vfloat;
+
+        constexpr size_t lanes = vfloat::lanes;
+
+        const vfloat oX(origin.x), oY(origin.y), oZ(origin.z);
+        const vfloat iX(invDir.x), iY(invDir.y), iZ(invDir.z);
+
+        size_t n = 0;
+        size_t i = 0;
+
+        for (; i + lanes <= boxes.count; i += lanes) {
+
+            const vfloat x0 = (vfloat::load(boxes.minX + i) - oX) * iX, x1 = (vfloat::load(boxes.maxX + i) - oX) * iX;
+            const vfloat y0 = (vfloat::load(boxes.minY + i) - oY) * iY, y1 = (vfloat::load(boxes.maxY + i) - oY) * iY;
+            const vfloat z0 = (vfloat::load(boxes.minZ + i) - oZ) * iZ, z1 = (vfloat::load(boxes.maxZ + i) - oZ) * iZ;
+
+            // fmin and fmax skip the NaN of a zero direction component through a slab plane, as the
+            // scalar tail's fminf and fmaxf do.
+            using math::fmin;
+            using math::fmax;
+
+            const vfloat near = fmax(fmax(fmin(x0, x1), fmin(y0, y1)), fmax(fmin(z0, z1), vfloat(tMin)));
+            const vfloat far = fmin(fmin(fmax(x0, x1), fmax(y0, y1)), fmin(fmax(z0, z1), vfloat(tMax)));
+
+            const vfloat hit = near <= far;
+
+            int bits = movemask(hit);
+
+            if (!bits) {
+                continue;
+            }
+
+            float t[lanes];
+
+            near.store(t);
+
+            for (unsigned b = (unsigned) bits; b; b &= b - 1) {
+
+                const size_t k = (size_t) __builtin_ctz(b);
+
+                if (tHit) {
+                    tHit[n] = t[k];
+                }
+
+                hits[n++] = (uint32_t) (i + k);
+            }
+        }
+
+        for (; i < boxes.count; i++) {
+
+            float x0 = (boxes.minX[i] - origin.x) * invDir.x, x1 = (boxes.maxX[i] - origin.x) * invDir.x;
+            float y0 = (boxes.minY[i] - origin.y) * invDir.y, y1 = (boxes.maxY[i] - origin.y) * invDir.y;
+            float z0 = (boxes.minZ[i] - origin.z) * invDir.z, z1 = (boxes.maxZ[i] - origin.z) * invDir.z;
+
+            float near = fmaxf(fmaxf(fminf(x0, x1), fminf(y0, y1)), fmaxf(fminf(z0, z1), tMin));
+            float far = fminf(fminf(fmaxf(x0, x1), fmaxf(y0, y1)), fminf(fmaxf(z0, z1), tMax));
+
+            if (near <= far) {
+
+                if (tHit) {
+                    tHit[n] = near;
+                }
+
+                hits[n++] = (uint32_t) i;
+            }
+        }
+
+        return n;
+    }
+
+#pragma endregion Batch }
@@ -1,24 +1,136 @@
 #ifndef CUBE_H
 #define CUBE_H
 
-class Cube {
+#include <cstddef>
+#include <cstdint>
+#include <vector>
 
-    private:
+#include "mathlib.h"
 
-        int min, max;
+template <typename T, size_t N>
+class Box {
 
     public:
-    
-        Cube(int, int);
 
-        int getMin() {
-            return min;
+        constexpr Box() : _min{}, _max{} {}
+
+        constexpr Box(T min, T max) : _min{}, _max{} {
+            for (size_t i = 0; i < N; i++) {
+                _min[i] = min;
+                _max[i] = max;
+            }
+        }
+
+        constexpr Box(const T (&min)[N], const T (&max)[N]) : _min{}, _max{} {
+            for (size_t i = 0; i < N; i++) {
+                _min[i] = min[i];
+                _max[i] = max[i];
+            }
+        }
+
+        constexpr T getMin(size_t axis = 0) const {
+            return _min[axis];
+        }
+
+        constexpr T getMax(size_t axis = 0) const {
+            return _max[axis];
+        }
+
+        constexpr bool empty() const {
+            for (size_t i = 0; i < N; i++) {
+                if (_min[i] > _max[i]) {
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        constexpr bool contains(const T (&point)[N]) const {
+            for (size_t i = 0; i < N; i++) {
+                if (point[i] < _min[i] || point[i] > _max[i]) {
+                    return false;
+                }
+            }
+            return true;
+        }
+
+        constexpr bool overlaps(const Box& other) const {
+            for (size_t i = 0; i < N; i++) {
+                if (other._max[i] < _min[i] || other._min[i] > _max[i]) {
+                    return false;
+                }
+            }
+            return true;
         }
 
-        int getMax() {
-            return max;
+        constexpr Box merge(const Box& other) const {
+
+            Box out;
+
+            for (size_t i = 0; i < N; i++) {
+                out._min[i] = other._min[i] < _min[i] ? other._min[i] : _min[i];
+                out._max[i] = other._max[i] > _max[i] ? other._max[i] : _max[i];
+            }
+
+            return out;
+        }
+
+    private:
+
+        T _min[N], _max[N];
+
+};
+
+using Cube = Box<int, 3>;
+
+using Box2 = Box<float, 2>;
+using Box3 = Box<float, 3>;
+
+// Float boxes in SoA form for the batch operations below.
+struct BoxBatch {
+
+    float* minX;
+    float* minY;
+    float* minZ;
+    float* maxX;
+    float* maxY;
+    float* maxZ;
+
+    size_t count;
+
+};
+
+class BoxArray {
+
+    public:
+
+        void resize(size_t count);
+
+        BoxBatch batch();
+
+        size_t size() const {
+            return _count;
         }
 
+    private:
+
+        std::vector<float> _data;
+
+        size_t _count = 0;
+
 };
 
+// Arvo's method: out[i] bounds the image of in[i] under the affine part of transform. out may alias in.
+void transformBoxes(const math::float4x4& transform, const BoxBatch& in, const BoxBatch& out);
+
+// Union of all boxes; empty (min > max) for an empty batch.
+Box3 mergeBoxes(const BoxBatch& boxes);
+
+// Indices of the boxes overlapping query, in order. Returns the number written to hits.
+size_t overlapBoxes(const Box3& query, const BoxBatch& boxes, uint32_t* hits);
+
+// Slab test of the ray origin + t * dir, t in [tMin, tMax], against every box. invDir is 1 / dir
+// per component. Writes the indices hit and, if tHit is not null, their entry distances.
+size_t intersectBoxes(const math::float3& origin, const math::float3& invDir, float tMin, float tMax, const BoxBatch& boxes, uint32_t* hits, float* tHit);
+
 #endif
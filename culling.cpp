@@ -0,0 +1,180 @@
+#include "culling.h"
+
+#include <cstring>
+
+#pragma region Frustum {
+
+    static math::float4 normalizePlane(const math::float4& p) {
+
+        const float inv = 1.f / sqrtf(p.x * p.x + p.y * p.y + p.z * p.z);
+
+        return math::float4(p.x * inv, p.y * inv, p.z * inv, p.w * inv);
+    }
+
+    Frustum extractFrustum(const math::float4x4& viewProjection) {
+
+        const math::float4x4& m = viewProjection;
+
+        math::float4 rows[4];
+
+        for (size_t r = 0; r < 4; r++) {
+            rows[r] = math::float4(m.columns[0][r], m.columns[1][r], m.columns[2][r], m.columns[3][r]);
+        }
+
+        Frustum frustum;
+
+        frustum.planes[0] = normalizePlane(rows[3] + rows[0]);
+        frustum.planes[1] = normalizePlane(rows[3] - rows[0]);
+        frustum.planes[2] = normalizePlane(rows[3] + rows[1]);
+        frustum.planes[3] = normalizePlane(rows[3] - rows[1]);
+        frustum.planes[4] = normalizePlane(rows[2]);
+        frustum.planes[5] = normalizePlane(rows[3] - rows[2]);
+
+        return frustum;
+    }
+
+#pragma endregion Frustum }
+
+#pragma region InstanceCuller {
+
+    void InstanceCuller::reserve(size_t count) {
+
+        if (_ids.size() >= count) {
+            return;
+        }
+
+        _ids.resize(count);
+        _x.resize(count);
+        _y.resize(count);
+        _z.resize(count);
+        _angleY.resize(count);
+        _angleZ.resize(count);
+        _scale.resize(count);
+    }
+
+    size_t InstanceCuller::cull(const Frustum& frustum, const math::float4x4& model, const InstanceBatch& batch, float radius, ThreadPool* pool, std::pmr::memory_resource* scratch) {
+
+        reserve(batch.count);
+
+        const math::affine m = math::toAffine(model);
+
+        // Fold the model transform into the planes so the test runs on untransformed centres.
+        math::float4 planes[6];
+
+        for (size_t p = 0; p < 6; p++) {
+
+            const math::float4& f = frustum.planes[p];
+
+            planes[p] = math::float4(
+                f.x * m.rows[0].x + f.y * m.rows[1].x + f.z * m.rows[2].x,
+                f.x * m.rows[0].y + f.y * m.rows[1].y + f.z * m.rows[2].y,
+                f.x * m.rows[0].z + f.y * m.rows[1].z + f.z * m.rows[2].z,
+                f.x * m.rows[0].w + f.y * m.rows[1].w + f.z * m.rows[2].w + f.w
+            );
+        }
+
+        if (!pool || pool -> size() == 1 || batch.count <= CULL_CHUNK) {
+            _count = cullRange(planes, batch, radius, 0, batch.count);
+            return _count;
+        }
+
+        // Each chunk compacts into the front of its own slice, then the slices are slid together.
+        const size_t chunks = (batch.count + CULL_CHUNK - 1) / CULL_CHUNK;
+
+        std::pmr::vector<size_t> chunkCounts(chunks, scratch ? scratch : std::pmr::get_default_resource());
+
+        pool -> parallelFor(0, chunks, 1, [&](size_t b, size_t e) {
+            for (size_t c = b; c < e; c++) {
+                size_t begin = c * CULL_CHUNK;
+                size_t end = begin + CULL_CHUNK < batch.count ? begin + CULL_CHUNK : batch.count;
+                chunkCounts[c] = cullRange(planes, batch, radius, begin, end);
+            }
+        });
+
+        size_t n = chunkCounts[0];
+
+        for (size_t c = 1; c < chunks; c++) {
+
+            const size_t from = c * CULL_CHUNK;
+            const size_t len = chunkCounts[c];
+
+            memmove(&_ids[n], &_ids[from], len * sizeof(uint32_t));
+            memmove(&_x[n], &_x[from], len * sizeof(float));
+            memmove(&_y[n], &_y[from], len * sizeof(float));
+            memmove(&_z[n], &_z[from], len * sizeof(float));
+            memmove(&_angleY[n], &_angleY[from], len * sizeof(float));
+            memmove(&_angleZ[n], &_angleZ[from], len * sizeof(float));
+            memmove(&_scale[n], &_scale[from], len * sizeof(float));
+
+            n += len;
+        }
+
+        _count = n;
+
+        return n;
+    }
+
+    size_t InstanceCuller::cullRange(const math::float4* planes, const InstanceBatch& batch, float radius, size_t begin, size_t end) {
+
+        using math::vfloat;
+
+        size_t n = begin;
+
+        auto keep = [&](size_t i) {
+            _ids[n] = (uint32_t) i;
+            _x[n] = batch.x[i];
+            _y[n] = batch.y[i];
+            _z[n] = batch.z[i];
+            _angleY[n] = batch.angleY[i];
+            _angleZ[n] = batch.angleZ[i];
+            _scale[n] = batch.scale[i];
+            n++;
+        };
+
+        constexpr size_t lanes = vfloat::lanes;
+
+        size_t i = begin;
+
+        for (; i + lanes <= end; i += lanes) {
+
+            const vfloat x = vfloat::load(batch.x + i);
+            const vfloat y = vfloat::load(batch.y + i);
+            const vfloat z = vfloat::load(batch.z + i);
+            const vfloat r = vfloat::load(batch.scale + i) * vfloat(radius);
+
+            vfloat inside = vfloat(0.f) <= madd(vfloat(planes[0].x), x, madd(vfloat(planes[0].y), y, madd(vfloat(planes[0].z), z, vfloat(planes[0].w) + r)));
+
+            for (size_t p = 1; p < 6; p++) {
+                const math::float4& f = planes[p];
+                inside = inside & (vfloat(0.f) <= madd(vfloat(f.x), x, madd(vfloat(f.y), y, madd(vfloat(f.z), z, vfloat(f.w) + r))));
+            }
+
+            for (unsigned bits = (unsigned) movemask(inside); bits; bits &= bits - 1) {
+                keep(i + (size_t) __builtin_ctz(bits));
+            }
+        }
+
+        for (; i < end; i++) {
+
+            const float r = batch.scale[i] * radius;
+
+            bool inside = true;
+
+            for (size_t p = 0; p < 6; p++) {
+                const math::float4& f = planes[p];
+                inside = inside && f.x * batch.x[i] + f.y * batch.y[i] + f.z * batch.z[i] + f.w + r >= 0.f;
+            }
+
+            if (inside) {
+                keep(i);
+            }
+        }
+
+        return n - begin;
+    }
+
+    InstanceBatch InstanceCuller::visible() const {
+        return {_x.data(), _y.data(), _z.data(), _angleY.data(), _angleZ.data(), _scale.data(), _count};
+    }
+
+#pragma endregion InstanceCuller }
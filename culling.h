@@ -0,0 +1,60 @@
+#ifndef CULLING_H
+#define CULLING_H
+
+#include <cstdint>
+#include <memory_resource>
+#include <vector>
+
+#include "instances.h"
+#include "threadpool.h"
+
+// Planes as (n, d) with |n| = 1 and n . p + d >= 0 on the inside.
+struct Frustum {
+
+    math::float4 planes[6];
+
+};
+
+// Gribb-Hartmann extraction for a clip space with z in [0, w], as produced by math::perspective.
+Frustum extractFrustum(const math::float4x4& viewProjection);
+
+class InstanceCuller {
+
+    public:
+
+        // Tests a bounding sphere per instance, centred at model * (x, y, z) with radius
+        // scale * radius, and compacts the visible ones. The linear part of model is
+        // assumed to be rigid. With a pool, chunks of the batch are tested in parallel, with
+        // their bookkeeping allocated from scratch (the default resource when null).
+        size_t cull(const Frustum& frustum, const math::float4x4& model, const InstanceBatch& batch, float radius, ThreadPool* pool = nullptr, std::pmr::memory_resource* scratch = nullptr);
+
+        // Visible instances in the order of the source batch.
+        InstanceBatch visible() const;
+
+        // Source index of each visible instance.
+        const uint32_t* ids() const {
+            return _ids.data();
+        }
+
+        size_t count() const {
+            return _count;
+        }
+
+    private:
+
+        static constexpr size_t CULL_CHUNK = 16384;
+
+        void reserve(size_t count);
+
+        size_t cullRange(const math::float4* planes, const InstanceBatch& batch, float radius, size_t begin, size_t end);
+
+        std::vector<uint32_t> _ids;
+        std::vector<float> _x, _y, _z;
+        std::vector<float> _angleY, _angleZ;
+        std::vector<float> _scale;
+
+        size_t _count = 0;
+
+};
+
+#endif
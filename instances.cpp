@@ -0,0 +1,571 @@
+#include "instances.h"
+
+#include <cstdint>
+#include <cstdlib>
+
+#if defined(__x86_64__) || defined(__i386__)
+    #include <immintrin.h>
+#endif
+
+#pragma region InstanceGrid {
+
+    InstanceGrid::InstanceGrid(size_t rows, size_t columns, size_t depth, float scale, const math::float3& origin) : _size{rows, columns, depth} {
+
+        const size_t count = rows * columns * depth;
+
+        _x.resize(count);
+        _y.resize(count);
+        _z.resize(count);
+        _rateY.resize(count);
+        _rateZ.resize(count);
+        _angleY.resize(count);
+        _angleZ.resize(count);
+        _scale.resize(count, scale);
+
+        // Every instance is derived from its linear index alone, so any range can be filled independently.
+        for (size_t i = 0; i < count; i++) {
+
+            const size_t xI = i % rows;
+            const size_t yI = (i / rows) % columns;
+            const size_t zI = i / (rows * columns);
+
+            float x = ((float) xI - (float) rows / 2.f) * (2.f * scale) + scale;
+            float y = ((float) yI - (float) columns / 2.f) * (2.f * scale) + scale;
+            float z = ((float) zI - (float) depth / 2.f) * (2.f * scale);
+
+            _x[i] = origin.x + x;
+            _y[i] = origin.y + y;
+            _z[i] = origin.z + z;
+
+            float sinX, cosX, sinY, cosY;
+
+            math::sincos((float) xI, sinX, cosX);
+            math::sincos((float) yI, sinY, cosY);
+
+            _rateY[i] = cosY;
+            _rateZ[i] = sinX;
+        }
+    }
+
+    void InstanceGrid::animate(float angle) {
+        animate(angle, 0, _x.size());
+    }
+
+    void InstanceGrid::animate(float angle, size_t begin, size_t end) {
+        animate(angle, begin, end, _angleY.data(), _angleZ.data());
+    }
+
+    void InstanceGrid::animate(float angle, size_t begin, size_t end, float* angleY, float* angleZ) const {
+        for (size_t i = begin; i < end; i++) {
+            angleY[i] = angle * _rateY[i];
+            angleZ[i] = angle * _rateZ[i];
+        }
+    }
+
+    InstanceBatch InstanceGrid::batch() const {
+        return batch(_angleY.data(), _angleZ.data());
+    }
+
+    InstanceBatch InstanceGrid::batch(const float* angleY, const float* angleZ) const {
+        return {
+            _x.data(), _y.data(), _z.data(),
+            angleY, angleZ,
+            _scale.data(),
+            _x.size()
+        };
+    }
+
+    bool parseGridSize(const char* text, GridSize& size) {
+
+        size_t dims[3];
+
+        for (size_t i = 0; i < 3; i++) {
+
+            if (*text < '0' || *text > '9') {
+                return false;
+            }
+
+            char* end;
+
+            unsigned long long value = strtoull(text, &end, 10);
+
+            if (end == text || value == 0 || value > UINT32_MAX || *end != (i < 2 ? 'x' : '\0')) {
+                return false;
+            }
+
+            dims[i] = (size_t) value;
+            text = end + 1;
+        }
+
+        // Instance ids are 32-bit in the culler and the shaders, so the whole grid must fit in one.
+        if (dims[0] > UINT32_MAX / dims[1] || dims[0] * dims[1] > UINT32_MAX / dims[2]) {
+            return false;
+        }
+
+        size = {dims[0], dims[1], dims[2]};
+
+        return true;
+    }
+
+    void buildStaticInstances(size_t count, shader::StaticInstanceData* out) {
+
+        for (size_t i = 0; i < count; i++) {
+
+            float r = i / (float) count;
+            float b, cosB;
+
+            math::sincos((float) M_PI * 2.0f * r, b, cosB);
+
+            out[i].instanceColor = shader::packColor({r, 1.0f - r, b, 1.0f});
+        }
+    }
+
+#pragma endregion InstanceGrid }
+
+#pragma region Kernels {
+
+    // Every kernel produces fullRot * translate(p) * rotateY(angleY) * rotateZ(angleZ) * scale(s),
+    // expanded in closed form: the per-instance TRS is built directly and pre-multiplied by the
+    // affine part of fullRot. The SIMD kernels keep the 3x4 result in lanes and transpose it
+    // into the output records.
+
+    template <typename Instance>
+    static void buildScalar(const math::float4x4& fullRot, const InstanceBatch& batch, size_t begin, size_t end, Instance* out) {
+
+        const math::affine full = math::toAffine(fullRot);
+
+        for (size_t i = begin; i < end; i++) {
+
+            math::affine local = math::trs({batch.x[i], batch.y[i], batch.z[i]}, batch.angleY[i], batch.angleZ[i], batch.scale[i]);
+
+            shader::setTransform(out[i], full * local);
+        }
+    }
+
+#if defined(__x86_64__) || defined(__i386__)
+
+    __attribute__((target("avx2,fma")))
+    static inline void transposeAVX2(__m256 a, __m256 b, __m256 c, __m256 d, __m256 v[4]) {
+
+        const __m256 t0 = _mm256_unpacklo_ps(a, b);
+        const __m256 t1 = _mm256_unpackhi_ps(a, b);
+        const __m256 t2 = _mm256_unpacklo_ps(c, d);
+        const __m256 t3 = _mm256_unpackhi_ps(c, d);
+
+        v[0] = _mm256_shuffle_ps(t0, t2, 0x44);
+        v[1] = _mm256_shuffle_ps(t0, t2, 0xEE);
+        v[2] = _mm256_shuffle_ps(t1, t3, 0x44);
+        v[3] = _mm256_shuffle_ps(t1, t3, 0xEE);
+    }
+
+    __attribute__((target("avx2,fma")))
+    static inline void storeAVX2(const __m256 m[3][4], shader::InstanceData* out) {
+
+        const __m256 zero = _mm256_setzero_ps();
+        const __m256 one = _mm256_set1_ps(1.f);
+
+        for (size_t c = 0; c < 4; c++) {
+
+            __m256 v[4];
+
+            transposeAVX2(m[0][c], m[1][c], m[2][c], c == 3 ? one : zero, v);
+
+            for (size_t k = 0; k < 4; k++) {
+
+                const __m128 lo = _mm256_castps256_ps128(v[k]);
+                const __m128 hi = _mm256_extractf128_ps(v[k], 1);
+
+                _mm_store_ps(&out[k].instanceTransform.columns[c].x, lo);
+                _mm_store_ps(&out[k + 4].instanceTransform.columns[c].x, hi);
+
+                if (c < 3) {
+                    _mm_store_ps(&out[k].instanceNormalTransform.columns[c].x, lo);
+                    _mm_store_ps(&out[k + 4].instanceNormalTransform.columns[c].x, hi);
+                }
+            }
+        }
+    }
+
+    __attribute__((target("avx2,fma")))
+    static inline void storeAVX2(const __m256 m[3][4], shader::AffineInstanceData* out) {
+
+        for (size_t r = 0; r < 3; r++) {
+
+            __m256 v[4];
+
+            transposeAVX2(m[r][0], m[r][1], m[r][2], m[r][3], v);
+
+            for (size_t k = 0; k < 4; k++) {
+                _mm_storeu_ps(out[k].rows[r], _mm256_castps256_ps128(v[k]));
+                _mm_storeu_ps(out[k + 4].rows[r], _mm256_extractf128_ps(v[k], 1));
+            }
+        }
+    }
+
+    template <typename Instance>
+    __attribute__((target("avx2,fma")))
+    static void buildAVX2(const math::float4x4& fullRot, const InstanceBatch& batch, size_t begin, size_t end, Instance* out) {
+
+        __m256 f[3][4];
+
+        for (size_t r = 0; r < 3; r++) {
+            for (size_t c = 0; c < 4; c++) {
+                f[r][c] = _mm256_set1_ps(fullRot.columns[c][r]);
+            }
+        }
+
+        const __m256 zero = _mm256_setzero_ps();
+
+        size_t i = begin;
+
+        for (; i + 8 <= end; i += 8) {
+
+            alignas(32) float sinY[8], cosY[8], sinZ[8], cosZ[8];
+
+            math::sincos(batch.angleY + i, sinY, cosY, 8);
+            math::sincos(batch.angleZ + i, sinZ, cosZ, 8);
+
+            const __m256 s = _mm256_loadu_ps(batch.scale + i);
+            const __m256 sy = _mm256_load_ps(sinY);
+            const __m256 cy = _mm256_load_ps(cosY);
+            const __m256 sz = _mm256_load_ps(sinZ);
+            const __m256 cz = _mm256_load_ps(cosZ);
+
+            const __m256 scy = _mm256_mul_ps(s, cy);
+            const __m256 ssy = _mm256_mul_ps(s, sy);
+
+            const __m256 l[3][3] = {
+                {_mm256_mul_ps(scy, cz), _mm256_mul_ps(scy, sz), ssy},
+                {_mm256_sub_ps(zero, _mm256_mul_ps(s, sz)), _mm256_mul_ps(s, cz), zero},
+                {_mm256_sub_ps(zero, _mm256_mul_ps(ssy, cz)), _mm256_sub_ps(zero, _mm256_mul_ps(ssy, sz)), scy}
+            };
+
+            const __m256 p[3] = {
+                _mm256_loadu_ps(batch.x + i),
+                _mm256_loadu_ps(batch.y + i),
+                _mm256_loadu_ps(batch.z + i)
+            };
+
+            __m256 m[3][4];
+
+            for (size_t r = 0; r < 3; r++) {
+
+                for (size_t c = 0; c < 3; c++) {
+                    m[r][c] = _mm256_fmadd_ps(f[r][0], l[0][c], _mm256_fmadd_ps(f[r][1], l[1][c], _mm256_mul_ps(f[r][2], l[2][c])));
+                }
+
+                m[r][3] = _mm256_fmadd_ps(f[r][0], p[0], _mm256_fmadd_ps(f[r][1], p[1], _mm256_fmadd_ps(f[r][2], p[2], f[r][3])));
+            }
+
+            storeAVX2(m, out + i);
+        }
+
+        buildScalar(fullRot, batch, i, end, out);
+    }
+
+    // GCC's unmasked unpacks and extracts merge into an uninitialised vector, which -Wmaybe-uninitialized
+    // reports once they are inlined. The masked forms with every lane set and a zero source compile to
+    // the same instructions.
+    static constexpr __mmask16 ALL_LANES = 0xFFFF;
+
+    __attribute__((target("avx512f")))
+    static inline __m128 extractAVX512(__m512 v, int part) {
+        switch (part) {
+            case 0: return _mm512_mask_extractf32x4_ps(_mm_setzero_ps(), 0xF, v, 0);
+            case 1: return _mm512_mask_extractf32x4_ps(_mm_setzero_ps(), 0xF, v, 1);
+            case 2: return _mm512_mask_extractf32x4_ps(_mm_setzero_ps(), 0xF, v, 2);
+            default: return _mm512_mask_extractf32x4_ps(_mm_setzero_ps(), 0xF, v, 3);
+        }
+    }
+
+    __attribute__((target("avx512f")))
+    static inline void transposeAVX512(__m512 a, __m512 b, __m512 c, __m512 d, __m512 v[4]) {
+
+        const __m512 zero = _mm512_setzero_ps();
+
+        const __m512 t0 = _mm512_mask_unpacklo_ps(zero, ALL_LANES, a, b);
+        const __m512 t1 = _mm512_mask_unpackhi_ps(zero, ALL_LANES, a, b);
+        const __m512 t2 = _mm512_mask_unpacklo_ps(zero, ALL_LANES, c, d);
+        const __m512 t3 = _mm512_mask_unpackhi_ps(zero, ALL_LANES, c, d);
+
+        v[0] = _mm512_shuffle_ps(t0, t2, 0x44);
+        v[1] = _mm512_shuffle_ps(t0, t2, 0xEE);
+        v[2] = _mm512_shuffle_ps(t1, t3, 0x44);
+        v[3] = _mm512_shuffle_ps(t1, t3, 0xEE);
+    }
+
+    __attribute__((target("avx512f")))
+    static inline void storeAVX512(const __m512 m[3][4], shader::InstanceData* out) {
+
+        const __m512 zero = _mm512_setzero_ps();
+        const __m512 one = _mm512_set1_ps(1.f);
+
+        for (size_t c = 0; c < 4; c++) {
+
+            __m512 v[4];
+
+            transposeAVX512(m[0][c], m[1][c], m[2][c], c == 3 ? one : zero, v);
+
+            for (size_t k = 0; k < 4; k++) {
+
+                const __m128 q[4] = {
+                    extractAVX512(v[k], 0),
+                    extractAVX512(v[k], 1),
+                    extractAVX512(v[k], 2),
+                    extractAVX512(v[k], 3)
+                };
+
+                for (size_t h = 0; h < 4; h++) {
+
+                    _mm_store_ps(&out[k + 4 * h].instanceTransform.columns[c].x, q[h]);
+
+                    if (c < 3) {
+                        _mm_store_ps(&out[k + 4 * h].instanceNormalTransform.columns[c].x, q[h]);
+                    }
+                }
+            }
+        }
+    }
+
+    __attribute__((target("avx512f")))
+    static inline void storeAVX512(const __m512 m[3][4], shader::AffineInstanceData* out) {
+
+        for (size_t r = 0; r < 3; r++) {
+
+            __m512 v[4];
+
+            transposeAVX512(m[r][0], m[r][1], m[r][2], m[r][3], v);
+
+            for (size_t k = 0; k < 4; k++) {
+                _mm_storeu_ps(out[k].rows[r], extractAVX512(v[k], 0));
+                _mm_storeu_ps(out[k + 4].rows[r], extractAVX512(v[k], 1));
+                _mm_storeu_ps(out[k + 8].rows[r], extractAVX512(v[k], 2));
+                _mm_storeu_ps(out[k + 12].rows[r], extractAVX512(v[k], 3));
+            }
+        }
+    }
+
+    template <typename Instance>
+    __attribute__((target("avx512f")))
+    static void buildAVX512(const math::float4x4& fullRot, const InstanceBatch& batch, size_t begin, size_t end, Instance* out) {
+
+        __m512 f[3][4];
+
+        for (size_t r = 0; r < 3; r++) {
+            for (size_t c = 0; c < 4; c++) {
+                f[r][c] = _mm512_set1_ps(fullRot.columns[c][r]);
+            }
+        }
+
+        const __m512 zero = _mm512_setzero_ps();
+
+        size_t i = begin;
+
+        for (; i + 16 <= end; i += 16) {
+
+            alignas(64) float sinY[16], cosY[16], sinZ[16], cosZ[16];
+
+            math::sincos(batch.angleY + i, sinY, cosY, 16);
+            math::sincos(batch.angleZ + i, sinZ, cosZ, 16);
+
+            const __m512 s = _mm512_loadu_ps(batch.scale + i);
+            const __m512 sy = _mm512_load_ps(sinY);
+            const __m512 cy = _mm512_load_ps(cosY);
+            const __m512 sz = _mm512_load_ps(sinZ);
+            const __m512 cz = _mm512_load_ps(cosZ);
+
+            const __m512 scy = _mm512_mul_ps(s, cy);
+            const __m512 ssy = _mm512_mul_ps(s, sy);
+
+            const __m512 l[3][3] = {
+                {_mm512_mul_ps(scy, cz), _mm512_mul_ps(scy, sz), ssy},
+                {_mm512_sub_ps(zero, _mm512_mul_ps(s, sz)), _mm512_mul_ps(s, cz), zero},
+                {_mm512_sub_ps(zero, _mm512_mul_ps(ssy, cz)), _mm512_sub_ps(zero, _mm512_mul_ps(ssy, sz)), scy}
+            };
+
+            const __m512 p[3] = {
+                _mm512_loadu_ps(batch.x + i),
+                _mm512_loadu_ps(batch.y + i),
+                _mm512_loadu_ps(batch.z + i)
+            };
+
+            __m512 m[3][4];
+
+            for (size_t r = 0; r < 3; r++) {
+
+                for (size_t c = 0; c < 3; c++) {
+                    m[r][c] = _mm512_fmadd_ps(f[r][0], l[0][c], _mm512_fmadd_ps(f[r][1], l[1][c], _mm512_mul_ps(f[r][2], l[2][c])));
+                }
+
+                m[r][3] = _mm512_fmadd_ps(f[r][0], p[0], _mm512_fmadd_ps(f[r][1], p[1], _mm512_fmadd_ps(f[r][2], p[2], f[r][3])));
+            }
+
+            storeAVX512(m, out + i);
+        }
+
+        buildAVX2(fullRot, batch, i, end, out);
+    }
+
+#endif
+
+    // The quaternion encoding composes rotations directly: fullRot's rotation (assumed rigid) times
+    // rotateY(angleY) * rotateZ(angleZ), the latter being a rotation about -z in quaternion terms.
+    static void buildQuaternions(const math::float4x4& fullRot, const InstanceBatch& batch, size_t begin, size_t end, shader::QuatInstanceData* out) {
+
+        using math::vfloat;
+
+        const math::affine full = math::toAffine(fullRot);
+        const math::quat q = math::toQuat(math::discard(fullRot));
+
+        constexpr size_t lanes = vfloat::lanes;
+
+        size_t i = begin;
+
+        for (; i + lanes <= end; i += lanes) {
+
+            vfloat sy, cy, sz, cz;
+
+            math::sincos(vfloat::load(batch.angleY + i) * vfloat(0.5f), sy, cy);
+            math::sincos(vfloat::load(batch.angleZ + i) * vfloat(0.5f), sz, cz);
+
+            const vfloat zero(0.f);
+            const vfloat lx = zero - sy * sz;
+            const vfloat ly = sy * cz;
+            const vfloat lz = zero - cy * sz;
+            const vfloat lw = cy * cz;
+
+            const vfloat px = vfloat::load(batch.x + i);
+            const vfloat py = vfloat::load(batch.y + i);
+            const vfloat pz = vfloat::load(batch.z + i);
+
+            alignas(64) float lanesOut[8][lanes];
+
+            (vfloat(q.w) * lx + vfloat(q.x) * lw + vfloat(q.y) * lz - vfloat(q.z) * ly).store(lanesOut[0]);
+            (vfloat(q.w) * ly - vfloat(q.x) * lz + vfloat(q.y) * lw + vfloat(q.z) * lx).store(lanesOut[1]);
+            (vfloat(q.w) * lz + vfloat(q.x) * ly - vfloat(q.y) * lx + vfloat(q.z) * lw).store(lanesOut[2]);
+            (vfloat(q.w) * lw - vfloat(q.x) * lx - vfloat(q.y) * ly - vfloat(q.z) * lz).store(lanesOut[3]);
+
+            for (size_t r = 0; r < 3; r++) {
+                const math::float4& row = full.rows[r];
+                madd(vfloat(row.x), px, madd(vfloat(row.y), py, madd(vfloat(row.z), pz, vfloat(row.w)))).store(lanesOut[4 + r]);
+            }
+
+            vfloat::load(batch.scale + i).store(lanesOut[7]);
+
+            for (size_t l = 0; l < lanes; l++) {
+
+                shader::QuatInstanceData& ins = out[i + l];
+
+                for (size_t k = 0; k < 4; k++) {
+                    ins.rotation[k] = lanesOut[k][l];
+                }
+
+                for (size_t k = 0; k < 3; k++) {
+                    ins.position[k] = lanesOut[4 + k][l];
+                }
+
+                ins.scale = lanesOut[7][l];
+            }
+        }
+
+        for (; i < end; i++) {
+
+            math::quat local = math::axisAngle({0.f, 1.f, 0.f}, batch.angleY[i]) * math::axisAngle({0.f, 0.f, -1.f}, batch.angleZ[i]);
+            math::float3 position = full * math::float3(batch.x[i], batch.y[i], batch.z[i]);
+
+            shader::setTransform(out[i], q * local, position, batch.scale[i]);
+        }
+    }
+
+#pragma endregion Kernels }
+
+#pragma region Dispatch {
+
+    static bool supportsInstanceKernel(InstanceKernel kernel) {
+
+        switch (kernel) {
+
+            case InstanceKernel::Scalar:
+                return true;
+
+#if defined(__x86_64__) || defined(__i386__)
+            case InstanceKernel::AVX2:
+                return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+
+            case InstanceKernel::AVX512:
+                return __builtin_cpu_supports("avx512f") && supportsInstanceKernel(InstanceKernel::AVX2);
+#endif
+
+            default:
+                return false;
+        }
+    }
+
+    static InstanceKernel detectInstanceKernel() {
+
+#if defined(__x86_64__) || defined(__i386__)
+        __builtin_cpu_init();
+#endif
+
+        if (supportsInstanceKernel(InstanceKernel::AVX512)) {
+            return InstanceKernel::AVX512;
+        }
+
+        if (supportsInstanceKernel(InstanceKernel::AVX2)) {
+            return InstanceKernel::AVX2;
+        }
+
+        return InstanceKernel::Scalar;
+    }
+
+    static InstanceKernel activeKernel = detectInstanceKernel();
+
+    InstanceKernel instanceKernel() {
+        return activeKernel;
+    }
+
+    bool selectInstanceKernel(InstanceKernel kernel) {
+
+        if (!supportsInstanceKernel(kernel)) {
+            return false;
+        }
+
+        activeKernel = kernel;
+
+        return true;
+    }
+
+    template <typename Instance>
+    static void dispatchInstanceTransforms(const math::float4x4& fullRot, const InstanceBatch& batch, size_t begin, size_t end, Instance* out) {
+
+        switch (activeKernel) {
+
+#if defined(__x86_64__) || defined(__i386__)
+            case InstanceKernel::AVX512:
+                buildAVX512(fullRot, batch, begin, end, out);
+                break;
+
+            case InstanceKernel::AVX2:
+                buildAVX2(fullRot, batch, begin, end, out);
+                break;
+#endif
+
+            default:
+                buildScalar(fullRot, batch, begin, end, out);
+                break;
+        }
+    }
+
+    void buildInstanceTransforms(const math::float4x4& fullRot, const InstanceBatch& batch, size_t begin, size_t end, shader::InstanceData* out) {
+        dispatchInstanceTransforms(fullRot, batch, begin, end, out);
+    }
+
+    void buildInstanceTransforms(const math::float4x4& fullRot, const InstanceBatch& batch, size_t begin, size_t end, shader::AffineInstanceData* out) {
+        dispatchInstanceTransforms(fullRot, batch, begin, end, out);
+    }
+
+    void buildInstanceTransforms(const math::float4x4& fullRot, const InstanceBatch& batch, size_t begin, size_t end, shader::QuatInstanceData* out) {
+        buildQuaternions(fullRot, batch, begin, end, out);
+    }
+
+#pragma endregion Dispatch }
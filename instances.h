@@ -0,0 +1,133 @@
+#ifndef INSTANCES_H
+#define INSTANCES_H
+
+#include <vector>
+
+#include "shader.h"
+#include "upload.h"
+
+struct InstanceBatch {
+
+    const float* x;
+    const float* y;
+    const float* z;
+    const float* angleY;
+    const float* angleZ;
+    const float* scale;
+
+    size_t count;
+
+};
+
+struct GridSize {
+
+    size_t rows;
+    size_t columns;
+    size_t depth;
+
+    constexpr size_t count() const {
+        return rows * columns * depth;
+    }
+
+};
+
+// Parses "RxCxD" with positive dimensions, e.g. "100x100x100". Grids of more than UINT32_MAX
+// instances are rejected, as instance ids are 32-bit on the CPU and the GPU.
+bool parseGridSize(const char* text, GridSize& size);
+
+class InstanceGrid {
+
+    public:
+
+        InstanceGrid(size_t rows, size_t columns, size_t depth, float scale, const math::float3& origin);
+
+        InstanceGrid(const GridSize& size, float scale, const math::float3& origin) : InstanceGrid(size.rows, size.columns, size.depth, scale, origin) {}
+
+        void animate(float angle);
+
+        void animate(float angle, size_t begin, size_t end);
+
+        // Writes the angles of [begin, end) to angleY and angleZ, leaving the grid's own untouched.
+        void animate(float angle, size_t begin, size_t end, float* angleY, float* angleZ) const;
+
+        InstanceBatch batch() const;
+
+        // The grid's positions and scales with angles animated elsewhere.
+        InstanceBatch batch(const float* angleY, const float* angleZ) const;
+
+        size_t count() const {
+            return _x.size();
+        }
+
+        const GridSize& size() const {
+            return _size;
+        }
+
+    private:
+
+        GridSize _size;
+        std::vector<float> _x, _y, _z;
+        std::vector<float> _rateY, _rateZ;
+        std::vector<float> _angleY, _angleZ;
+        std::vector<float> _scale;
+
+};
+
+enum class InstanceKernel {
+
+    Scalar,
+    AVX2,
+    AVX512
+
+};
+
+InstanceKernel instanceKernel();
+
+bool selectInstanceKernel(InstanceKernel kernel);
+
+// Fills the per-instance attributes that stay fixed for the lifetime of a grid, indexed by grid id.
+void buildStaticInstances(size_t count, shader::StaticInstanceData* out);
+
+void buildInstanceTransforms(const math::float4x4& fullRot, const InstanceBatch& batch, size_t begin, size_t end, shader::InstanceData* out);
+
+void buildInstanceTransforms(const math::float4x4& fullRot, const InstanceBatch& batch, size_t begin, size_t end, shader::AffineInstanceData* out);
+
+void buildInstanceTransforms(const math::float4x4& fullRot, const InstanceBatch& batch, size_t begin, size_t end, shader::QuatInstanceData* out);
+
+template <typename Instance>
+inline void buildInstanceTransforms(const math::float4x4& fullRot, const InstanceBatch& batch, Instance* out) {
+    buildInstanceTransforms(fullRot, batch, 0, batch.count, out);
+}
+
+// Bytes of records built in cache between streamed copies, well inside L1 with the batch inputs.
+static constexpr size_t INSTANCE_STAGING_BYTES = 16384;
+
+// Same output as buildInstanceTransforms, for outputs in mapped GPU memory: the kernels' scattered
+// stores land in a stack staging block, which is then streamed to out in whole lines.
+template <typename Instance>
+void streamInstanceTransforms(const math::float4x4& fullRot, const InstanceBatch& batch, size_t begin, size_t end, Instance* out) {
+
+    // Whole SIMD blocks, so only the last piece of the range takes the scalar tail.
+    constexpr size_t block = INSTANCE_STAGING_BYTES / sizeof(Instance) / 16 * 16;
+
+    alignas(64) unsigned char storage[block * sizeof(Instance)];
+
+    Instance* staging = reinterpret_cast<Instance*>(storage);
+
+    for (size_t b = begin; b < end; b += block) {
+
+        const size_t n = end - b < block ? end - b : block;
+
+        const InstanceBatch part = {
+            batch.x + b, batch.y + b, batch.z + b,
+            batch.angleY + b, batch.angleZ + b,
+            batch.scale + b,
+            n
+        };
+
+        buildInstanceTransforms(fullRot, part, 0, n, staging);
+        streamCopy(out + b, staging, n * sizeof(Instance));
+    }
+}
+
+#endif
@@ -0,0 +1,85 @@
+#ifndef MAILBOX_H
+#define MAILBOX_H
+
+#include <atomic>
+
+#include "threadpool.h"
+
+// Single-writer, single-reader handoff of the newest value. The writer fills back() and publishes
+// it without ever waiting; the reader picks up whatever was published last, skipping values it
+// never got to, and keeps reading the same one until a newer one arrives. Three slots, one owned
+// by each side and one in the middle, so neither side can touch the slot the other is using.
+template <typename T>
+class TripleBuffer {
+
+    public:
+
+        TripleBuffer() = default;
+
+        TripleBuffer(const TripleBuffer&) = delete;
+        TripleBuffer& operator=(const TripleBuffer&) = delete;
+
+        // Writer: the slot to fill for the next publish().
+        T& back() {
+            return _slots[_back];
+        }
+
+        // Writer: hands back() to the reader and takes the middle slot in its place.
+        void publish() {
+            _back = _middle.exchange(_back | FRESH, std::memory_order_acq_rel) & INDEX;
+        }
+
+        // Reader: whether a value newer than front() is waiting. Stays true until update().
+        bool pending() const {
+            return _middle.load(std::memory_order_relaxed) & FRESH;
+        }
+
+        // Reader: moves front() to the newest published value. False when nothing new arrived.
+        bool update() {
+
+            if (!pending()) {
+                return false;
+            }
+
+            _front = _middle.exchange(_front, std::memory_order_acq_rel) & INDEX;
+
+            return true;
+        }
+
+        // Reader: the value picked up by the last update(). The reader may modify it, and the
+        // writer gets the slot back as its back() once a newer value is picked up.
+        T& front() {
+            return _slots[_front];
+        }
+
+        const T& front() const {
+            return _slots[_front];
+        }
+
+        // Sets every slot to value and forgets anything published. Neither side may be running.
+        void reset(const T& value) {
+
+            for (T& slot : _slots) {
+                slot = value;
+            }
+
+            _back = 0;
+            _middle.store(1, std::memory_order_relaxed);
+            _front = 2;
+        }
+
+    private:
+
+        static constexpr unsigned INDEX = 3;
+        static constexpr unsigned FRESH = 4;
+
+        T _slots[3];
+
+        // Kept on separate lines so the two sides only share the middle index.
+        alignas(CACHE_LINE) std::atomic<unsigned> _middle{1};
+        alignas(CACHE_LINE) unsigned _back = 0;
+        alignas(CACHE_LINE) unsigned _front = 2;
+
+};
+
+#endif
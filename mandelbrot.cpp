@@ -0,0 +1,526 @@
+// Every path has to round exactly like the kernel's separate multiplies and adds, so nothing here
+// may be fused into an FMA: clang honours the standard pragma, GCC needs its own. Both
+// come before the includes so they also cover the shared functions from shader.h.
+#pragma STDC FP_CONTRACT OFF
+
+#if defined(__GNUC__) && !defined(__clang__)
+    #pragma GCC optimize("fp-contract=off")
+#endif
+
+#include "mandelbrot.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+    #include <immintrin.h>
+#endif
+
+// Rows per parallelFor grain; a band of a few rows keeps the uneven escape times balanced.
+static constexpr uint32_t MANDELBROT_BAND = 4;
+
+#pragma region Palette {
+
+    // Float to half, rounding to nearest even, and back: the precision of the kernel's half colour.
+    // A half keeps 11 significant bits, and nothing below 2^-24.
+    static float roundToHalf(float value) {
+
+        if (value == 0.f) {
+            return value;
+        }
+
+        int exponent;
+
+        frexpf(value, &exponent);
+
+        const float step = ldexpf(1.f, std::max(exponent - 11, -24));
+
+        return nearbyintf(value / step) * step;
+    }
+
+    // RGBA8 for every iteration count, as the kernel writes half4(color, color, color, 1).
+    struct Palette {
+
+        // Counts run from 0 to mandelbrotMaxIterations() inclusive.
+        float shades[1001];
+        uint32_t colors[1001];
+
+        Palette() {
+
+            for (uint32_t iter = 0; iter <= shader::mandelbrotMaxIterations(); iter++) {
+
+                shades[iter] = shader::mandelbrotShade(iter);
+
+                const float color = roundToHalf(shades[iter]);
+                const uint32_t level = (uint32_t) lrintf((color < 0.f ? 0.f : (color > 1.f ? 1.f : color)) * 255.f);
+
+                colors[iter] = level | level << 8 | level << 16 | 0xffu << 24;
+            }
+        }
+
+    };
+
+    static const Palette& palette() {
+
+        static const Palette instance;
+
+        return instance;
+    }
+
+    float mandelbrotFrameZoom(uint32_t frame) {
+        return shader::mandelbrotZoom(frame);
+    }
+
+    const float* mandelbrotShades() {
+        return palette().shades;
+    }
+
+#pragma endregion Palette }
+
+#pragma region Kernels {
+
+    static uint64_t rowsScalar(uint32_t width, uint32_t height, float zoom, uint32_t options, uint32_t rowBegin, uint32_t rowEnd, uint32_t x0, uint32_t* out) {
+
+        const uint32_t* colors = palette().colors;
+
+        uint64_t steps = 0;
+
+        for (uint32_t y = rowBegin; y < rowEnd; y++) {
+            for (uint32_t x = x0; x < width; x++) {
+
+                const shader::MandelbrotEscape escape = shader::mandelbrotEscape(shader::mandelbrotPoint(zoom, x, y, width, height), options);
+
+                out[(size_t) y * width + x] = colors[escape.iter];
+                steps += escape.steps;
+            }
+        }
+
+        return steps;
+    }
+
+#if defined(__x86_64__) || defined(__i386__)
+
+    // Eight pixels a step. Each lane runs the scalar loop's exact float operations, unfused, and
+    // drops out of the count once it escapes; the step ends when every lane has. Lanes found to be
+    // interior, up front or by a cycle, drop out too and are coloured as never escaping.
+    __attribute__((target("avx2")))
+    static uint64_t rowsAVX2(uint32_t width, uint32_t height, float zoom, uint32_t options, uint32_t rowBegin, uint32_t rowEnd, uint32_t* out) {
+
+        const uint32_t* colors = palette().colors;
+        const uint32_t maxIter = shader::mandelbrotMaxIterations();
+
+        const bool skipBulbs = options & shader::MandelbrotSkipBulbs;
+        const bool skipCycles = options & shader::MandelbrotSkipCycles;
+
+        const __m256 four = _mm256_set1_ps(4.f);
+        const __m256 two = _mm256_set1_ps(2.f);
+
+        const uint32_t vectorWidth = width / 8 * 8;
+
+        uint64_t steps = 0;
+
+        for (uint32_t y = rowBegin; y < rowEnd; y++) {
+
+            for (uint32_t x = 0; x < vectorWidth; x += 8) {
+
+                alignas(32) float cx[8];
+                alignas(32) float cy[8];
+                alignas(32) int32_t interior[8];
+                alignas(32) uint32_t counts[8];
+
+                for (uint32_t l = 0; l < 8; l++) {
+
+                    const shader::MandelbrotPoint c = shader::mandelbrotPoint(zoom, x + l, y, width, height);
+
+                    cx[l] = c.x;
+                    cy[l] = c.y;
+                    interior[l] = skipBulbs && shader::mandelbrotInterior(c) ? -1 : 0;
+                }
+
+                const __m256 cX = _mm256_load_ps(cx);
+                const __m256 cY = _mm256_load_ps(cy);
+
+                __m256 zX = _mm256_setzero_ps();
+                __m256 zY = _mm256_setzero_ps();
+                __m256 cycleX = _mm256_setzero_ps();
+                __m256 cycleY = _mm256_setzero_ps();
+                __m256 captured = _mm256_castsi256_ps(_mm256_load_si256(reinterpret_cast<const __m256i*>(interior)));
+                __m256 active = _mm256_xor_ps(captured, _mm256_castsi256_ps(_mm256_set1_epi32(-1)));
+                __m256i iter = _mm256_setzero_si256();
+
+                uint32_t cyclePower = 1;
+                uint32_t cycleSteps = 0;
+
+                for (uint32_t k = 0; k < maxIter; k++) {
+
+                    const __m256 x2 = _mm256_mul_ps(zX, zX);
+                    const __m256 y2 = _mm256_mul_ps(zY, zY);
+
+                    active = _mm256_and_ps(active, _mm256_cmp_ps(_mm256_add_ps(x2, y2), four, _CMP_LE_OQ));
+
+                    if (_mm256_testz_ps(active, active)) {
+                        break;
+                    }
+
+                    const __m256 tempX = _mm256_add_ps(_mm256_sub_ps(x2, y2), cX);
+
+                    zY = _mm256_add_ps(_mm256_mul_ps(_mm256_mul_ps(two, zX), zY), cY);
+                    zX = tempX;
+
+                    // Active lanes are all ones, so subtracting the mask counts them.
+                    iter = _mm256_sub_epi32(iter, _mm256_castps_si256(active));
+
+                    if (skipCycles) {
+
+                        const __m256 cycled = _mm256_and_ps(active, _mm256_and_ps(_mm256_cmp_ps(zX, cycleX, _CMP_EQ_OQ), _mm256_cmp_ps(zY, cycleY, _CMP_EQ_OQ)));
+
+                        captured = _mm256_or_ps(captured, cycled);
+                        active = _mm256_andnot_ps(cycled, active);
+
+                        // Every lane started together, so one counter serves them all.
+                        if (++cycleSteps == cyclePower) {
+                            cycleX = zX;
+                            cycleY = zY;
+                            cyclePower *= 2;
+                            cycleSteps = 0;
+                        }
+                    }
+                }
+
+                _mm256_store_si256(reinterpret_cast<__m256i*>(counts), iter);
+                _mm256_store_si256(reinterpret_cast<__m256i*>(interior), _mm256_castps_si256(captured));
+
+                for (uint32_t l = 0; l < 8; l++) {
+                    out[(size_t) y * width + x + l] = colors[interior[l] ? maxIter : counts[l]];
+                    steps += counts[l];
+                }
+            }
+        }
+
+        if (vectorWidth < width) {
+            steps += rowsScalar(width, height, zoom, options, rowBegin, rowEnd, vectorWidth, out);
+        }
+
+        return steps;
+    }
+
+    __attribute__((target("avx512f")))
+    static uint64_t rowsAVX512(uint32_t width, uint32_t height, float zoom, uint32_t options, uint32_t rowBegin, uint32_t rowEnd, uint32_t* out) {
+
+        const uint32_t* colors = palette().colors;
+        const uint32_t maxIter = shader::mandelbrotMaxIterations();
+
+        const bool skipBulbs = options & shader::MandelbrotSkipBulbs;
+        const bool skipCycles = options & shader::MandelbrotSkipCycles;
+
+        const __m512 four = _mm512_set1_ps(4.f);
+        const __m512 two = _mm512_set1_ps(2.f);
+        const __m512i one = _mm512_set1_epi32(1);
+
+        const uint32_t vectorWidth = width / 16 * 16;
+
+        uint64_t steps = 0;
+
+        for (uint32_t y = rowBegin; y < rowEnd; y++) {
+
+            for (uint32_t x = 0; x < vectorWidth; x += 16) {
+
+                alignas(64) float cx[16];
+                alignas(64) float cy[16];
+                alignas(64) uint32_t counts[16];
+
+                __mmask16 captured = 0;
+
+                for (uint32_t l = 0; l < 16; l++) {
+
+                    const shader::MandelbrotPoint c = shader::mandelbrotPoint(zoom, x + l, y, width, height);
+
+                    cx[l] = c.x;
+                    cy[l] = c.y;
+
+                    if (skipBulbs && shader::mandelbrotInterior(c)) {
+                        captured |= (__mmask16) (1u << l);
+                    }
+                }
+
+                const __m512 cX = _mm512_load_ps(cx);
+                const __m512 cY = _mm512_load_ps(cy);
+
+                __m512 zX = _mm512_setzero_ps();
+                __m512 zY = _mm512_setzero_ps();
+                __m512 cycleX = _mm512_setzero_ps();
+                __m512 cycleY = _mm512_setzero_ps();
+                __mmask16 active = (__mmask16) ~captured;
+                __m512i iter = _mm512_setzero_si512();
+
+                uint32_t cyclePower = 1;
+                uint32_t cycleSteps = 0;
+
+                for (uint32_t k = 0; k < maxIter; k++) {
+
+                    const __m512 x2 = _mm512_mul_ps(zX, zX);
+                    const __m512 y2 = _mm512_mul_ps(zY, zY);
+
+                    active = _mm512_mask_cmp_ps_mask(active, _mm512_add_ps(x2, y2), four, _CMP_LE_OQ);
+
+                    if (!active) {
+                        break;
+                    }
+
+                    const __m512 tempX = _mm512_add_ps(_mm512_sub_ps(x2, y2), cX);
+
+                    zY = _mm512_add_ps(_mm512_mul_ps(_mm512_mul_ps(two, zX), zY), cY);
+                    zX = tempX;
+
+                    iter = _mm512_mask_add_epi32(iter, active, iter, one);
+
+                    if (skipCycles) {
+
+                        const __mmask16 cycled = _mm512_mask_cmp_ps_mask(_mm512_mask_cmp_ps_mask(active, zX, cycleX, _CMP_EQ_OQ), zY, cycleY, _CMP_EQ_OQ);
+
+                        captured |= cycled;
+                        active &= (__mmask16) ~cycled;
+
+                        if (++cycleSteps == cyclePower) {
+                            cycleX = zX;
+                            cycleY = zY;
+                            cyclePower *= 2;
+                            cycleSteps = 0;
+                        }
+                    }
+                }
+
+                _mm512_store_si512(counts, iter);
+
+                for (uint32_t l = 0; l < 16; l++) {
+                    out[(size_t) y * width + x + l] = colors[(captured >> l) & 1 ? maxIter : counts[l]];
+                    steps += counts[l];
+                }
+            }
+        }
+
+        if (vectorWidth < width) {
+            steps += rowsScalar(width, height, zoom, options, rowBegin, rowEnd, vectorWidth, out);
+        }
+
+        return steps;
+    }
+
+#endif
+
+#pragma endregion Kernels }
+
+#pragma region Dispatch {
+
+    static bool supportsMandelbrotKernel(MandelbrotKernel kernel) {
+
+        switch (kernel) {
+
+            case MandelbrotKernel::Scalar:
+                return true;
+
+#if defined(__x86_64__) || defined(__i386__)
+            case MandelbrotKernel::AVX2:
+                return __builtin_cpu_supports("avx2");
+
+            case MandelbrotKernel::AVX512:
+                return __builtin_cpu_supports("avx512f");
+#endif
+
+            default:
+                return false;
+        }
+    }
+
+    static MandelbrotKernel detectMandelbrotKernel() {
+
+#if defined(__x86_64__) || defined(__i386__)
+        __builtin_cpu_init();
+#endif
+
+        if (supportsMandelbrotKernel(MandelbrotKernel::AVX512)) {
+            return MandelbrotKernel::AVX512;
+        }
+
+        if (supportsMandelbrotKernel(MandelbrotKernel::AVX2)) {
+            return MandelbrotKernel::AVX2;
+        }
+
+        return MandelbrotKernel::Scalar;
+    }
+
+    static MandelbrotKernel activeKernel = detectMandelbrotKernel();
+
+    MandelbrotKernel mandelbrotKernel() {
+        return activeKernel;
+    }
+
+    bool selectMandelbrotKernel(MandelbrotKernel kernel) {
+
+        if (!supportsMandelbrotKernel(kernel)) {
+            return false;
+        }
+
+        activeKernel = kernel;
+
+        return true;
+    }
+
+    uint64_t renderMandelbrotRows(uint32_t width, uint32_t height, uint32_t frame, uint32_t options, uint32_t rowBegin, uint32_t rowEnd, uint32_t* out) {
+
+        const float zoom = mandelbrotFrameZoom(frame);
+
+        switch (activeKernel) {
+
+#if defined(__x86_64__) || defined(__i386__)
+            case MandelbrotKernel::AVX512:
+                return rowsAVX512(width, height, zoom, options, rowBegin, rowEnd, out);
+
+            case MandelbrotKernel::AVX2:
+                return rowsAVX2(width, height, zoom, options, rowBegin, rowEnd, out);
+#endif
+
+            default:
+                return rowsScalar(width, height, zoom, options, rowBegin, rowEnd, 0, out);
+        }
+    }
+
+    uint64_t renderMandelbrot(uint32_t width, uint32_t height, uint32_t frame, uint32_t options, uint32_t* out, ThreadPool* pool) {
+
+        if (!pool) {
+            return renderMandelbrotRows(width, height, frame, options, 0, height, out);
+        }
+
+        std::atomic<uint64_t> steps{0};
+
+        pool -> parallelFor(0, height, MANDELBROT_BAND, [&](size_t begin, size_t end) {
+            steps.fetch_add(renderMandelbrotRows(width, height, frame, options, (uint32_t) begin, (uint32_t) end, out), std::memory_order_relaxed);
+        });
+
+        return steps.load(std::memory_order_relaxed);
+    }
+
+    bool parseMandelbrotOptions(const char* text, uint32_t& options) {
+
+        if (strcmp(text, "none") == 0) {
+            options = 0;
+        } else if (strcmp(text, "bulbs") == 0) {
+            options = shader::MandelbrotSkipBulbs;
+        } else if (strcmp(text, "cycles") == 0) {
+            options = shader::MandelbrotSkipCycles;
+        } else if (strcmp(text, "all") == 0) {
+            options = shader::MandelbrotSkipBulbs | shader::MandelbrotSkipCycles;
+        } else {
+            return false;
+        }
+
+        return true;
+    }
+
+#pragma endregion Dispatch }
+
+#pragma region Benchmark {
+
+    // Indexed by MandelbrotKernel.
+    static constexpr const char* KERNEL_NAMES[] = {"scalar", "avx2", "avx512"};
+
+    void benchmarkMandelbrot(uint32_t width, uint32_t height, uint32_t frames, uint32_t options, ThreadPool& pool) {
+
+        static constexpr MandelbrotKernel kernels[] = {MandelbrotKernel::Scalar, MandelbrotKernel::AVX2, MandelbrotKernel::AVX512};
+
+        const MandelbrotKernel active = activeKernel;
+
+        std::vector<uint32_t> image((size_t) width * height);
+
+        fprintf(stderr, "mandelbrot %ux%u, %u frames, options %u, %u threads\n", width, height, frames, options, pool.size());
+
+        double baseline = 0.0;
+
+        for (size_t k = 0; k < sizeof(kernels) / sizeof(kernels[0]); k++) {
+
+            if (!selectMandelbrotKernel(kernels[k])) {
+                continue;
+            }
+
+            for (ThreadPool* threads : {(ThreadPool*) nullptr, &pool}) {
+
+                const auto start = std::chrono::steady_clock::now();
+
+                uint64_t iterations = 0;
+
+                for (uint32_t frame = 0; frame < frames; frame++) {
+                    iterations += renderMandelbrot(width, height, frame, options, image.data(), threads);
+                }
+
+                const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+                const double rate = (double) iterations / seconds * 1e-6;
+
+                if (baseline == 0.0) {
+                    baseline = rate;
+                }
+
+                fprintf(stderr, "    %-6s %-6s %8.2f ms/frame %9.0f Mpixel*iter/s %6.2fx\n",
+                    KERNEL_NAMES[(size_t) kernels[k]],
+                    threads ? "pool" : "single",
+                    seconds * 1e3 / frames,
+                    rate,
+                    rate / baseline
+                );
+            }
+        }
+
+        activeKernel = active;
+    }
+
+    void benchmarkMandelbrotOptions(uint32_t width, uint32_t height, uint32_t stride, ThreadPool& pool) {
+
+        static constexpr uint32_t options[] = {0, shader::MandelbrotSkipBulbs, shader::MandelbrotSkipCycles, shader::MandelbrotSkipBulbs | shader::MandelbrotSkipCycles};
+        static constexpr const char* names[] = {"none", "bulbs", "cycles", "all"};
+        static constexpr size_t count = sizeof(options) / sizeof(options[0]);
+
+        const size_t pixels = (size_t) width * height;
+
+        std::vector<uint32_t> reference(pixels);
+        std::vector<uint32_t> image(pixels);
+
+        uint64_t steps[count] = {};
+        uint64_t differing[count] = {};
+        double seconds[count] = {};
+        uint32_t frames = 0;
+
+        for (uint32_t frame = 0; frame < MANDELBROT_CYCLE; frame += stride, frames++) {
+            for (size_t o = 0; o < count; o++) {
+
+                uint32_t* target = o == 0 ? reference.data() : image.data();
+
+                const auto start = std::chrono::steady_clock::now();
+
+                steps[o] += renderMandelbrot(width, height, frame, options[o], target, &pool);
+
+                seconds[o] += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+                for (size_t i = 0; o > 0 && i < pixels; i++) {
+                    differing[o] += target[i] != reference[i];
+                }
+            }
+        }
+
+        fprintf(stderr, "mandelbrot %ux%u, %u of %u frames, %s kernel, %u threads\n", width, height, frames, MANDELBROT_CYCLE, KERNEL_NAMES[(size_t) activeKernel], pool.size());
+
+        for (size_t o = 0; o < count; o++) {
+            fprintf(stderr, "    %-6s %8.1f iter/pixel %8.3f ms/frame %6.2fx %8llu pixels differ\n",
+                names[o],
+                (double) steps[o] / ((double) pixels * frames),
+                seconds[o] * 1e3 / frames,
+                seconds[0] / seconds[o],
+                (unsigned long long) differing[o]
+            );
+        }
+    }
+
+#pragma endregion Benchmark }
@@ -0,0 +1,53 @@
+#ifndef MANDELBROT_H
+#define MANDELBROT_H
+
+#include <cstdint>
+
+#include "shader.h"
+#include "threadpool.h"
+
+// Frames in the texture animation before the id wraps.
+static constexpr uint32_t MANDELBROT_CYCLE = 5000;
+
+enum class MandelbrotKernel {
+
+    Scalar,
+    AVX2,
+    AVX512
+
+};
+
+MandelbrotKernel mandelbrotKernel();
+
+bool selectMandelbrotKernel(MandelbrotKernel kernel);
+
+// The zoom of an animation frame, and the shade of every iteration count from 0 to
+// shader::mandelbrotMaxIterations(), as mandelbrot.cpp computes them unfused. The compute kernel
+// takes both from here instead of running its own cos and pow.
+float mandelbrotFrameZoom(uint32_t frame);
+
+const float* mandelbrotShades();
+
+// CPU version of the mandelbrotSet compute kernel. Writes rows [rowBegin, rowEnd) of a
+// width x height image as RGBA8, four bytes a pixel in rows of width pixels, the same bytes the
+// kernel stores in its RGBA8Unorm texture. options are shader::MandelbrotOption bits. Returns the
+// loop iterations actually run for those rows: points the bulb test skips add none and points
+// caught in a cycle add the steps taken before it was seen.
+uint64_t renderMandelbrotRows(uint32_t width, uint32_t height, uint32_t frame, uint32_t options, uint32_t rowBegin, uint32_t rowEnd, uint32_t* out);
+
+// The whole image, with bands of rows spread over pool when one is given.
+uint64_t renderMandelbrot(uint32_t width, uint32_t height, uint32_t frame, uint32_t options, uint32_t* out, ThreadPool* pool = nullptr);
+
+// Parses none, bulbs, cycles or all into shader::MandelbrotOption bits.
+bool parseMandelbrotOptions(const char* text, uint32_t& options);
+
+// Renders frames [0, frames) of the animation at width x height with every supported kernel, alone
+// and on pool, and prints the throughput of each in Mpixel*iter/s to stderr.
+void benchmarkMandelbrot(uint32_t width, uint32_t height, uint32_t frames, uint32_t options, ThreadPool& pool);
+
+// Renders every stride-th frame of the animation with each combination of options on the active
+// kernel and pool, and prints the iterations actually run per pixel, the time per frame and the
+// pixels that differ from the full loop.
+void benchmarkMandelbrotOptions(uint32_t width, uint32_t height, uint32_t stride, ThreadPool& pool);
+
+#endif
@@ -0,0 +1,802 @@
+#include "mandelbrotcache.h"
+
+#include <cassert>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "upload.h"
+
+// Bumped whenever the file layout or the CPU colouring changes.
+static constexpr uint32_t STORE_VERSION = 1;
+static constexpr char STORE_MAGIC[8] = {'P', 'E', 'R', 'S', 'M', 'B', 'C', '\0'};
+
+static constexpr size_t STORE_PAGE = 4096;
+static constexpr size_t STORE_FRAME_ALIGNMENT = 64;
+
+struct StoreHeader {
+
+    char magic[8];
+    uint32_t version;
+    uint32_t width;
+    uint32_t height;
+    uint32_t options;
+    uint32_t frames;
+    uint32_t encoding;
+    uint64_t source;
+
+};
+
+#pragma region Encoding {
+
+    // FNV-1a of the kernel source, so a store made by another version of the kernel is not reused.
+    static uint64_t sourceHash() {
+
+        static const char source[] = SHADER_MANDELBROT_SOURCE;
+
+        uint64_t hash = 0xcbf29ce484222325ull;
+
+        for (size_t i = 0; i + 1 < sizeof(source); i++) {
+            hash = (hash ^ (uint8_t) source[i]) * 0x100000001b3ull;
+        }
+
+        return hash;
+    }
+
+    // Runs of up to 255 pixels of one grey level as (length, level) byte pairs. Fails for a pixel
+    // that is not opaque grey, which the palette never produces.
+    static bool encodeGreyRuns(const uint32_t* pixels, size_t count, std::vector<uint8_t>& out) {
+
+        out.clear();
+
+        size_t i = 0;
+
+        while (i < count) {
+
+            const uint32_t pixel = pixels[i];
+            const uint32_t level = pixel & 0xff;
+
+            if (pixel != (level | level << 8 | level << 16 | 0xffu << 24)) {
+                return false;
+            }
+
+            size_t run = 1;
+
+            while (run < 255 && i + run < count && pixels[i + run] == pixel) {
+                run++;
+            }
+
+            out.push_back((uint8_t) run);
+            out.push_back((uint8_t) level);
+
+            i += run;
+        }
+
+        return true;
+    }
+
+    static bool decodeGreyRuns(const uint8_t* data, size_t size, uint32_t* pixels, size_t count) {
+
+        size_t written = 0;
+
+        for (size_t i = 0; i + 1 < size; i += 2) {
+
+            const size_t run = data[i];
+            const uint32_t level = data[i + 1];
+
+            if (run == 0 || written + run > count) {
+                return false;
+            }
+
+            const uint32_t pixel = level | level << 8 | level << 16 | 0xffu << 24;
+
+            for (size_t r = 0; r < run; r++) {
+                pixels[written++] = pixel;
+            }
+        }
+
+        return size % 2 == 0 && written == count;
+    }
+
+    // Two running sums over 32-bit words, enough to notice a frame that was cut short or overwritten.
+    static uint64_t checksum(const uint8_t* data, size_t size) {
+
+        uint64_t a = 1;
+        uint64_t b = 0;
+        size_t i = 0;
+
+        for (; i + 4 <= size; i += 4) {
+
+            uint32_t word;
+
+            memcpy(&word, data + i, sizeof(word));
+
+            a += word;
+            b += a;
+        }
+
+        for (; i < size; i++) {
+            a += data[i];
+            b += a;
+        }
+
+        return a ^ (b << 32 | b >> 32);
+    }
+
+#pragma endregion Encoding }
+
+#pragma region MandelbrotCache {
+
+    MandelbrotCache::MandelbrotCache(uint32_t width, uint32_t height, uint32_t options, size_t memoryFrames, const char* storePath, Encoding encoding) : _width(width), _height(height), _options(options), _pixels((size_t) width * height), _encoding(encoding) {
+
+        const size_t frames = memoryFrames < MANDELBROT_CYCLE ? memoryFrames : MANDELBROT_CYCLE;
+
+        _memory.resize(frames * _pixels);
+        _slots.resize(frames);
+        _slotOf.assign(frames > 0 ? MANDELBROT_CYCLE : 0, NONE);
+
+        if (frames == 0) {
+            _single.resize(_pixels);
+        }
+
+        if (storePath && !openStore(storePath)) {
+            fprintf(stderr, "mandelbrot cache: cannot use %s, keeping frames in memory only\n", storePath);
+        }
+
+        if (_fd >= 0) {
+
+            _writeBehind.resize(WRITE_BEHIND * _pixels);
+            _deferred.reserve(WRITE_BEHIND);
+
+            for (uint32_t b = WRITE_BEHIND; b-- > 0;) {
+                _freeBuffers.push_back(b);
+            }
+
+            _background = std::thread(&MandelbrotCache::runBackground, this);
+        }
+    }
+
+    // Writes still queued are dropped; their frames are rendered again next time.
+    MandelbrotCache::~MandelbrotCache() {
+
+        {
+            std::lock_guard<std::mutex> guard(_storeLock);
+            _stopping.store(true, std::memory_order_relaxed);
+        }
+
+        _work.notify_all();
+
+        if (_background.joinable()) {
+            _background.join();
+        }
+
+        closeStore();
+    }
+
+    const uint32_t* MandelbrotCache::frame(uint32_t frame, ThreadPool* pool) {
+
+        assert(frame < MANDELBROT_CYCLE);
+
+        const auto start = std::chrono::steady_clock::now();
+
+        const uint32_t* result = memoryFind(frame);
+
+        _lookups++;
+
+        if (result) {
+            _memoryHits++;
+        } else {
+
+            Entry entry = {0, 0, 0, 0};
+
+            const uint8_t* stored = _fd >= 0 ? storeFind(frame, entry) : nullptr;
+
+            if (stored && entry.encoding == (uint32_t) Encoding::Raw) {
+                _storeHits++;
+                result = reinterpret_cast<const uint32_t*>(stored);
+            } else {
+
+                uint32_t* target = memoryInsert(frame);
+
+                if (stored && decodeGreyRuns(stored, entry.size, target, _pixels)) {
+                    _storeHits++;
+                } else {
+
+                    renderMandelbrot(_width, _height, frame, _options, target, pool);
+
+                    _misses++;
+
+                    // An entry that storeFind or the decoder rejected is damaged and gets replaced.
+                    if (_fd >= 0) {
+                        defer(frame, target, entry.size > 0);
+                    }
+                }
+
+                result = target;
+            }
+        }
+
+        _lookup.record((uint64_t) std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count());
+
+        return result;
+    }
+
+    void MandelbrotCache::prebake(uint32_t first) {
+
+        if (_fd < 0 || _prebaking.load(std::memory_order_acquire)) {
+            return;
+        }
+
+        {
+            std::lock_guard<std::mutex> guard(_storeLock);
+
+            _bakeRequested = true;
+            _bakeFirst = first % MANDELBROT_CYCLE;
+            _prebaking.store(true, std::memory_order_relaxed);
+        }
+
+        _work.notify_one();
+    }
+
+    void MandelbrotCache::flush() {
+
+        if (_fd < 0) {
+            return;
+        }
+
+        std::unique_lock<std::mutex> guard(_storeLock);
+
+        _idle.wait(guard, [this]() {
+            return _deferred.empty() && !_writing;
+        });
+    }
+
+    MandelbrotCache::Stats MandelbrotCache::stats() const {
+
+        std::lock_guard<std::mutex> guard(_storeLock);
+
+        return {
+            _lookups,
+            _memoryHits,
+            _storeHits,
+            _misses,
+            _baked.load(std::memory_order_relaxed),
+            _deferredWrites.load(std::memory_order_relaxed),
+            _storeFrames,
+            _storeBytes,
+            _storeFailures,
+            _lookup
+        };
+    }
+
+    std::string MandelbrotCache::storePath(const char* directory, uint32_t width, uint32_t height, uint32_t options, Encoding encoding) {
+
+        char name[96];
+
+        snprintf(name, sizeof(name), "/mandelbrot-%ux%u-%u-%s-%016llx.cache",
+            width,
+            height,
+            options,
+            encoding == Encoding::Raw ? "raw" : "runs",
+            (unsigned long long) sourceHash()
+        );
+
+        return std::string(directory) + name;
+    }
+
+    uint32_t* MandelbrotCache::memoryFind(uint32_t frame) {
+
+        if (_slots.empty() || _slotOf[frame] == NONE) {
+            return nullptr;
+        }
+
+        const uint32_t slot = _slotOf[frame];
+
+        if (slot != _head) {
+            memoryUnlink(slot);
+            memoryPushFront(slot);
+        }
+
+        return &_memory[slot * _pixels];
+    }
+
+    uint32_t* MandelbrotCache::memoryInsert(uint32_t frame) {
+
+        if (_slots.empty()) {
+            return _single.data();
+        }
+
+        uint32_t slot;
+
+        if (_used < _slots.size()) {
+            slot = _used++;
+        } else {
+
+            slot = _tail;
+
+            memoryUnlink(slot);
+
+            _slotOf[_slots[slot].frame] = NONE;
+        }
+
+        _slots[slot].frame = frame;
+        _slotOf[frame] = slot;
+
+        memoryPushFront(slot);
+
+        return &_memory[slot * _pixels];
+    }
+
+    void MandelbrotCache::memoryUnlink(uint32_t slot) {
+
+        Slot& s = _slots[slot];
+
+        if (s.prev != NONE) {
+            _slots[s.prev].next = s.next;
+        } else {
+            _head = s.next;
+        }
+
+        if (s.next != NONE) {
+            _slots[s.next].prev = s.prev;
+        } else {
+            _tail = s.prev;
+        }
+    }
+
+    void MandelbrotCache::memoryPushFront(uint32_t slot) {
+
+        _slots[slot].prev = NONE;
+        _slots[slot].next = _head;
+
+        if (_head != NONE) {
+            _slots[_head].prev = slot;
+        }
+
+        _head = slot;
+
+        if (_tail == NONE) {
+            _tail = slot;
+        }
+    }
+
+    // A header, the index of every frame, then frame data from the next page on in the order it
+    // was made. A store with another header is started afresh.
+    bool MandelbrotCache::openStore(const char* path) {
+
+        _fd = open(path, O_RDWR | O_CREAT, 0644);
+
+        if (_fd < 0) {
+            return false;
+        }
+
+        StoreHeader expected;
+
+        memset(&expected, 0, sizeof(expected));
+        memcpy(expected.magic, STORE_MAGIC, sizeof(STORE_MAGIC));
+
+        expected.version = STORE_VERSION;
+        expected.width = _width;
+        expected.height = _height;
+        expected.options = _options;
+        expected.frames = MANDELBROT_CYCLE;
+        expected.encoding = (uint32_t) _encoding;
+        expected.source = sourceHash();
+
+        const size_t indexSize = MANDELBROT_CYCLE * sizeof(Entry);
+        const size_t rawSize = _pixels * sizeof(uint32_t);
+
+        _dataBegin = alignUp(sizeof(StoreHeader) + indexSize, STORE_PAGE);
+        _entries.assign(MANDELBROT_CYCLE, {0, 0, 0, 0});
+        _verified.assign(MANDELBROT_CYCLE, 0);
+
+        StoreHeader header;
+        struct stat info;
+
+        const bool reuse = pread(_fd, &header, sizeof(header), 0) == (ssize_t) sizeof(header)
+            && memcmp(&header, &expected, sizeof(header)) == 0
+            && pread(_fd, _entries.data(), indexSize, sizeof(StoreHeader)) == (ssize_t) indexSize
+            && fstat(_fd, &info) == 0;
+
+        if (reuse) {
+
+            const uint64_t fileSize = (uint64_t) info.st_size;
+
+            // Anything that does not fit the file is dropped and made again.
+            for (Entry& entry : _entries) {
+
+                const bool raw = entry.encoding == (uint32_t) Encoding::Raw && entry.size == rawSize;
+                const bool runs = entry.encoding == (uint32_t) Encoding::GreyRuns && entry.size > 0 && entry.size <= 2 * _pixels;
+
+                if ((!raw && !runs) || entry.offset < _dataBegin || entry.offset + entry.size > fileSize) {
+                    entry = {0, 0, 0, 0};
+                    continue;
+                }
+
+                _storeFrames++;
+                _storeBytes += entry.size;
+            }
+
+            _end = alignUp(fileSize > _dataBegin ? fileSize : _dataBegin, STORE_FRAME_ALIGNMENT);
+        } else {
+
+            _entries.assign(MANDELBROT_CYCLE, {0, 0, 0, 0});
+
+            if (ftruncate(_fd, 0) != 0
+                || pwrite(_fd, &expected, sizeof(expected), 0) != (ssize_t) sizeof(expected)
+                || pwrite(_fd, _entries.data(), indexSize, sizeof(StoreHeader)) != (ssize_t) indexSize
+                || ftruncate(_fd, (off_t) _dataBegin) != 0) {
+
+                closeStore();
+                return false;
+            }
+
+            _end = _dataBegin;
+        }
+
+        // Mapped once, as large as the store can grow, so pointers into it stay put. Only frames
+        // already written are ever read, so the part past the end of the file is never touched.
+        const size_t largest = _dataBegin + MANDELBROT_CYCLE * alignUp(rawSize, STORE_FRAME_ALIGNMENT);
+
+        _mapped = _end > largest ? _end : largest;
+
+        void* map = mmap(nullptr, _mapped, PROT_READ, MAP_SHARED, _fd, 0);
+
+        if (map == MAP_FAILED) {
+            _mapped = 0;
+            closeStore();
+            return false;
+        }
+
+        _map = static_cast<const uint8_t*>(map);
+
+        return true;
+    }
+
+    void MandelbrotCache::closeStore() {
+
+        if (_map) {
+            munmap(const_cast<uint8_t*>(_map), _mapped);
+            _map = nullptr;
+        }
+
+        if (_fd >= 0) {
+            close(_fd);
+            _fd = -1;
+        }
+    }
+
+    // Data is checked against its entry the first time it is read in a session.
+    const uint8_t* MandelbrotCache::storeFind(uint32_t frame, Entry& entry) {
+
+        {
+            std::lock_guard<std::mutex> guard(_storeLock);
+            entry = _entries[frame];
+        }
+
+        if (entry.size == 0) {
+            return nullptr;
+        }
+
+        const uint8_t* data = _map + entry.offset;
+
+        if (!_verified[frame]) {
+
+            if (checksum(data, entry.size) != entry.check) {
+                return nullptr;
+            }
+
+            _verified[frame] = 1;
+        }
+
+        return data;
+    }
+
+    bool MandelbrotCache::storeContains(uint32_t frame) {
+
+        std::lock_guard<std::mutex> guard(_storeLock);
+
+        return _entries[frame].size > 0;
+    }
+
+    // The data goes in before its index entry, so a store cut short by a crash only loses frames.
+    bool MandelbrotCache::storeAppend(uint32_t frame, const uint32_t* pixels, std::vector<uint8_t>& scratch, bool replace) {
+
+        const uint8_t* data = reinterpret_cast<const uint8_t*>(pixels);
+
+        Entry entry = {0, (uint32_t) (_pixels * sizeof(uint32_t)), (uint32_t) Encoding::Raw, 0};
+
+        if (_encoding == Encoding::GreyRuns && encodeGreyRuns(pixels, _pixels, scratch)) {
+            data = scratch.data();
+            entry.size = (uint32_t) scratch.size();
+            entry.encoding = (uint32_t) Encoding::GreyRuns;
+        }
+
+        entry.check = checksum(data, entry.size);
+
+        std::lock_guard<std::mutex> guard(_storeLock);
+
+        const uint32_t previous = _entries[frame].size;
+
+        if (previous > 0 && !replace) {
+            return false;
+        }
+
+        entry.offset = _end;
+
+        // Replaced frames leave holes, so a store can run out of the space mapped for it.
+        if (entry.offset + entry.size > _mapped) {
+            storeFailed(frame, "store is full");
+            return false;
+        }
+
+        if (pwrite(_fd, data, entry.size, (off_t) entry.offset) != (ssize_t) entry.size
+            || pwrite(_fd, &entry, sizeof(entry), (off_t) (sizeof(StoreHeader) + frame * sizeof(Entry))) != (ssize_t) sizeof(entry)) {
+
+            storeFailed(frame, "write failed");
+            return false;
+        }
+
+        _entries[frame] = entry;
+        _end = alignUp(entry.offset + entry.size, STORE_FRAME_ALIGNMENT);
+        _storeFrames += previous > 0 ? 0 : 1;
+        _storeBytes = _storeBytes - previous + entry.size;
+
+        return true;
+    }
+
+    // Called with _storeLock held. Frames that are not stored keep being rendered when asked for,
+    // so only the first failure is reported; the rest are counted in the stats.
+    void MandelbrotCache::storeFailed(uint32_t frame, const char* reason) {
+
+        if (_storeFailures++ == 0) {
+            fprintf(stderr, "mandelbrot cache: %s at frame %u, later frames may not be kept\n", reason, frame);
+        }
+    }
+
+    // Hands a copy of a miss to the background thread; the frame path pays for the copy alone.
+    void MandelbrotCache::defer(uint32_t frame, const uint32_t* pixels, bool replace) {
+
+        uint32_t buffer;
+
+        {
+            std::lock_guard<std::mutex> guard(_storeLock);
+
+            if (_freeBuffers.empty()) {
+                return;
+            }
+
+            buffer = _freeBuffers.back();
+            _freeBuffers.pop_back();
+        }
+
+        memcpy(&_writeBehind[buffer * _pixels], pixels, _pixels * sizeof(uint32_t));
+
+        {
+            std::lock_guard<std::mutex> guard(_storeLock);
+            _deferred.push_back({frame, buffer, replace});
+        }
+
+        _work.notify_one();
+    }
+
+    // Queued misses go ahead of a requested prebake pass. Those queued during a pass wait for it
+    // to end, and are dropped if their buffers run out meanwhile; the pass stores them anyway.
+    void MandelbrotCache::runBackground() {
+
+        std::vector<uint32_t> pixels(_pixels);
+        std::vector<uint8_t> scratch;
+
+        scratch.reserve(2 * _pixels);
+
+        std::unique_lock<std::mutex> guard(_storeLock);
+
+        while (true) {
+
+            _work.wait(guard, [this]() {
+                return _stopping.load(std::memory_order_relaxed) || !_deferred.empty() || _bakeRequested;
+            });
+
+            if (_stopping.load(std::memory_order_relaxed)) {
+                break;
+            }
+
+            if (!_deferred.empty()) {
+
+                const Pending pending = _deferred.back();
+
+                _deferred.pop_back();
+                _writing = true;
+
+                guard.unlock();
+
+                // A prebake pass may have stored it since.
+                if (pending.replace || !storeContains(pending.frame)) {
+                    if (storeAppend(pending.frame, &_writeBehind[pending.buffer * _pixels], scratch, pending.replace)) {
+                        _deferredWrites.fetch_add(1, std::memory_order_relaxed);
+                    }
+                }
+
+                guard.lock();
+
+                _freeBuffers.push_back(pending.buffer);
+                _writing = false;
+
+                if (_deferred.empty()) {
+                    _idle.notify_all();
+                }
+
+                continue;
+            }
+
+            _bakeRequested = false;
+
+            const uint32_t first = _bakeFirst;
+
+            guard.unlock();
+
+            runPrebake(first, pixels, scratch);
+
+            _prebaking.store(false, std::memory_order_release);
+
+            guard.lock();
+        }
+
+        _writing = false;
+        _idle.notify_all();
+    }
+
+    void MandelbrotCache::runPrebake(uint32_t first, std::vector<uint32_t>& pixels, std::vector<uint8_t>& scratch) {
+
+        for (uint32_t i = 0; i < MANDELBROT_CYCLE && !_stopping.load(std::memory_order_relaxed); i++) {
+
+            const uint32_t frame = (first + i) % MANDELBROT_CYCLE;
+
+            if (storeContains(frame)) {
+                continue;
+            }
+
+            renderMandelbrot(_width, _height, frame, _options, pixels.data());
+
+            if (storeAppend(frame, pixels.data(), scratch, false)) {
+                _baked.fetch_add(1, std::memory_order_relaxed);
+            }
+        }
+    }
+
+#pragma endregion MandelbrotCache }
+
+#pragma region Benchmark {
+
+    void benchmarkMandelbrotCache(uint32_t width, uint32_t height, uint32_t options, const char* directory, ThreadPool& pool) {
+
+        using Clock = std::chrono::steady_clock;
+
+        // The LRU alone at the size the renderer used to give it, then the stores behind a decode
+        // buffer as the renderer now runs them.
+        static constexpr size_t SMALL_MEMORY = 256;
+
+        const size_t bytes = (size_t) width * height * sizeof(uint32_t);
+
+        std::vector<uint32_t> image((size_t) width * height);
+        std::vector<uint32_t> upload((size_t) width * height);
+
+        fprintf(stderr, "mandelbrot cache %ux%u, options %u, %u frames a pass\n", width, height, options, MANDELBROT_CYCLE);
+
+        // One pass over the animation, each frame fetched and copied out like the texture upload.
+        const auto pass = [&](const char* name, MandelbrotCache* cache) {
+
+            const MandelbrotCache::Stats before = cache ? cache -> stats() : MandelbrotCache::Stats{};
+
+            Histogram frameTime;
+
+            const Clock::time_point start = Clock::now();
+
+            for (uint32_t frame = 0; frame < MANDELBROT_CYCLE; frame++) {
+
+                const Clock::time_point frameStart = Clock::now();
+
+                const uint32_t* pixels = image.data();
+
+                if (cache) {
+                    pixels = cache -> frame(frame, &pool);
+                } else {
+                    renderMandelbrot(width, height, frame, options, image.data(), &pool);
+                }
+
+                streamCopy(upload.data(), pixels, bytes);
+
+                frameTime.record((uint64_t) std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - frameStart).count());
+            }
+
+            const double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+            const MandelbrotCache::Stats after = cache ? cache -> stats() : MandelbrotCache::Stats{};
+            const double percent = (double) MANDELBROT_CYCLE / 100.0;
+
+            fprintf(stderr, "    %-20s memory %5.1f%% store %5.1f%% miss %5.1f%% %9.1f us/frame p99 %6llu us store %6.1f MB, %llu not kept\n",
+                name,
+                cache ? (double) (after.memoryHits - before.memoryHits) / percent : 0.0,
+                cache ? (double) (after.storeHits - before.storeHits) / percent : 0.0,
+                cache ? (double) (after.misses - before.misses) / percent : 100.0,
+                seconds * 1e6 / MANDELBROT_CYCLE,
+                (unsigned long long) frameTime.percentile(0.99),
+                (double) after.storeBytes / (1024.0 * 1024.0),
+                (unsigned long long) (after.storeFailures - before.storeFailures)
+            );
+        };
+
+        pass("render", nullptr);
+
+        {
+            MandelbrotCache cache(width, height, options, SMALL_MEMORY, nullptr, MandelbrotCache::Encoding::Raw);
+
+            pass("lru 256 cold", &cache);
+            pass("lru 256 warm", &cache);
+        }
+
+        {
+            MandelbrotCache cache(width, height, options, MANDELBROT_CYCLE, nullptr, MandelbrotCache::Encoding::Raw);
+
+            pass("lru all cold", &cache);
+            pass("lru all warm", &cache);
+        }
+
+        for (MandelbrotCache::Encoding encoding : {MandelbrotCache::Encoding::Raw, MandelbrotCache::Encoding::GreyRuns}) {
+
+            const char* label = encoding == MandelbrotCache::Encoding::Raw ? "raw" : "runs";
+            const std::string path = MandelbrotCache::storePath(directory, width, height, options, encoding);
+
+            char name[32];
+
+            remove(path.c_str());
+
+            {
+                MandelbrotCache cache(width, height, options, 0, path.c_str(), encoding);
+
+                snprintf(name, sizeof(name), "%s lazy cold", label);
+                pass(name, &cache);
+
+                cache.flush();
+
+                snprintf(name, sizeof(name), "%s lazy warm", label);
+                pass(name, &cache);
+            }
+
+            {
+                MandelbrotCache cache(width, height, options, 0, path.c_str(), encoding);
+
+                snprintf(name, sizeof(name), "%s reopened", label);
+                pass(name, &cache);
+            }
+
+            remove(path.c_str());
+
+            {
+                MandelbrotCache cache(width, height, options, 0, path.c_str(), encoding);
+
+                const Clock::time_point start = Clock::now();
+
+                cache.prebake();
+
+                while (cache.prebaking()) {
+                    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+                }
+
+                fprintf(stderr, "    %-20s %llu frames in %.2f s on one thread\n",
+                    label,
+                    (unsigned long long) cache.baked(),
+                    std::chrono::duration<double>(Clock::now() - start).count()
+                );
+
+                snprintf(name, sizeof(name), "%s prebaked", label);
+                pass(name, &cache);
+            }
+        }
+    }
+
+#pragma endregion Benchmark }
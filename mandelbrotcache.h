@@ -0,0 +1,211 @@
+#ifndef MANDELBROTCACHE_H
+#define MANDELBROTCACHE_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "mandelbrot.h"
+#include "pacer.h"
+#include "threadpool.h"
+
+// Images of the texture animation by frame, for one width, height and set of options. Looks in a
+// bounded in-memory LRU of decoded frames first, then in an optional store on disk, and renders on
+// the CPU only when both miss. The store is one file per key, frames appended as they are made and
+// read back through a read-only mapping; it survives restarts and can be filled ahead of time with
+// prebake(). Every write to it runs on a background thread, so frame() never waits on the disk.
+//
+// frame() and stats() belong to one thread; only store writes run elsewhere.
+class MandelbrotCache {
+
+    public:
+
+        enum class Encoding : uint32_t {
+
+            // RGBA8 as rendered; the mapping hands out the stored bytes without a copy.
+            Raw = 1,
+
+            // One byte a pixel in runs of equal grey levels, decoded into the LRU.
+            GreyRuns = 2
+
+        };
+
+        struct Stats {
+
+            uint64_t lookups;
+            uint64_t memoryHits;
+            uint64_t storeHits;
+            uint64_t misses;
+            uint64_t baked;
+
+            // Misses written to the store in the background.
+            uint64_t deferred;
+
+            uint64_t storeFrames;
+            uint64_t storeBytes;
+
+            // Frames the store could not take, for want of space or a failed write.
+            uint64_t storeFailures;
+
+            // Microseconds each frame() took.
+            Histogram lookup;
+
+        };
+
+        // memoryFrames may be 0 to keep nothing in memory. storePath may be null for no store; a
+        // store that cannot be opened is reported and skipped.
+        MandelbrotCache(uint32_t width, uint32_t height, uint32_t options, size_t memoryFrames, const char* storePath, Encoding encoding);
+
+        ~MandelbrotCache();
+
+        MandelbrotCache(const MandelbrotCache&) = delete;
+        MandelbrotCache& operator=(const MandelbrotCache&) = delete;
+
+        // RGBA8 pixels of frame (below MANDELBROT_CYCLE), valid until the next call. Misses are
+        // rendered across pool when one is given, kept in the LRU and copied out for the store.
+        const uint32_t* frame(uint32_t frame, ThreadPool* pool = nullptr);
+
+        // Renders every frame missing from the store on the background thread, starting at first
+        // and wrapping around. Does nothing without a store or while a pass is running.
+        void prebake(uint32_t first = 0);
+
+        // Blocks until the misses queued so far are in the store.
+        void flush();
+
+        // Frames prebake() has added so far.
+        uint64_t baked() const {
+            return _baked.load(std::memory_order_relaxed);
+        }
+
+        bool prebaking() const {
+            return _prebaking.load(std::memory_order_acquire);
+        }
+
+        bool hasStore() const {
+            return _fd >= 0;
+        }
+
+        Stats stats() const;
+
+        // File in directory that holds the store for this key.
+        static std::string storePath(const char* directory, uint32_t width, uint32_t height, uint32_t options, Encoding encoding);
+
+    private:
+
+        static constexpr uint32_t NONE = UINT32_MAX;
+
+        // Copies of misses that can wait for the background thread at once.
+        static constexpr uint32_t WRITE_BEHIND = 8;
+
+        struct Slot {
+
+            uint32_t frame;
+            uint32_t prev;
+            uint32_t next;
+
+        };
+
+        struct Pending {
+
+            uint32_t frame;
+            uint32_t buffer;
+            bool replace;
+
+        };
+
+        struct Entry {
+
+            uint64_t offset;
+            uint32_t size;
+            uint32_t encoding;
+            uint64_t check;
+
+        };
+
+        uint32_t* memoryFind(uint32_t frame);
+        uint32_t* memoryInsert(uint32_t frame);
+        void memoryUnlink(uint32_t slot);
+        void memoryPushFront(uint32_t slot);
+
+        bool openStore(const char* path);
+        void closeStore();
+        const uint8_t* storeFind(uint32_t frame, Entry& entry);
+        bool storeAppend(uint32_t frame, const uint32_t* pixels, std::vector<uint8_t>& scratch, bool replace);
+        bool storeContains(uint32_t frame);
+        void storeFailed(uint32_t frame, const char* reason);
+
+        void defer(uint32_t frame, const uint32_t* pixels, bool replace);
+        void runBackground();
+        void runPrebake(uint32_t first, std::vector<uint32_t>& pixels, std::vector<uint8_t>& scratch);
+
+        uint32_t _width;
+        uint32_t _height;
+        uint32_t _options;
+        size_t _pixels;
+        Encoding _encoding;
+
+        // LRU of decoded frames: slots in a list from most to least recently used, and the slot
+        // of each frame of the animation. All storage is allocated up front.
+        std::vector<uint32_t> _memory;
+        std::vector<Slot> _slots;
+        std::vector<uint32_t> _slotOf;
+        uint32_t _used = 0;
+        uint32_t _head = NONE;
+        uint32_t _tail = NONE;
+
+        // Where a frame goes when the LRU holds nothing.
+        std::vector<uint32_t> _single;
+
+        // The store. _entries mirrors the index in the file and, with _end, the totals and the
+        // background thread's work, is guarded by _storeLock. The mapping is made once when the
+        // store opens.
+        int _fd = -1;
+        mutable std::mutex _storeLock;
+        std::vector<Entry> _entries;
+        uint64_t _dataBegin = 0;
+        uint64_t _end = 0;
+        uint64_t _storeBytes = 0;
+        uint64_t _storeFrames = 0;
+        uint64_t _storeFailures = 0;
+        const uint8_t* _map = nullptr;
+        size_t _mapped = 0;
+
+        // Entries whose data has been checked since the store was opened; frame()'s alone.
+        std::vector<uint8_t> _verified;
+
+        // Misses waiting to be written, in write-behind buffers of _pixels each. A miss that finds
+        // them all taken is not stored this time round. All sized up front.
+        std::vector<uint32_t> _writeBehind;
+        std::vector<uint32_t> _freeBuffers;
+        std::vector<Pending> _deferred;
+        bool _writing = false;
+        bool _bakeRequested = false;
+        uint32_t _bakeFirst = 0;
+
+        std::thread _background;
+        std::condition_variable _work;
+        std::condition_variable _idle;
+        std::atomic<bool> _stopping{false};
+        std::atomic<bool> _prebaking{false};
+        std::atomic<uint64_t> _baked{0};
+        std::atomic<uint64_t> _deferredWrites{0};
+
+        uint64_t _lookups = 0;
+        uint64_t _memoryHits = 0;
+        uint64_t _storeHits = 0;
+        uint64_t _misses = 0;
+        Histogram _lookup;
+
+};
+
+// Renders the animation at width x height through one cache after another, two passes each, and
+// prints hit rates and the cost of a frame, including a copy out as the texture upload would make,
+// to stderr. Stores go in directory, replacing any left there for the same key.
+void benchmarkMandelbrotCache(uint32_t width, uint32_t height, uint32_t options, const char* directory, ThreadPool& pool);
+
+#endif
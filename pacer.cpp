@@ -0,0 +1,140 @@
+#include "pacer.h"
+
+#include <cstdlib>
+
+#pragma region Histogram {
+
+    void Histogram::record(uint64_t micros) {
+
+        size_t index = 0;
+
+        for (uint64_t v = micros >> 1; v && index + 1 < BUCKETS; v >>= 1) {
+            index++;
+        }
+
+        _buckets[index]++;
+        _count++;
+        _total += micros;
+        _max = micros > _max ? micros : _max;
+    }
+
+    uint64_t Histogram::percentile(double p) const {
+
+        const uint64_t rank = (uint64_t) (p * (double) _count);
+
+        uint64_t seen = 0;
+
+        for (size_t i = 0; i < BUCKETS; i++) {
+
+            seen += _buckets[i];
+
+            if (seen > rank || seen == _count) {
+                const uint64_t bound = (uint64_t) 2 << i;
+
+                return i + 1 < BUCKETS && bound < _max ? bound : _max;
+            }
+        }
+
+        return _max;
+    }
+
+#pragma endregion Histogram }
+
+#pragma region FramePacer {
+
+    static unsigned clampFrames(unsigned framesInFlight) {
+        return framesInFlight < 1 ? 1 : (framesInFlight > FramePacer::MAX_FRAMES_IN_FLIGHT ? FramePacer::MAX_FRAMES_IN_FLIGHT : framesInFlight);
+    }
+
+    FramePacer::FramePacer(unsigned framesInFlight) : _limit(clampFrames(framesInFlight)) {}
+
+    void FramePacer::setFramesInFlight(unsigned framesInFlight) {
+
+        {
+            std::lock_guard<std::mutex> guard(_lock);
+            _limit = clampFrames(framesInFlight);
+        }
+
+        _released.notify_all();
+    }
+
+    unsigned FramePacer::framesInFlight() const {
+
+        std::lock_guard<std::mutex> guard(_lock);
+
+        return _limit;
+    }
+
+    uint64_t FramePacer::begin() {
+
+        const Clock::time_point start = Clock::now();
+
+        std::unique_lock<std::mutex> guard(_lock);
+
+        _released.wait(guard, [this]() {
+            return _inFlight < _limit;
+        });
+
+        const Clock::time_point now = Clock::now();
+
+        _blocked.record((uint64_t) std::chrono::duration_cast<std::chrono::microseconds>(now - start).count());
+
+        // At most MAX_FRAMES_IN_FLIGHT tickets are live, so their slots never collide.
+        const uint64_t ticket = _next++;
+
+        _started[ticket % MAX_FRAMES_IN_FLIGHT] = now;
+        _inFlight++;
+
+        return ticket;
+    }
+
+    void FramePacer::complete(uint64_t ticket) {
+
+        const Clock::time_point now = Clock::now();
+
+        {
+            std::lock_guard<std::mutex> guard(_lock);
+
+            _latency.record((uint64_t) std::chrono::duration_cast<std::chrono::microseconds>(now - _started[ticket % MAX_FRAMES_IN_FLIGHT]).count());
+            _inFlight--;
+        }
+
+        _released.notify_all();
+    }
+
+    void FramePacer::drain() {
+
+        std::unique_lock<std::mutex> guard(_lock);
+
+        _released.wait(guard, [this]() {
+            return _inFlight == 0;
+        });
+    }
+
+    FramePacer::Stats FramePacer::stats() const {
+
+        std::lock_guard<std::mutex> guard(_lock);
+
+        return {_limit, _blocked, _latency};
+    }
+
+    bool parseFramesInFlight(const char* text, unsigned& framesInFlight) {
+
+        if (*text < '0' || *text > '9') {
+            return false;
+        }
+
+        char* end;
+
+        unsigned long value = strtoul(text, &end, 10);
+
+        if (*end != '\0' || value < 1 || value > FramePacer::MAX_FRAMES_IN_FLIGHT) {
+            return false;
+        }
+
+        framesInFlight = (unsigned) value;
+
+        return true;
+    }
+
+#pragma endregion FramePacer }
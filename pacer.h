@@ -0,0 +1,103 @@
+#ifndef PACER_H
+#define PACER_H
+
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+
+// Durations in power-of-two microsecond buckets: bucket 0 holds [0, 2) us, bucket k holds
+// [2^k, 2^(k+1)) us and the last one everything longer.
+class Histogram {
+
+    public:
+
+        static constexpr size_t BUCKETS = 24;
+
+        void record(uint64_t micros);
+
+        uint64_t count() const {
+            return _count;
+        }
+
+        uint64_t max() const {
+            return _max;
+        }
+
+        double mean() const {
+            return _count ? (double) _total / (double) _count : 0.0;
+        }
+
+        // Upper bound of the bucket holding the p-th fraction of the samples, p in [0, 1], capped at max().
+        uint64_t percentile(double p) const;
+
+        uint64_t bucket(size_t index) const {
+            return _buckets[index];
+        }
+
+    private:
+
+        uint64_t _buckets[BUCKETS] = {};
+        uint64_t _count = 0;
+        uint64_t _total = 0;
+        uint64_t _max = 0;
+
+};
+
+// Bounds the number of frames the CPU may run ahead of the GPU. begin() blocks while the limit is
+// reached and complete() releases a frame from any thread. Records how long begin() blocked and
+// the time from begin() to complete() of every frame.
+class FramePacer {
+
+    public:
+
+        static constexpr unsigned MAX_FRAMES_IN_FLIGHT = 4;
+
+        struct Stats {
+
+            unsigned framesInFlight;
+            Histogram blocked;
+            Histogram latency;
+
+        };
+
+        explicit FramePacer(unsigned framesInFlight = 3);
+
+        // Clamped to [1, MAX_FRAMES_IN_FLIGHT]. Lowering it takes effect as frames complete.
+        void setFramesInFlight(unsigned framesInFlight);
+
+        unsigned framesInFlight() const;
+
+        // Waits for a free slot and returns the frame's ticket for complete().
+        uint64_t begin();
+
+        void complete(uint64_t ticket);
+
+        // Blocks until every begun frame has completed.
+        void drain();
+
+        Stats stats() const;
+
+    private:
+
+        using Clock = std::chrono::steady_clock;
+
+        mutable std::mutex _lock;
+        std::condition_variable _released;
+
+        unsigned _limit;
+        unsigned _inFlight = 0;
+        uint64_t _next = 0;
+
+        Clock::time_point _started[MAX_FRAMES_IN_FLIGHT];
+
+        Histogram _blocked;
+        Histogram _latency;
+
+};
+
+// Parses a frames-in-flight count in [1, FramePacer::MAX_FRAMES_IN_FLIGHT].
+bool parseFramesInFlight(const char* text, unsigned& framesInFlight);
+
+#endif
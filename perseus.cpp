@@ -1,4 +1,7 @@
 #include <cassert>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
 
 #define NS_PRIVATE_IMPLEMENTATION
 #define CA_PRIVATE_IMPLEMENTATION
@@ -9,46 +12,104 @@
 #include <Metal/Metal.hpp>
 #include <MetalKit/MetalKit.hpp>
 
-#include <simd/simd.h>
-
-static constexpr size_t INSTANCE_ROWS = 10;
-static constexpr size_t INSTANCE_COLUMNS = 10;
-static constexpr size_t INSTANCE_DEPTH = 10;
-
-static constexpr size_t INSTANCES = (INSTANCE_ROWS * INSTANCE_COLUMNS * INSTANCE_DEPTH);
-static constexpr size_t FRAMES = 3;
+#include "arena.h"
+#include "culling.h"
+#include "instances.h"
+#include "mandelbrot.h"
+#include "mandelbrotcache.h"
+#include "pacer.h"
+#include "picking.h"
+#include "shader.h"
+#include "simulation.h"
+#include "taskgraph.h"
+#include "threadpool.h"
+#include "upload.h"
+
+static constexpr GridSize DEFAULT_GRID = {10, 10, 10};
+
+// Grids of about 1k to 10M instances, walked by --grid-sweep and by the Scene menu's Larger and
+// Smaller Grid. The sweep draws GRID_SWEEP_FRAMES frames at each before moving on.
+static constexpr GridSize GRID_SWEEP[] = {{10, 10, 10}, {25, 20, 20}, {50, 50, 40}, {100, 100, 100}, {250, 200, 200}};
+static constexpr size_t GRID_SWEEP_SIZES = sizeof(GRID_SWEEP) / sizeof(GRID_SWEEP[0]);
+static constexpr uint32_t GRID_SWEEP_FRAMES = 240;
+
+// Points of the window, square, so a pick through its centre uses VIEW_SIZE / 2.
+static constexpr double VIEW_SIZE = 1024.0;
+static constexpr unsigned DEFAULT_FRAMES_IN_FLIGHT = 3;
+
+static constexpr float INSTANCE_SCALE = 0.2f;
+static constexpr float INSTANCE_RADIUS = 0.8660254f;
+static constexpr float INSTANCE_HALF_EXTENT = 0.5f;
+
+// Chunk sizes for the per-frame loops: whole cache lines of output and full kernel blocks.
+static constexpr size_t INSTANCE_GRAIN = std::lcm(cacheLineGrain<shader::Instance>(), (size_t) 16);
+static constexpr size_t INTERPOLATION_GRAIN = cacheLineGrain<float>();
+static constexpr math::float3 OBJECT_POSITION = {0.f, 0.f, -10.f};
+
+// Radians a second, the old 0.002 a frame on a 60 Hz display, whatever the simulation rate.
+static constexpr double DEFAULT_SIMULATION_HZ = 60.0;
+static constexpr float ANGULAR_SPEED = 0.12f;
+
+// Per-frame instance bytes for count instances. The procedural format only uploads its uniforms.
+static constexpr size_t instanceStreamSize(size_t count) {
+#if INSTANCE_FORMAT == INSTANCE_FORMAT_PROCEDURAL
+    return sizeof(shader::ProceduralUniforms);
+#else
+    return count * sizeof(shader::Instance);
+#endif
+}
 
-static constexpr uint32_t TEXTURE_WIDTH = 128;
-static constexpr uint32_t TEXTURE_HEIGHT = 128;
+// Offset alignment of every sub-allocation in the upload ring, enough for any buffer binding.
+static constexpr size_t UPLOAD_ALIGNMENT = 256;
 
-#pragma region Declaration {
+// What the stages of a frame read and write, as declared to the frame graph.
+enum FrameResource : uint32_t {
 
-    namespace math {
+    FrameModel,         // _frame.alpha, _angle, _model
+    FrameCamera,        // _camera and its upload slot
+    FrameUpload,        // _upload, _uploadDirty and the frame's upload buffer
+    FrameVisible,       // _culler and the instance and id slots
+    FrameMandelbrot,    // _animationId, _mandelbrotOptions, _mandelbrotCache
+    FrameCommands       // the frame's command buffer
 
-        constexpr simd::float3 add(const simd::float3& a, const simd::float3& b);
-        constexpr simd_float4x4 identity();
+};
 
-        simd::float4x4 perspective();
+static constexpr uint32_t TEXTURE_WIDTH = 128;
+static constexpr uint32_t TEXTURE_HEIGHT = 128;
 
-        simd::float4x4 rotateX(float radiansAngle);
+// --mandelbrot-bench times the kernels on a few frames at a size worth timing, then the skip
+// options on the texture itself over the whole animation.
+static constexpr uint32_t MANDELBROT_BENCH_SIZE = 1024;
+static constexpr uint32_t MANDELBROT_BENCH_FRAMES = 8;
 
-        simd::float4x4 rotateY(float radiansAngle);
+static constexpr uint32_t DEFAULT_MANDELBROT_OPTIONS = shader::MandelbrotSkipBulbs | shader::MandelbrotSkipCycles;
 
-        simd::float4x4 rotateZ(float radiansAngle);
+// Decoded texture frames kept in memory by --mandelbrot-cache, 64 KB each. The animation walks its
+// whole cycle in order, so an LRU short of the cycle never hits (0% at 256 frames in
+// --mandelbrot-bench); the store serves every frame and one decode buffer is enough.
+static constexpr size_t MANDELBROT_CACHE_FRAMES = 0;
+static constexpr size_t TEXTURE_BYTES = TEXTURE_WIDTH * TEXTURE_HEIGHT * sizeof(uint32_t);
 
-        simd::float4x4 translate(const simd::float3& vec);
+#pragma region Declaration {
 
-        simd::float4x4 scale(const simd::float3& vec);
+    struct RenderOptions {
 
-        simd::float3x3 discard(const simd::float4x4& matr);
+        GridSize grid;
+        unsigned framesInFlight;
+        double simulationHz;
+        const char* tracePath;
+        uint32_t mandelbrotOptions;
+        const char* mandelbrotCache;
+        MandelbrotCache::Encoding mandelbrotCacheEncoding;
+        bool gridSweep;
 
-    }
+    };
 
     class Render {
 
         public:
 
-            Render(MTL::Device* device);
+            Render(MTL::Device* device, const RenderOptions& options);
 
             ~Render();
 
@@ -62,10 +123,45 @@ static constexpr uint32_t TEXTURE_HEIGHT = 128;
 
             void buildBuffers();
 
+            void reserveInstances(size_t count);
+
+            size_t allocateUpload(size_t size);
+
+            void buildStaticInstances();
+
+            void reportInstanceUpload() const;
+
+            void resize(const GridSize& grid);
+
+            // Resizes to the next GRID_SWEEP grid above or below the current instance count.
+            void stepGrid(bool larger);
+
+            void setFramesInFlight(unsigned framesInFlight);
+
+            void advanceGridSweep();
+
             void buildMandelbrotTexture(MTL::CommandBuffer* cmdBuff);
 
+            void fetchMandelbrotTexture();
+
+            void uploadMandelbrotTexture();
+
+            void buildFrameGraph();
+
+            void updateSimulation();
+
+            void updateCamera();
+
+            void updateInstances();
+
+            void flushUploads();
+
+            void encodeFrame();
+
             void draw(MTK::View* view);
 
+            bool pick(float x, float y, float width, float height, PickHit& hit);
+
         private:
 
             MTL::Device* _device;
@@ -76,26 +172,74 @@ static constexpr uint32_t TEXTURE_HEIGHT = 128;
             MTL::DepthStencilState* _depthStencilState;
             MTL::Texture* _texture;
             MTL::Buffer* _vertexDataBuff;
-            MTL::Buffer* _instanceDataBuff[FRAMES];
-            MTL::Buffer* _cameraDataBuff[FRAMES];
+            MTL::Buffer* _uploadBuff;
+            MTL::Buffer* _instanceStaticBuff;
             MTL::Buffer* _indexBuff;
-            MTL::Buffer* _textureAnimationBuff;
+            MTL::Buffer* _mandelbrotShadesBuff;
+
+            InstanceGrid _grid;
+            Simulation _simulation;
+
+            // Instance angles of the last frame drawn, between the two newest simulation states.
+            std::vector<float> _angleY, _angleZ;
+
+            InstanceCuller _culler;
+            ThreadPool _pool;
+            InstancePicker _picker;
+            bool _pickerBuilt;
+            RingAllocator _upload;
+            DirtyRanges _uploadDirty;
+            FrameArena _arenas[FramePacer::MAX_FRAMES_IN_FLIGHT];
+
+            shader::CameraData _camera;
+            math::float4x4 _model;
 
             float _angle;
-            int _frame;
             uint _animationId;
+            uint32_t _mandelbrotOptions;
 
-            dispatch_semaphore_t _semaphore;
+            // With a cache the texture is uploaded from it instead of computed on the GPU.
+            std::unique_ptr<MandelbrotCache> _mandelbrotCache;
+
+            FramePacer _pacer;
+
+            // --grid-sweep: the GRID_SWEEP entry being drawn and the frames drawn at it so far.
+            bool _gridSweep;
+            size_t _sweepStep;
+            uint32_t _sweepFrames;
+            std::chrono::steady_clock::time_point _sweepStart;
+
+            // Handed between the stages of the frame being built.
+            struct Frame {
+
+                MTL::CommandBuffer* cmdBuff;
+                MTL::RenderPassDescriptor* passDesc;
+                MTL::Buffer* uploadBuff;
+                uint8_t* upload;
+                FrameArena* arena;
+
+                float alpha;
+
+                size_t camOffset;
+                size_t insOffset;
+                size_t idOffset;
+                size_t visible;
+
+                const uint32_t* mandelbrot;
+
+            };
+
+            Frame _frame;
+            TaskGraph _frameGraph;
+            const char* _tracePath;
 
-            static const int FRAMES;
-            
     };
 
     class CoreViewDelegate : public MTK::ViewDelegate {
 
         public:
 
-            CoreViewDelegate(MTL::Device* device);
+            CoreViewDelegate(MTL::Device* device, const RenderOptions& options);
 
             virtual ~CoreViewDelegate() override;
 
@@ -111,6 +255,8 @@ static constexpr uint32_t TEXTURE_HEIGHT = 128;
 
         public:
 
+            CoreApplicationDelegate(const RenderOptions& options);
+
             ~CoreApplicationDelegate();
 
             NS::Menu* createMenuBar();
@@ -127,16 +273,67 @@ static constexpr uint32_t TEXTURE_HEIGHT = 128;
             MTK::View* _view;
             MTL::Device* _device;
             CoreViewDelegate* _coreViewDelegate = nullptr;
+            RenderOptions _options;
 
     };
 
+    // The renderer the Scene menu acts on, set while the view delegate owns one.
+    static Render* activeRender = nullptr;
+
 #pragma endregion Declaration }
 
-int main() {
+int main(int argc, char** argv) {
+
+    RenderOptions options = {DEFAULT_GRID, DEFAULT_FRAMES_IN_FLIGHT, DEFAULT_SIMULATION_HZ, nullptr, DEFAULT_MANDELBROT_OPTIONS, nullptr, MandelbrotCache::Encoding::GreyRuns, false};
+
+    bool mandelbrotBench = false;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--grid") == 0 && i + 1 < argc && parseGridSize(argv[i + 1], options.grid)) {
+            i++;
+        } else if (strcmp(argv[i], "--frames") == 0 && i + 1 < argc && parseFramesInFlight(argv[i + 1], options.framesInFlight)) {
+            i++;
+        } else if (strcmp(argv[i], "--sim-hz") == 0 && i + 1 < argc && parseSimulationRate(argv[i + 1], options.simulationHz)) {
+            i++;
+        } else if (strcmp(argv[i], "--trace") == 0 && i + 1 < argc) {
+            options.tracePath = argv[++i];
+        } else if (strcmp(argv[i], "--mandelbrot-skip") == 0 && i + 1 < argc && parseMandelbrotOptions(argv[i + 1], options.mandelbrotOptions)) {
+            i++;
+        } else if (strcmp(argv[i], "--mandelbrot-cache") == 0 && i + 1 < argc) {
+            options.mandelbrotCache = argv[++i];
+        } else if (strcmp(argv[i], "--mandelbrot-cache-raw") == 0) {
+            options.mandelbrotCacheEncoding = MandelbrotCache::Encoding::Raw;
+        } else if (strcmp(argv[i], "--mandelbrot-bench") == 0) {
+            mandelbrotBench = true;
+        } else if (strcmp(argv[i], "--grid-sweep") == 0) {
+            options.gridSweep = true;
+        } else {
+            fprintf(stderr, "usage: %s [--grid ROWSxCOLUMNSxDEPTH | --grid-sweep] [--frames 1-%u] [--sim-hz HZ] [--trace FILE] [--mandelbrot-skip none|bulbs|cycles|all] [--mandelbrot-cache DIR [--mandelbrot-cache-raw]] [--mandelbrot-bench]\n", argv[0], FramePacer::MAX_FRAMES_IN_FLIGHT);
+            return 1;
+        }
+    }
+
+    if (options.gridSweep) {
+        options.grid = GRID_SWEEP[0];
+    }
+
+    if (mandelbrotBench) {
+
+        ThreadPool threads;
+
+        benchmarkMandelbrot(MANDELBROT_BENCH_SIZE, MANDELBROT_BENCH_SIZE, MANDELBROT_BENCH_FRAMES, options.mandelbrotOptions, threads);
+        benchmarkMandelbrotOptions(TEXTURE_WIDTH, TEXTURE_HEIGHT, 1, threads);
+
+        if (options.mandelbrotCache) {
+            benchmarkMandelbrotCache(TEXTURE_WIDTH, TEXTURE_HEIGHT, options.mandelbrotOptions, options.mandelbrotCache, threads);
+        }
+
+        return 0;
+    }
 
     NS::AutoreleasePool* pool = NS::AutoreleasePool::alloc() -> init();
 
-    CoreApplicationDelegate coreApp;
+    CoreApplicationDelegate coreApp(options);
 
     NS::Application* sharedApp = NS::Application::sharedApplication();
 
@@ -151,6 +348,8 @@ int main() {
 #pragma mark - CoreApplicationDelegate
 #pragma region CoreApplicationDelegate {
 
+    CoreApplicationDelegate::CoreApplicationDelegate(const RenderOptions& options) : _options(options) {}
+
     CoreApplicationDelegate::~CoreApplicationDelegate() {
 
         _view -> release();
@@ -199,13 +398,73 @@ int main() {
 
         windowMenuItem -> setSubmenu(windowMenu);
 
+        NS::MenuItem* sceneMenuItem = NS::MenuItem::alloc() -> init();
+        NS::Menu* sceneMenu = NS::Menu::alloc() -> init(NS::String::string("Scene", UTF8StringEncoding));
+
+        SEL largerGrid = NS::MenuItem::registerActionCallback("sceneLargerGrid", [](void*, SEL, const NS::Object*) {
+            if (activeRender) {
+                activeRender -> stepGrid(true);
+            }
+        });
+
+        SEL smallerGrid = NS::MenuItem::registerActionCallback("sceneSmallerGrid", [](void*, SEL, const NS::Object*) {
+            if (activeRender) {
+                activeRender -> stepGrid(false);
+            }
+        });
+
+        sceneMenu -> addItem(NS::String::string("Larger Grid", UTF8StringEncoding), largerGrid, NS::String::string("=", UTF8StringEncoding)) -> setKeyEquivalentModifierMask(NS::EventModifierFlagCommand);
+        sceneMenu -> addItem(NS::String::string("Smaller Grid", UTF8StringEncoding), smallerGrid, NS::String::string("-", UTF8StringEncoding)) -> setKeyEquivalentModifierMask(NS::EventModifierFlagCommand);
+
+        // Command-1 to Command-4 set the frames in flight; the callbacks cannot capture, so one each.
+        const NS::MenuItemCallback framesInFlight[FramePacer::MAX_FRAMES_IN_FLIGHT] = {
+            [](void*, SEL, const NS::Object*) { if (activeRender) { activeRender -> setFramesInFlight(1); } },
+            [](void*, SEL, const NS::Object*) { if (activeRender) { activeRender -> setFramesInFlight(2); } },
+            [](void*, SEL, const NS::Object*) { if (activeRender) { activeRender -> setFramesInFlight(3); } },
+            [](void*, SEL, const NS::Object*) { if (activeRender) { activeRender -> setFramesInFlight(4); } }
+        };
+
+        for (unsigned n = 1; n <= FramePacer::MAX_FRAMES_IN_FLIGHT; n++) {
+
+            char name[32], title[32], key[2] = {(char) ('0' + n), 0};
+
+            snprintf(name, sizeof(name), "sceneFramesInFlight%u", n);
+            snprintf(title, sizeof(title), "%u Frames in Flight", n);
+
+            SEL action = NS::MenuItem::registerActionCallback(name, framesInFlight[n - 1]);
+
+            sceneMenu -> addItem(NS::String::string(title, UTF8StringEncoding), action, NS::String::string(key, UTF8StringEncoding)) -> setKeyEquivalentModifierMask(NS::EventModifierFlagCommand);
+        }
+
+        SEL pickCentre = NS::MenuItem::registerActionCallback("scenePickCentre", [](void*, SEL, const NS::Object*) {
+
+            PickHit hit;
+
+            if (!activeRender) {
+                return;
+            }
+
+            if (activeRender -> pick(VIEW_SIZE / 2, VIEW_SIZE / 2, VIEW_SIZE, VIEW_SIZE, hit)) {
+                fprintf(stderr, "pick: instance %u at distance %.3f\n", hit.id, hit.distance);
+            } else {
+                fprintf(stderr, "pick: nothing under the centre of the view\n");
+            }
+        });
+
+        sceneMenu -> addItem(NS::String::string("Pick Centre", UTF8StringEncoding), pickCentre, NS::String::string("p", UTF8StringEncoding)) -> setKeyEquivalentModifierMask(NS::EventModifierFlagCommand);
+
+        sceneMenuItem -> setSubmenu(sceneMenu);
+
         coreMenu -> addItem(appMenuItem);
         coreMenu -> addItem(windowMenuItem);
+        coreMenu -> addItem(sceneMenuItem);
 
         appMenuItem -> release();
         windowMenuItem -> release();
+        sceneMenuItem -> release();
         appMenu -> release();
         windowMenu -> release();
+        sceneMenu -> release();
 
         return coreMenu -> autorelease();
     }
@@ -223,7 +482,7 @@ int main() {
 
         CGRect frame = (CGRect) {
             {100.0, 100.0},
-            {1024.0, 1024.0}
+            {VIEW_SIZE, VIEW_SIZE}
         };
 
         _window = NS::Window::alloc() -> init(
@@ -241,7 +500,7 @@ int main() {
         _view -> setDepthStencilPixelFormat(MTL::PixelFormat::PixelFormatDepth16Unorm);
         _view -> setClearDepth(1.0f);
 
-        _coreViewDelegate = new CoreViewDelegate(_device);
+        _coreViewDelegate = new CoreViewDelegate(_device, _options);
 
         _view -> setDelegate(_coreViewDelegate);
 
@@ -263,9 +522,12 @@ int main() {
 #pragma mark - CoreViewDelegate
 #pragma region CoreViewDelegate {
 
-    CoreViewDelegate::CoreViewDelegate(MTL::Device* device) : MTK::ViewDelegate(), _render(new Render(device)) {}
+    CoreViewDelegate::CoreViewDelegate(MTL::Device* device, const RenderOptions& options) : MTK::ViewDelegate(), _render(new Render(device, options)) {
+        activeRender = _render;
+    }
 
     CoreViewDelegate::~CoreViewDelegate() {
+        activeRender = nullptr;
         delete _render;
     }
 
@@ -275,127 +537,139 @@ int main() {
 
 #pragma endregion CoreViewDelegate }
 
-#pragma mark - Math
+#pragma mark - Render
+#pragma region Render {
 
-    namespace math {
+    Render::Render(MTL::Device* device, const RenderOptions& options) : _device(device -> retain()), _uploadBuff(nullptr), _grid(options.grid, INSTANCE_SCALE, OBJECT_POSITION), _simulation(OBJECT_POSITION, ANGULAR_SPEED, options.simulationHz, INSTANCE_FORMAT != INSTANCE_FORMAT_PROCEDURAL), _pickerBuilt(false), _uploadDirty(UPLOAD_ALIGNMENT), _model(math::identity()), _angle(0.f), _animationId(0), _mandelbrotOptions(options.mandelbrotOptions), _pacer(options.framesInFlight), _gridSweep(options.gridSweep), _sweepStep(0), _sweepFrames(0), _sweepStart(std::chrono::steady_clock::now()), _frame(), _tracePath(options.tracePath) {
+        _commandQueue = _device -> newCommandQueue();
 
-        constexpr simd::float3 add(const simd::float3& a, const simd::float3& b) {
-            return {
-                a.x + b.x,
-                a.y + b.y,
-                a.z + b.z
-            };
-        }
+        if (options.mandelbrotCache) {
 
-        constexpr simd_float4x4 identity() {
-            return (simd_float4x4) {
-                (simd::float4) {1.f, 0.f, 0.f, 0.f},
-                (simd::float4) {0.f, 1.f, 0.f, 0.f},
-                (simd::float4) {0.f, 0.f, 1.f, 0.f},
-                (simd::float4) {0.f, 0.f, 0.f, 1.f}
-            };
+            const std::string path = MandelbrotCache::storePath(options.mandelbrotCache, TEXTURE_WIDTH, TEXTURE_HEIGHT, _mandelbrotOptions, options.mandelbrotCacheEncoding);
+
+            _mandelbrotCache = std::make_unique<MandelbrotCache>(TEXTURE_WIDTH, TEXTURE_HEIGHT, _mandelbrotOptions, MANDELBROT_CACHE_FRAMES, path.c_str(), options.mandelbrotCacheEncoding);
+            _mandelbrotCache -> prebake();
         }
 
-        simd::float4x4 perspective(float fov, float aspect, float nearZ, float farZ) {
+        buildShaders();
+        buildComputePipeline();
+        buildDepthStencilStates();
+        buildTextures();
+        buildBuffers();
+
+#if INSTANCE_FORMAT != INSTANCE_FORMAT_PROCEDURAL
+        _angleY.assign(_grid.count(), 0.f);
+        _angleZ.assign(_grid.count(), 0.f);
+#endif
 
-            float ys = 1.f / tanf(fov * 0.5f);
-            float xs = ys / aspect;
-            float zs = farZ / (nearZ - farZ);
+        _simulation.start(_grid);
 
-            return simd_matrix_from_rows(
-                (simd::float4) {xs, 0.0f, 0.0f, 0.0f},
-                (simd::float4) {0.0f, ys, 0.0f, 0.0f},
-                (simd::float4) {0.0f, 0.0f, zs, nearZ * zs},
-                (simd::float4) {0, 0, -1, 0}
-            );
-        }
+        buildFrameGraph();
+    }
 
-        simd::float4x4 rotateX(float radiansAngle) {
-            return simd_matrix_from_rows(
-                (simd::float4) {1.0f, 0.0f, 0.0f, 0.0f},
-                (simd::float4) {0.0f, cosf(radiansAngle), sinf(radiansAngle), 0.0f},
-                (simd::float4) {0.0f, -sinf(radiansAngle), cosf(radiansAngle), 0.0f},
-                (simd::float4) {0.0f, 0.0f, 0.0f, 1.0f}
-            );
-        }
+    Render::~Render() {
 
-        simd::float4x4 rotateY(float radiansAngle) {
-            return simd_matrix_from_rows(
-                (simd::float4) {cosf(radiansAngle), 0.0f, sinf(radiansAngle), 0.0f},
-                (simd::float4) {0.0f, 1.0f, 0.0f, 0.0f},
-                (simd::float4) {-sinf(radiansAngle), 0.0f, cosf(radiansAngle), 0.0f},
-                (simd::float4) {0.0f, 0.0f, 0.0f, 1.0f}
-            );
-        }
+        // Completion handlers still reference the ring and the arenas.
+        _pacer.drain();
+        _simulation.stop();
 
-        simd::float4x4 rotateZ(float radiansAngle) {
-            return simd_matrix_from_rows(
-                (simd::float4) {cosf(radiansAngle), sinf(radiansAngle), 0.0f, 0.0f},
-                (simd::float4) {-sinf(radiansAngle), cosf(radiansAngle), 0.0f, 0.0f},
-                (simd::float4) {0.0f, 0.0f, 1.0f, 0.0f},
-                (simd::float4) {0.0f, 0.0f, 0.0f, 1.0f}
-            );
-        }
+        const RingAllocator::Stats stats = _upload.stats();
+        const DirtyRanges::Stats dirty = _uploadDirty.stats();
 
-        simd::float4x4 translate(const simd::float3& vec) {
-            return simd_matrix(
-                (simd::float4) {1.0f, 0.0f, 0.0f, 0.0f},
-                (simd::float4) {0.0f, 1.0f, 0.0f, 0.0f},
-                (simd::float4) {0.0f, 0.0f, 1.0f, 0.0f},
-                (simd::float4) {vec.x, vec.y, vec.z, 1.0f}
+        fprintf(stderr, "upload ring: %zu B, high water %zu B, largest frame %zu B, %llu failed allocations\n",
+            stats.capacity,
+            stats.highWater,
+            stats.frameHighWater,
+            (unsigned long long) stats.failures
+        );
+
+        fprintf(stderr, "upload flushes: %llu B written, %llu B flushed in %llu ranges\n",
+            (unsigned long long) dirty.bytesMarked,
+            (unsigned long long) dirty.bytesFlushed,
+            (unsigned long long) dirty.flushes
+        );
+
+        const FramePacer::Stats pacing = _pacer.stats();
+
+        const auto reportHistogram = [](const char* name, const Histogram& histogram) {
+            fprintf(stderr, "%s: %llu samples, mean %.0f us, p50 %llu us, p95 %llu us, p99 %llu us, max %llu us\n",
+                name,
+                (unsigned long long) histogram.count(),
+                histogram.mean(),
+                (unsigned long long) histogram.percentile(0.50),
+                (unsigned long long) histogram.percentile(0.95),
+                (unsigned long long) histogram.percentile(0.99),
+                (unsigned long long) histogram.max()
             );
-        }
+        };
+
+        fprintf(stderr, "frame pacing: %u frames in flight\n", pacing.framesInFlight);
+
+        reportHistogram("  blocked", pacing.blocked);
+        reportHistogram("  latency", pacing.latency);
 
-        simd::float4x4 scale(const simd::float3& vec) {
-            return simd_matrix(
-                (simd::float4) {vec.x, 0, 0, 0},
-                (simd::float4) {0, vec.y, 0, 0},
-                (simd::float4) {0, 0, vec.z, 0},
-                (simd::float4) {0, 0, 0, 1.0}
+        const Simulation::Stats simulation = _simulation.stats();
+
+        fprintf(stderr, "simulation: %.0f Hz, %llu frames drew %llu new states\n", simulation.hz, (unsigned long long) simulation.reads, (unsigned long long) simulation.freshReads);
+
+        reportHistogram("  step", simulation.stepTime);
+
+        const TaskGraph::Stats graph = _frameGraph.stats();
+
+        if (graph.executions > 0) {
+            fprintf(stderr, "frame graph: %llu frames, mean %.0f us elapsed, %.0f us of work, %.0f us critical path\n",
+                (unsigned long long) graph.executions,
+                graph.wall / graph.executions,
+                graph.work / graph.executions,
+                graph.criticalPath / graph.executions
             );
         }
 
-        simd::float3x3 discard(const simd::float4x4& matr) {
-            return simd_matrix(
-                matr.columns[0].xyz,
-                matr.columns[1].xyz,
-                matr.columns[2].xyz
+        if (_mandelbrotCache) {
+
+            const MandelbrotCache::Stats cache = _mandelbrotCache -> stats();
+
+            fprintf(stderr, "mandelbrot cache: %llu frames, %llu from memory, %llu from the store, %llu rendered, %llu prebaked, %llu written behind; store %llu frames in %llu B, %llu not kept\n",
+                (unsigned long long) cache.lookups,
+                (unsigned long long) cache.memoryHits,
+                (unsigned long long) cache.storeHits,
+                (unsigned long long) cache.misses,
+                (unsigned long long) cache.baked,
+                (unsigned long long) cache.deferred,
+                (unsigned long long) cache.storeFrames,
+                (unsigned long long) cache.storeBytes,
+                (unsigned long long) cache.storeFailures
             );
+
+            reportHistogram("  lookup", cache.lookup);
         }
 
-    }
+        if (_tracePath) {
 
-#pragma mark - Render
-#pragma region Render {
+            FILE* trace = fopen(_tracePath, "w");
 
-    const int Render::FRAMES = 3;
+            if (trace) {
+                _frameGraph.writeTrace(trace);
+                fclose(trace);
+            } else {
+                fprintf(stderr, "could not write frame trace to %s\n", _tracePath);
+            }
+        }
 
-    Render::Render(MTL::Device* device) : _device(device -> retain()), _angle(0.f), _frame(0), _animationId(0) {
-        _commandQueue = _device -> newCommandQueue();
+        for (const FrameArena& arena : _arenas) {
 
-        buildShaders();
-        buildComputePipeline();
-        buildDepthStencilStates();
-        buildTextures();
-        buildBuffers();
+            const FrameArena::Stats arenaStats = arena.stats();
 
-        _semaphore = dispatch_semaphore_create(Render::FRAMES);
-    }
+            fprintf(stderr, "frame arena: %zu B, high water %zu B, %llu overflows\n", arenaStats.capacity, arenaStats.highWater, (unsigned long long) arenaStats.overflows);
+        }
 
-    Render::~Render() {
-        _textureAnimationBuff -> release();
+        _mandelbrotShadesBuff -> release();
         _texture -> release();
         _shaderLibrary -> release();
         _depthStencilState -> release();
         _vertexDataBuff -> release();
-
-        for (int i = 0; i < FRAMES; i++) {
-            _instanceDataBuff[i] -> release();
-        }
-
-        for (int i = 0; i < FRAMES; i++) {
-            _cameraDataBuff[i] -> release();
-        }
+        _uploadBuff -> release();
+        _instanceStaticBuff -> release();
 
         _indexBuff -> release();
         _comPipeState -> release();
@@ -404,43 +678,15 @@ int main() {
         _device -> release();
     }
 
-    namespace shader {
-
-        struct VertexData {
-
-            simd::float3 position;
-            simd::float3 normal;
-            simd::float2 coord;
-
-        };
-
-        struct InstanceData {
-
-            simd::float4x4 instanceTransform;
-            simd::float3x3 instanceNormalTransform;
-            simd::float4 instanceColor;
-
-        };
-
-        struct CameraData {
-
-            simd::float4x4 perspectiveTransform;
-            simd::float4x4 worldTransform;
-            simd::float3x3 worldNormalTransform;
-
-        };
-
-    }
-
     void Render::buildShaders() {
 
         using NS::UTF8StringEncoding;
 
-        const char* src = R"(
+        const char* src = SHADER_DEFINES R"(
             #include <metal_stdlib>
 
             using namespace metal;
-
+        )" SHADER_PROCEDURAL_SOURCE R"(
             struct v2f {
 
                 float4 position [[position]];
@@ -458,43 +704,143 @@ int main() {
 
             };
 
+            struct CameraData {
+
+                float4x4 perspectiveTransform;
+                float4x4 worldTransform;
+                float3x3 worldNormalTransform;
+
+            };
+
+            #if INSTANCE_FORMAT == INSTANCE_FORMAT_AFFINE
+
+            struct AffineInstanceData {
+
+                packed_float4 rows[3];
+
+            };
+
+            using Instance = AffineInstanceData;
+
+            float3 instancePosition(device const Instance& ins, float3 pos) {
+                float4 p = float4(pos, 1.0);
+                return float3(dot(float4(ins.rows[0]), p), dot(float4(ins.rows[1]), p), dot(float4(ins.rows[2]), p));
+            }
+
+            float3 instanceNormal(device const Instance& ins, float3 norm) {
+                return float3(dot(float4(ins.rows[0]).xyz, norm), dot(float4(ins.rows[1]).xyz, norm), dot(float4(ins.rows[2]).xyz, norm));
+            }
+
+            #elif INSTANCE_FORMAT == INSTANCE_FORMAT_QUATERNION
+
+            struct QuatInstanceData {
+
+                packed_float4 rotation;
+                packed_float3 position;
+                float scale;
+
+            };
+
+            using Instance = QuatInstanceData;
+
+            float3x3 instanceRotation(device const Instance& ins) {
+                float4 q = float4(ins.rotation);
+                float3 q2 = q.xyz * 2.0;
+                float xx = q.x * q2.x, yy = q.y * q2.y, zz = q.z * q2.z;
+                float xy = q.x * q2.y, xz = q.x * q2.z, yz = q.y * q2.z;
+                float wx = q.w * q2.x, wy = q.w * q2.y, wz = q.w * q2.z;
+                return float3x3(
+                    float3(1.0 - yy - zz, xy + wz, xz - wy),
+                    float3(xy - wz, 1.0 - xx - zz, yz + wx),
+                    float3(xz + wy, yz - wx, 1.0 - xx - yy)
+                );
+            }
+
+            float3 instancePosition(device const Instance& ins, float3 pos) {
+                return instanceRotation(ins) * (pos * ins.scale) + float3(ins.position);
+            }
+
+            float3 instanceNormal(device const Instance& ins, float3 norm) {
+                return instanceRotation(ins) * norm;
+            }
+
+            #elif INSTANCE_FORMAT == INSTANCE_FORMAT_PROCEDURAL
+
+            using InstanceBuffer = ProceduralUniforms;
+            using Instance = ProceduralTransform;
+
+            float4 instanceRow(thread const Instance& ins, uint r) {
+                return float4(ins.rows[r][0], ins.rows[r][1], ins.rows[r][2], ins.rows[r][3]);
+            }
+
+            float3 instancePosition(thread const Instance& ins, float3 pos) {
+                float4 p = float4(pos, 1.0);
+                return float3(dot(instanceRow(ins, 0), p), dot(instanceRow(ins, 1), p), dot(instanceRow(ins, 2), p));
+            }
+
+            float3 instanceNormal(thread const Instance& ins, float3 norm) {
+                return float3(dot(instanceRow(ins, 0).xyz, norm), dot(instanceRow(ins, 1).xyz, norm), dot(instanceRow(ins, 2).xyz, norm));
+            }
+
+            #else
+
             struct InstanceData {
 
                 float4x4 instanceTransform;
                 float3x3 instanceNormalTransform;
-                float4 instanceColor;
 
             };
 
-            struct CameraData {
+            using Instance = InstanceData;
 
-                float4x4 perspectiveTransform;
-                float4x4 worldTransform;
-                float3x3 worldNormalTransform;
+            float3 instancePosition(device const Instance& ins, float3 pos) {
+                return (ins.instanceTransform * float4(pos, 1.0)).xyz;
+            }
+
+            float3 instanceNormal(device const Instance& ins, float3 norm) {
+                return ins.instanceNormalTransform * norm;
+            }
+
+            #endif
+
+            #if INSTANCE_FORMAT != INSTANCE_FORMAT_PROCEDURAL
+            using InstanceBuffer = Instance;
+            #endif
+
+            struct StaticInstanceData {
+
+                uint instanceColor;
 
             };
 
             v2f vertex vertexCore(uint vertexId [[vertex_id]],
                 uint instanceId [[instance_id]],
                 device const VertexData* vertexData [[buffer(0)]],
-                device const InstanceData* instanceData [[buffer(1)]],
-                device const CameraData& cameraData [[buffer(2)]]) {
+                device const InstanceBuffer* instanceData [[buffer(1)]],
+                device const CameraData& cameraData [[buffer(2)]],
+                device const StaticInstanceData* staticData [[buffer(3)]],
+                device const uint* instanceIds [[buffer(4)]]) {
 
                     v2f out;
 
-                    float4 pos = float4(vertexData[vertexId].position, 1.0);
+                    #if INSTANCE_FORMAT == INSTANCE_FORMAT_PROCEDURAL
+                    const Instance ins = proceduralTransform(instanceData[0], instanceIds[instanceId]);
+                    #else
+                    device const Instance& ins = instanceData[instanceId];
+                    #endif
+
+                    float4 pos = float4(instancePosition(ins, vertexData[vertexId].position), 1.0);
 
-                    pos = instanceData[instanceId].instanceTransform * pos;
                     pos = cameraData.perspectiveTransform * cameraData.worldTransform * pos;
 
-                    float3 norm = instanceData[instanceId].instanceNormalTransform * vertexData[vertexId].normal;
+                    float3 norm = instanceNormal(ins, vertexData[vertexId].normal);
                     
                     norm = cameraData.worldNormalTransform * norm;
 
                     out.position = pos;
                     out.normal = norm;
                     out.coord = vertexData[vertexId].coord.xy;
-                    out.color = half3(instanceData[instanceId].instanceColor.rgb);
+                    out.color = half3(unpack_unorm4x8_to_float(staticData[instanceIds[instanceId]].instanceColor).rgb);
 
                     return out;
                 }
@@ -553,57 +899,39 @@ int main() {
 
     void Render::buildComputePipeline() {
 
+        // The zoom and the shades come from mandelbrot.cpp rather than the GPU's own cos and pow, and
+        // the loop is compiled without fast math or contraction, so the texture holds the same bytes
+        // as the CPU renderer and the cache. Compilers older than MSL 3.2 ignore the pragma.
         const char* src = R"(
             #include <metal_stdlib>
 
-            using namespace metal;
+            #pragma METAL fp contract(off)
 
+            using namespace metal;
+        )" SHADER_MANDELBROT_SOURCE R"(
             kernel void mandelbrotSet(uint2 id [[thread_position_in_grid]],
                 uint2 grid [[threads_per_grid]],
-                device const uint* frame [[buffer(0)]],
+                constant float& zoom [[buffer(0)]],
+                constant uint& options [[buffer(1)]],
+                constant float* shades [[buffer(2)]],
                 texture2d<half, access::write> tex [[texture(0)]]) {
 
-                    constexpr float animFreq = 0.01;
-                    constexpr float animSpeed = 4;
-                    constexpr float animScaleLow = 0.62;
-                    constexpr float animScale = 0.38;
-
-                    constexpr float2 mbPixelOffset = {-0.2, -0.35};
-                    constexpr float2 mbOrigin = {-1.2, -0.32};
-                    constexpr float2 mbScale = {2.2, 2.0};
-
-                    float zoom = animScaleLow + animScale * cos(animFreq * *frame);
-
-                    zoom = pow(zoom, animSpeed);
-
-                    float sclX = zoom * mbScale.x * ((float) id.x / grid.x + mbPixelOffset.x) + mbOrigin.x;
-                    float sclY = zoom * mbScale.y * ((float) id.y / grid.y + mbPixelOffset.y) + mbOrigin.y;
-
-                    float tempX = 0.0;
-                    float x = 0.0;
-                    float y = 0.0;
-
-                    uint iter = 0;
-                    uint maxIter = 1000;
-
-                    while (x * x + y * y <= 4 && iter < maxIter) {
-
-                        tempX = x * x - y * y + sclX;
-
-                        y = 2 * x * y + sclY;
-                        x = tempX;
+                    MandelbrotPoint c = mandelbrotPoint(zoom, id.x, id.y, grid.x, grid.y);
 
-                        iter += 1;
-                    }
-
-                    half color = (0.5 + 0.5 * cos(3.0 + iter * 0.15));
+                    half color = half(shades[mandelbrotIterations(c, options)]);
 
                     tex.write(half4(color, color, color, 1.0), id, 0);
                 }
         )";
 
+        MTL::CompileOptions* opts = MTL::CompileOptions::alloc() -> init();
+
+        opts -> setFastMathEnabled(false);
+
         NS::Error* err = nullptr;
-        MTL::Library* lib = _device -> newLibrary(NS::String::string(src, NS::UTF8StringEncoding), nullptr, &err);
+        MTL::Library* lib = _device -> newLibrary(NS::String::string(src, NS::UTF8StringEncoding), opts, &err);
+
+        opts -> release();
 
         if (!lib) {
             __builtin_printf("%s", err -> localizedDescription() -> utf8String());
@@ -721,39 +1049,189 @@ int main() {
         memcpy(_vertexDataBuff -> contents(), verts, vertexDataSize);
         memcpy(_indexBuff -> contents(), indices, indexDataSize);
 
-        _vertexDataBuff -> didModifyRange(NS::Range::Make(0, _vertexDataBuff -> length()));
-        _indexBuff -> didModifyRange(NS::Range::Make(0, _indexBuff -> length()));
+        _vertexDataBuff -> didModifyRange(NS::Range::Make(0, vertexDataSize));
+        _indexBuff -> didModifyRange(NS::Range::Make(0, indexDataSize));
+
+        reserveInstances(_grid.count());
+        buildStaticInstances();
+
+        const size_t shadesSize = (shader::mandelbrotMaxIterations() + 1) * sizeof(float);
+
+        _mandelbrotShadesBuff = _device -> newBuffer(shadesSize, MTL::ResourceStorageModeManaged);
+
+        memcpy(_mandelbrotShadesBuff -> contents(), mandelbrotShades(), shadesSize);
+
+        _mandelbrotShadesBuff -> didModifyRange(NS::Range::Make(0, shadesSize));
+    }
+
+    // Sizes the upload ring for frames of up to count visible instances: the pacer's frames in flight
+    // plus one more for the space lost when an allocation wraps. Grows geometrically; the old
+    // buffer stays alive for the frames still using it through their command buffers.
+    void Render::reserveInstances(size_t count) {
 
-        const size_t instanceDataSize = FRAMES * INSTANCES * sizeof(shader::InstanceData);
+        const size_t frameSize = alignUp(sizeof(shader::CameraData), UPLOAD_ALIGNMENT)
+            + alignUp(instanceStreamSize(count), UPLOAD_ALIGNMENT)
+            + alignUp(count * sizeof(uint32_t), UPLOAD_ALIGNMENT)
+            + (_mandelbrotCache ? alignUp(TEXTURE_BYTES, UPLOAD_ALIGNMENT) : 0);
 
-        for (size_t i = 0; i < FRAMES; i++) {
-            _instanceDataBuff[i] = _device -> newBuffer(instanceDataSize, MTL::ResourceStorageModeManaged);
+        const size_t required = (_pacer.framesInFlight() + 1) * frameSize;
+
+        if (required <= _upload.capacity()) {
+            return;
         }
 
-        const size_t cameraDataSize = FRAMES * sizeof(shader::CameraData);
+        const size_t capacity = _upload.capacity() * 2 > required ? _upload.capacity() * 2 : required;
 
-        for (size_t i = 0; i < FRAMES; i++) {
-            _cameraDataBuff[i] = _device -> newBuffer(cameraDataSize, MTL::ResourceStorageModeManaged);
+        if (_uploadBuff) {
+            _uploadBuff -> release();
         }
 
-        _textureAnimationBuff = _device -> newBuffer(sizeof(uint), MTL::ResourceStorageModeManaged);
+        _uploadBuff = _device -> newBuffer(capacity, MTL::ResourceStorageModeManaged);
+        _upload.reset(capacity);
     }
 
-    void Render::buildMandelbrotTexture(MTL::CommandBuffer* cmdBuff) {
+    // Offset of size bytes in _uploadBuff owned by the frame being built. When the frames still on
+    // the GPU hold the rest of the ring, waits for them to finish; the buffer cannot be replaced
+    // here, as the frame's earlier allocations live in it.
+    size_t Render::allocateUpload(size_t size) {
 
-        assert(cmdBuff);
+        size_t offset = 0;
+
+        size = size > 0 ? size : 1;
+
+        if (_upload.allocate(size, UPLOAD_ALIGNMENT, offset)) {
+            return offset;
+        }
+
+        _upload.waitForRetired();
+
+        if (_upload.allocate(size, UPLOAD_ALIGNMENT, offset)) {
+            return offset;
+        }
+
+        // reserveInstances sizes the ring for several whole frames, so this is a sizing bug.
+        const RingAllocator::Stats stats = _upload.stats();
+
+        fprintf(stderr, "upload ring of %zu B cannot fit %zu B with %zu B already taken by this frame\n", stats.capacity, size, stats.used);
+        abort();
+    }
+
+    // Trades latency for throughput: fewer frames in flight wait on the GPU sooner, more let the
+    // CPU run further ahead. The ring grows to match before the next frame is built.
+    void Render::setFramesInFlight(unsigned framesInFlight) {
+
+        _pacer.setFramesInFlight(framesInFlight);
+
+        reserveInstances(_grid.count());
+    }
+
+    void Render::resize(const GridSize& grid) {
+
+        _simulation.stop();
+
+        _grid = InstanceGrid(grid, INSTANCE_SCALE, OBJECT_POSITION);
+
+#if INSTANCE_FORMAT != INSTANCE_FORMAT_PROCEDURAL
+        _angleY.assign(_grid.count(), 0.f);
+        _angleZ.assign(_grid.count(), 0.f);
+#endif
+
+        _simulation.start(_grid);
+        _pickerBuilt = false;
+
+        _instanceStaticBuff -> release();
+
+        reserveInstances(_grid.count());
+        buildStaticInstances();
+    }
+
+    void Render::stepGrid(bool larger) {
+
+        const size_t count = _grid.count();
+
+        if (larger) {
+            for (size_t i = 0; i < GRID_SWEEP_SIZES; i++) {
+                if (GRID_SWEEP[i].count() > count) {
+                    resize(GRID_SWEEP[i]);
+                    break;
+                }
+            }
+        } else {
+            for (size_t i = GRID_SWEEP_SIZES; i-- > 0;) {
+                if (GRID_SWEEP[i].count() < count) {
+                    resize(GRID_SWEEP[i]);
+                    break;
+                }
+            }
+        }
+
+        fprintf(stderr, "grid: %zu instances\n", _grid.count());
+    }
+
+    // Reports the CPU time per frame at each GRID_SWEEP grid, from one draw call to the next, and
+    // quits after the largest.
+    void Render::advanceGridSweep() {
+
+        if (++_sweepFrames < GRID_SWEEP_FRAMES) {
+            return;
+        }
+
+        const std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - _sweepStart;
+
+        fprintf(stderr, "grid sweep: %zu instances, %.3f ms per frame\n", _grid.count(), elapsed.count() / _sweepFrames);
+
+        if (++_sweepStep == GRID_SWEEP_SIZES) {
+            _gridSweep = false;
+            NS::Application::sharedApplication() -> terminate(nullptr);
+            return;
+        }
+
+        resize(GRID_SWEEP[_sweepStep]);
+
+        _sweepFrames = 0;
+        _sweepStart = std::chrono::steady_clock::now();
+    }
+
+    // Colours depend only on the grid id, so they are uploaded once per grid and looked up
+    // through the id stream instead of being rewritten into every frame's instances.
+    void Render::buildStaticInstances() {
 
-        uint* ptr = reinterpret_cast<uint*>(_textureAnimationBuff -> contents());
+        const size_t size = _grid.count() * sizeof(shader::StaticInstanceData);
 
-        *ptr = (_animationId++) % 5000;
+        _instanceStaticBuff = _device -> newBuffer(size, MTL::ResourceStorageModeManaged);
 
-        _textureAnimationBuff -> didModifyRange(NS::Range::Make(0, sizeof(uint)));
+        ::buildStaticInstances(_grid.count(), reinterpret_cast<shader::StaticInstanceData*>(_instanceStaticBuff -> contents()));
+
+        _instanceStaticBuff -> didModifyRange(NS::Range::Make(0, size));
+
+        reportInstanceUpload();
+    }
+
+    void Render::reportInstanceUpload() const {
+
+        const size_t count = _grid.count();
+
+        fprintf(stderr, "instances: %zu, static %zu B once, at most %zu B instance data + %zu B ids per frame\n",
+            count,
+            count * sizeof(shader::StaticInstanceData),
+            instanceStreamSize(count),
+            count * sizeof(uint32_t)
+        );
+    }
+
+    void Render::buildMandelbrotTexture(MTL::CommandBuffer* cmdBuff) {
+
+        assert(cmdBuff);
+
+        const float zoom = mandelbrotFrameZoom((_animationId++) % MANDELBROT_CYCLE);
 
         MTL::ComputeCommandEncoder* comEncoder = cmdBuff -> computeCommandEncoder();
 
         comEncoder -> setComputePipelineState(_comPipeState);
         comEncoder -> setTexture(_texture, 0);
-        comEncoder -> setBuffer(_textureAnimationBuff, 0, 0);
+        comEncoder -> setBytes(&zoom, sizeof(zoom), 0);
+        comEncoder -> setBytes(&_mandelbrotOptions, sizeof(_mandelbrotOptions), 1);
+        comEncoder -> setBuffer(_mandelbrotShadesBuff, 0, 2);
 
         MTL::Size gridSize = MTL::Size(TEXTURE_WIDTH, TEXTURE_HEIGHT, 1);
 
@@ -765,118 +1243,269 @@ int main() {
         comEncoder -> endEncoding();
     }
 
-    void Render::draw(MTK::View* view) {
+    // The cached image of the next animation frame; a miss renders it on the pool.
+    void Render::fetchMandelbrotTexture() {
+        _frame.mandelbrot = _mandelbrotCache -> frame((_animationId++) % MANDELBROT_CYCLE, &_pool);
+    }
 
-        NS::AutoreleasePool* pool = NS::AutoreleasePool::alloc() -> init();
+    // Copies the fetched image into the frame's upload region and blits it into the texture ahead
+    // of the render pass, so frames still in flight keep sampling the image they were given.
+    void Render::uploadMandelbrotTexture() {
 
-        _frame = (_frame + 1) % Render::FRAMES;
+        const size_t offset = allocateUpload(TEXTURE_BYTES);
 
-        MTL::Buffer* insBuff = _instanceDataBuff[_frame];
-        MTL::CommandBuffer* cmdBuff = _commandQueue -> commandBuffer();
+        streamCopy(_frame.upload + offset, _frame.mandelbrot, TEXTURE_BYTES);
 
-        dispatch_semaphore_wait(_semaphore, DISPATCH_TIME_FOREVER);
-        Render* render = this;
+        _uploadDirty.mark(offset, TEXTURE_BYTES);
 
-        cmdBuff -> addCompletedHandler([render](MTL::CommandBuffer* cmdBuff) {
-            dispatch_semaphore_signal(render -> _semaphore);
-        });
+        MTL::BlitCommandEncoder* blitEncoder = _frame.cmdBuff -> blitCommandEncoder();
 
-        _angle += 0.002f;
-        const float scl = 0.2f;
+        blitEncoder -> copyFromBuffer(
+            _frame.uploadBuff,
+            offset,
+            TEXTURE_WIDTH * sizeof(uint32_t),
+            TEXTURE_BYTES,
+            MTL::Size(TEXTURE_WIDTH, TEXTURE_HEIGHT, 1),
+            _texture,
+            0,
+            0,
+            MTL::Origin(0, 0, 0)
+        );
 
-        shader::InstanceData* insData = reinterpret_cast<shader::InstanceData*>(insBuff -> contents());
+        blitEncoder -> endEncoding();
+    }
 
-        simd::float3 objectPos = {0.f, 0.f, -10.f};
+    // Instance under pixel (x, y) of a width x height view as of the last frame drawn.
+    bool Render::pick(float x, float y, float width, float height, PickHit& hit) {
 
-        simd::float4x4 trans = math::translate(objectPos);
-        simd::float4x4 rotY = math::rotateY(-_angle);
-        simd::float4x4 rotX = math::rotateX(_angle * 0.5);
-        simd::float4x4 inverTrans = math::translate({
-            -objectPos.x, -objectPos.y, -objectPos.z
+#if INSTANCE_FORMAT == INSTANCE_FORMAT_PROCEDURAL
+        // The procedural path leaves the CPU copy of the animation behind; catch it up for the hit test.
+        _grid.animate(_angle);
+
+        const InstanceBatch batch = _grid.batch();
+#else
+        const InstanceBatch batch = _grid.batch(_angleY.data(), _angleZ.data());
+#endif
+
+        if (!_pickerBuilt) {
+            _picker.build(batch, INSTANCE_RADIUS, INSTANCE_HALF_EXTENT, &_pool);
+            _pickerBuilt = true;
+        }
+
+        return _picker.pick(screenRay(_camera, x, y, width, height), _model, batch, hit);
+    }
+
+    // Stages of a frame and the data they share; anything that does not depend on another stage
+    // overlaps with it on the pool.
+    void Render::buildFrameGraph() {
+
+        _frameGraph.add("simulation", {}, {FrameModel}, [this]() {
+            updateSimulation();
         });
-        simd::float4x4 fullRot = trans * rotY * rotX * inverTrans;
 
-        size_t xI = 0;
-        size_t yI = 0;
-        size_t zI = 0;
+        _frameGraph.add("camera", {}, {FrameCamera, FrameUpload}, [this]() {
+            updateCamera();
+        });
 
-        for (size_t i = 0; i < INSTANCES; i++) {
+        if (_mandelbrotCache) {
+            _frameGraph.add("mandelbrot", {}, {FrameMandelbrot}, [this]() {
+                fetchMandelbrotTexture();
+            });
+        } else {
+            _frameGraph.add("mandelbrot", {}, {FrameMandelbrot, FrameCommands}, [this]() {
+                NS::AutoreleasePool* pool = NS::AutoreleasePool::alloc() -> init();
+                buildMandelbrotTexture(_frame.cmdBuff);
+                pool -> release();
+            });
+        }
 
-            if (xI == INSTANCE_ROWS) {
+        _frameGraph.add("instances", {FrameModel, FrameCamera}, {FrameUpload, FrameVisible}, [this]() {
+            updateInstances();
+        });
 
-                xI = 0;
-                yI += 1;
+        if (_mandelbrotCache) {
+            _frameGraph.add("texture", {FrameMandelbrot}, {FrameUpload, FrameCommands}, [this]() {
+                NS::AutoreleasePool* pool = NS::AutoreleasePool::alloc() -> init();
+                uploadMandelbrotTexture();
+                pool -> release();
+            });
+        }
 
-            }
+        _frameGraph.add("flush", {}, {FrameUpload}, [this]() {
+            flushUploads();
+        });
 
-            if (yI == INSTANCE_ROWS) {
+        _frameGraph.add("encode", {FrameUpload, FrameVisible, FrameMandelbrot}, {FrameCommands}, [this]() {
+            NS::AutoreleasePool* pool = NS::AutoreleasePool::alloc() -> init();
+            encodeFrame();
+            pool -> release();
+        });
+    }
 
-                yI = 0;
-                zI += 1;
+    void Render::updateSimulation() {
 
-            }
+        // The simulation one step in the past, blended between the two states around that time.
+        _frame.alpha = _simulation.sample(Simulation::Clock::now());
 
-            simd::float4x4 scale = math::scale((simd::float3) {scl, scl, scl});
-            simd::float4x4 rotZ = math::rotateZ(_angle * sinf((float) xI));
-            simd::float4x4 rotY = math::rotateY(_angle * cosf((float) yI));
+        _angle = _simulation.angle(_frame.alpha);
+        _model = _simulation.model(_angle);
+    }
 
-            float x = ((float) xI - (float) INSTANCE_ROWS / 2.f) * (2.f * scl) + scl;
-            float y = ((float) yI - (float) INSTANCE_COLUMNS / 2.f) * (2.f * scl) + scl;
-            float z = ((float) zI - (float) INSTANCE_DEPTH / 2.f) * (2.f * scl);
+    void Render::updateCamera() {
 
-            simd::float4x4 translate = math::translate(math::add(objectPos, {x, y, z}));
+        const size_t camOffset = allocateUpload(sizeof(shader::CameraData));
 
-            insData[i].instanceTransform = fullRot * translate * rotY * rotZ * scale;
-            insData[i].instanceNormalTransform = math::discard(insData[i].instanceTransform);
+        shader::CameraData* camData = reinterpret_cast<shader::CameraData*>(_frame.upload + camOffset);
 
-            float divIns = i / (float) INSTANCES;
-            float r = divIns;
-            float g = 1.0f - r;
-            float b = sinf(M_PI * 2.0f * divIns);
-            
-            insData[i].instanceColor = (simd::float4) {r, g, b, 1.0f};
+        _camera.perspectiveTransform = math::perspective(45.f * M_PI / 180.f, 1.f, 0.03f, 500.0f);
+        _camera.worldTransform = math::identity();
+        _camera.worldNormalTransform = math::discard(_camera.worldTransform);
 
-            xI += 1;
-        }
+        *camData = _camera;
         
-        insBuff -> didModifyRange(NS::Range::Make(0, insBuff -> length()));
+        _uploadDirty.mark(camOffset, sizeof(shader::CameraData));
+
+        _frame.camOffset = camOffset;
+    }
+
+    void Render::updateInstances() {
 
-        MTL::Buffer* camBuff = _cameraDataBuff[_frame];
+        uint8_t* upload = _frame.upload;
+        const math::float4x4& fullRot = _model;
 
-        shader::CameraData* camData = reinterpret_cast<shader::CameraData*>(camBuff -> contents());
+        Frustum frustum = extractFrustum(_camera.perspectiveTransform * _camera.worldTransform);
 
-        camData -> perspectiveTransform = math::perspective(45.f * M_PI / 180.f, 1.f, 0.03f, 500.0f);
-        camData -> worldTransform = math::identity();
-        camData -> worldNormalTransform = math::discard(camData -> worldTransform);
+#if INSTANCE_FORMAT == INSTANCE_FORMAT_PROCEDURAL
+        // Culling only needs the fixed grid positions, so the CPU skips the animation altogether
+        // and vertexCore rebuilds every visible transform from its grid id.
+        const size_t visible = _culler.cull(frustum, fullRot, _grid.batch(), INSTANCE_RADIUS, &_pool, _frame.arena -> resource());
+        const uint32_t* ids = _culler.ids();
+
+        const GridSize& size = _grid.size();
+        const size_t insOffset = allocateUpload(sizeof(shader::ProceduralUniforms));
+
+        *reinterpret_cast<shader::ProceduralUniforms*>(upload + insOffset) = {
+            _angle,
+            INSTANCE_SCALE,
+            (uint32_t) size.rows, (uint32_t) size.columns, (uint32_t) size.depth,
+            {OBJECT_POSITION.x, OBJECT_POSITION.y, OBJECT_POSITION.z},
+            {OBJECT_POSITION.x, OBJECT_POSITION.y, OBJECT_POSITION.z}
+        };
+
+        _uploadDirty.mark(insOffset, sizeof(shader::ProceduralUniforms));
+#else
+        const float alpha = _frame.alpha;
+
+        _pool.parallelFor(0, _grid.count(), INTERPOLATION_GRAIN, [&](size_t begin, size_t end) {
+            _simulation.interpolate(alpha, begin, end, _angleY.data(), _angleZ.data());
+        });
+
+        const InstanceBatch animated = _grid.batch(_angleY.data(), _angleZ.data());
+
+        const size_t visible = _culler.cull(frustum, fullRot, animated, INSTANCE_RADIUS, &_pool, _frame.arena -> resource());
+        const uint32_t* ids = _culler.ids();
+        const InstanceBatch batch = _culler.visible();
+
+        const size_t insOffset = allocateUpload(visible * sizeof(shader::Instance));
+
+        shader::Instance* insData = reinterpret_cast<shader::Instance*>(upload + insOffset);
+
+        _pool.parallelFor(0, visible, INSTANCE_GRAIN, [&](size_t begin, size_t end) {
+            streamInstanceTransforms(fullRot, batch, begin, end, insData);
+        });
         
-        camBuff -> didModifyRange(NS::Range::Make(0, sizeof(shader::CameraData)));
+        _uploadDirty.mark(insOffset, visible * sizeof(shader::Instance));
+#endif
+
+        const size_t idOffset = allocateUpload(visible * sizeof(uint32_t));
+
+        streamCopy(upload + idOffset, ids, visible * sizeof(uint32_t));
+
+        _uploadDirty.mark(idOffset, visible * sizeof(uint32_t));
+
+        _frame.insOffset = insOffset;
+        _frame.idOffset = idOffset;
+        _frame.visible = visible;
+    }
+
+    void Render::flushUploads() {
+
+        MTL::Buffer* uploadBuff = _frame.uploadBuff;
+
+        _upload.endFrame();
+
+        // The frame's allocations sit back to back apart from alignment padding, so this is
+        // usually a single flush, or two when the ring wrapped.
+        _uploadDirty.flush([uploadBuff](size_t offset, size_t length) {
+            uploadBuff -> didModifyRange(NS::Range::Make(offset, length));
+        });
+    }
 
-        buildMandelbrotTexture(cmdBuff);
+    void Render::encodeFrame() {
 
-        MTL::RenderPassDescriptor* passDesc = view -> currentRenderPassDescriptor();
-        MTL::RenderCommandEncoder* cmdEncoder = cmdBuff -> renderCommandEncoder(passDesc);
+        MTL::Buffer* uploadBuff = _frame.uploadBuff;
+        MTL::RenderCommandEncoder* cmdEncoder = _frame.cmdBuff -> renderCommandEncoder(_frame.passDesc);
 
         cmdEncoder -> setRenderPipelineState(_renPipeState);
         cmdEncoder -> setDepthStencilState(_depthStencilState);
         cmdEncoder -> setVertexBuffer(_vertexDataBuff, 0, 0);
-        cmdEncoder -> setVertexBuffer(insBuff, 0, 1);
-        cmdEncoder -> setVertexBuffer(camBuff, 0, 2);
+        cmdEncoder -> setVertexBuffer(uploadBuff, _frame.insOffset, 1);
+        cmdEncoder -> setVertexBuffer(uploadBuff, _frame.camOffset, 2);
+        cmdEncoder -> setVertexBuffer(_instanceStaticBuff, 0, 3);
+        cmdEncoder -> setVertexBuffer(uploadBuff, _frame.idOffset, 4);
         cmdEncoder -> setFragmentTexture(_texture, 0);
         cmdEncoder -> setCullMode(MTL::CullModeBack);
         cmdEncoder -> setFrontFacingWinding(MTL::Winding::WindingCounterClockwise);
-        cmdEncoder -> drawIndexedPrimitives(
-            MTL::PrimitiveType::PrimitiveTypeTriangle,
-            6 * 6,
-            MTL::IndexType::IndexTypeUInt16,
-            _indexBuff,
-            0,
-            INSTANCES
-        );
+        if (_frame.visible > 0) {
+            cmdEncoder -> drawIndexedPrimitives(
+                MTL::PrimitiveType::PrimitiveTypeTriangle,
+                6 * 6,
+                MTL::IndexType::IndexTypeUInt16,
+                _indexBuff,
+                0,
+                _frame.visible
+            );
+        }
         cmdEncoder -> endEncoding();
+    }
+
+    void Render::draw(MTK::View* view) {
+
+        NS::AutoreleasePool* pool = NS::AutoreleasePool::alloc() -> init();
+
+        MTL::CommandBuffer* cmdBuff = _commandQueue -> commandBuffer();
+
+        const uint64_t ticket = _pacer.begin();
+        Render* render = this;
+
+        const uint64_t frame = _upload.beginFrame();
+
+        cmdBuff -> addCompletedHandler([render, frame, ticket](MTL::CommandBuffer* cmdBuff) {
+            render -> _upload.retire(frame);
+            render -> _arenas[frame % FramePacer::MAX_FRAMES_IN_FLIGHT].reset();
+            render -> _pacer.complete(ticket);
+        });
+
+        _frame.cmdBuff = cmdBuff;
+        _frame.uploadBuff = _uploadBuff;
+        _frame.upload = reinterpret_cast<uint8_t*>(_uploadBuff -> contents());
+
+        // Transient CPU data for this frame, released with the frame's upload region. The pacer
+        // never lets more than MAX_FRAMES_IN_FLIGHT frames overlap, whatever its current limit.
+        _frame.arena = &_arenas[frame % FramePacer::MAX_FRAMES_IN_FLIGHT];
+
+        // The view is only touched here, on the thread that owns it.
+        _frame.passDesc = view -> currentRenderPassDescriptor();
+
+        _frameGraph.execute(_pool);
 
         cmdBuff -> presentDrawable(view -> currentDrawable());
         cmdBuff -> commit();
 
+        if (_gridSweep) {
+            advanceGridSweep();
+        }
+
         pool -> release();
     }
 
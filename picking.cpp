@@ -0,0 +1,227 @@
+#include "picking.h"
+
+#include <cfloat>
+
+#pragma region Rays {
+
+    Ray screenRay(const shader::CameraData& camera, float x, float y, float width, float height) {
+
+        const math::float4x4 inv = math::inverse(camera.perspectiveTransform * camera.worldTransform);
+
+        const float ndcX = 2.f * x / width - 1.f;
+        const float ndcY = 1.f - 2.f * y / height;
+
+        math::float4 near = inv * math::float4(ndcX, ndcY, 0.f, 1.f);
+        math::float4 far = inv * math::float4(ndcX, ndcY, 1.f, 1.f);
+
+        math::float3 a = near.xyz() * (1.f / near.w);
+        math::float3 b = far.xyz() * (1.f / far.w);
+
+        return {a, math::normalize(b - a)};
+    }
+
+    // Ray against one instance cube in its local frame. Returns the entry distance, or 0 when the
+    // origin is inside, and a negative value for a miss or a hit beyond limit.
+    static float hitInstance(const InstanceBatch& batch, uint32_t i, float halfExtent, const math::float3& o, const math::float3& d, float limit) {
+
+        const math::float3 rel = o - math::float3(batch.x[i], batch.y[i], batch.z[i]);
+
+        // Reject against the bounding sphere before building the rotation.
+        const float extent = halfExtent * batch.scale[i];
+        const float closest = -math::dot(rel, d) / math::dot(d, d);
+        const math::float3 miss = rel + d * closest;
+
+        if (math::dot(miss, miss) > 3.f * extent * extent) {
+            return -1.f;
+        }
+
+        const math::float3x3 r = math::rotationYZ(batch.angleY[i], batch.angleZ[i]);
+
+        const float inv = 1.f / batch.scale[i];
+
+        float near = 0.f, far = limit;
+
+        for (size_t a = 0; a < 3; a++) {
+
+            const float lo = math::dot(r.columns[a], rel) * inv;
+            const float ld = math::dot(r.columns[a], d) * inv;
+
+            const float t0 = (-halfExtent - lo) / ld;
+            const float t1 = (halfExtent - lo) / ld;
+
+            near = fmaxf(near, fminf(t0, t1));
+            far = fminf(far, fmaxf(t0, t1));
+        }
+
+        return near <= far ? near : -1.f;
+    }
+
+#pragma endregion Rays }
+
+#pragma region InstancePicker {
+
+    void InstancePicker::build(const InstanceBatch& batch, float radius, float halfExtent, ThreadPool* pool) {
+
+        _halfExtent = halfExtent;
+
+        _bounds.resize(batch.count);
+
+        instanceBounds(math::identity(), batch, radius, _bounds.batch());
+
+        _bvh.build(_bounds.batch(), pool);
+    }
+
+    bool InstancePicker::pick(const Ray& ray, const math::float4x4& model, const InstanceBatch& batch, PickHit& hit) const {
+
+        // The model is affine, so distances along the transformed ray match the original ones.
+        const math::float4x4 inv = math::inverse(model);
+
+        const math::float3 o = (inv * math::float4(ray.origin, 1.f)).xyz();
+        const math::float3 d = (inv * math::float4(ray.direction, 0.f)).xyz();
+
+        float t;
+
+        uint32_t id = _bvh.intersect(o, d, FLT_MAX, [&](uint32_t i, float limit) {
+            return hitInstance(batch, i, _halfExtent, o, d, limit);
+        }, t);
+
+        if (id == UINT32_MAX) {
+            return false;
+        }
+
+        hit.id = id;
+        hit.distance = t;
+        hit.position = ray.origin + ray.direction * t;
+
+        return true;
+    }
+
+    size_t InstancePicker::pick(const Ray* rays, size_t count, const math::float4x4& model, const InstanceBatch& batch, PickHit* hits) const {
+
+        using math::vfloat;
+
+        constexpr size_t lanes = vfloat::lanes;
+
+        const std::vector<BVHNode>& nodes = _bvh.nodes();
+        const uint32_t* indices = _bvh.indices();
+
+        const math::float4x4 inv = math::inverse(model);
+
+        size_t found = 0;
+
+        for (size_t base = 0; base < count; base += lanes) {
+
+            const size_t n = count - base < lanes ? count - base : lanes;
+
+            math::float3 o[lanes], d[lanes];
+
+            alignas(64) float ox[lanes], oy[lanes], oz[lanes];
+            alignas(64) float ix[lanes], iy[lanes], iz[lanes];
+            alignas(64) float best[lanes];
+
+            uint32_t ids[lanes];
+
+            for (size_t l = 0; l < lanes; l++) {
+
+                // Pad the last packet with copies of its first ray; their results are dropped.
+                const Ray& ray = rays[base + (l < n ? l : 0)];
+
+                o[l] = (inv * math::float4(ray.origin, 1.f)).xyz();
+                d[l] = (inv * math::float4(ray.direction, 0.f)).xyz();
+
+                ox[l] = o[l].x;
+                oy[l] = o[l].y;
+                oz[l] = o[l].z;
+                ix[l] = 1.f / d[l].x;
+                iy[l] = 1.f / d[l].y;
+                iz[l] = 1.f / d[l].z;
+
+                best[l] = FLT_MAX;
+                ids[l] = UINT32_MAX;
+            }
+
+            // Children are visited front to back along the packet's mean direction.
+            math::float3 mean(0.f, 0.f, 0.f);
+
+            for (size_t l = 0; l < lanes; l++) {
+                mean = mean + d[l];
+            }
+
+            const vfloat vox = vfloat::load(ox), voy = vfloat::load(oy), voz = vfloat::load(oz);
+            const vfloat vix = vfloat::load(ix), viy = vfloat::load(iy), viz = vfloat::load(iz);
+
+            uint32_t stack[64];
+            size_t top = 0;
+
+            if (!nodes.empty()) {
+                stack[top++] = 0;
+            }
+
+            while (top > 0) {
+
+                const BVHNode& node = nodes[stack[--top]];
+
+                const vfloat x0 = (vfloat(node.min[0]) - vox) * vix, x1 = (vfloat(node.max[0]) - vox) * vix;
+                const vfloat y0 = (vfloat(node.min[1]) - voy) * viy, y1 = (vfloat(node.max[1]) - voy) * viy;
+                const vfloat z0 = (vfloat(node.min[2]) - voz) * viz, z1 = (vfloat(node.max[2]) - voz) * viz;
+
+                const vfloat near = math::max(math::max(math::min(x0, x1), math::min(y0, y1)), math::max(math::min(z0, z1), vfloat(0.f)));
+                const vfloat far = math::min(math::min(math::max(x0, x1), math::max(y0, y1)), math::min(math::max(z0, z1), vfloat::load(best)));
+
+                const unsigned active = (unsigned) movemask(near <= far);
+
+                if (!active) {
+                    continue;
+                }
+
+                if (node.count == 0) {
+
+                    const BVHNode& left = nodes[node.offset];
+                    const BVHNode& right = nodes[node.offset + 1];
+
+                    const float order =
+                        (left.min[0] + left.max[0] - right.min[0] - right.max[0]) * mean.x +
+                        (left.min[1] + left.max[1] - right.min[1] - right.max[1]) * mean.y +
+                        (left.min[2] + left.max[2] - right.min[2] - right.max[2]) * mean.z;
+
+                    stack[top++] = order < 0.f ? node.offset + 1 : node.offset;
+                    stack[top++] = order < 0.f ? node.offset : node.offset + 1;
+                    continue;
+                }
+
+                for (uint32_t k = node.offset; k < node.offset + node.count; k++) {
+
+                    const uint32_t i = indices[k];
+
+                    for (unsigned bits = active; bits; bits &= bits - 1) {
+
+                        const size_t l = (size_t) __builtin_ctz(bits);
+
+                        float t = hitInstance(batch, i, _halfExtent, o[l], d[l], best[l]);
+
+                        if (t >= 0.f && t < best[l]) {
+                            best[l] = t;
+                            ids[l] = i;
+                        }
+                    }
+                }
+            }
+
+            for (size_t l = 0; l < n; l++) {
+
+                const Ray& ray = rays[base + l];
+
+                PickHit& hit = hits[base + l];
+
+                hit.id = ids[l];
+                hit.distance = best[l];
+                hit.position = ids[l] != UINT32_MAX ? ray.origin + ray.direction * best[l] : ray.origin;
+
+                found += ids[l] != UINT32_MAX;
+            }
+        }
+
+        return found;
+    }
+
+#pragma endregion InstancePicker }
@@ -0,0 +1,53 @@
+#ifndef PICKING_H
+#define PICKING_H
+
+#include <cstdint>
+
+#include "bvh.h"
+
+struct Ray {
+
+    math::float3 origin;
+    math::float3 direction;
+
+};
+
+struct PickHit {
+
+    uint32_t id;
+    float distance;
+    math::float3 position;
+
+};
+
+// Ray through pixel (x, y) of a width x height view, y pointing down, in the space the instance
+// transforms map to (before camera.worldTransform).
+Ray screenRay(const shader::CameraData& camera, float x, float y, float width, float height);
+
+class InstancePicker {
+
+    public:
+
+        // Builds the tree over the bounds of batch in its own space, which only changes when the
+        // positions or scales do. Instances are cubes of halfExtent * scale rotated by
+        // rotationYZ(angleY, angleZ); radius bounds them. The tree is built across pool when one
+        // is given.
+        void build(const InstanceBatch& batch, float radius, float halfExtent, ThreadPool* pool = nullptr);
+
+        // Nearest instance along ray, with model mapping the batch space to the ray's space as
+        // fullRot does for the kernels. batch must be the one built from, with current angles.
+        bool pick(const Ray& ray, const math::float4x4& model, const InstanceBatch& batch, PickHit& hit) const;
+
+        // Traces rays in packets of math::vfloat::lanes. Misses get id UINT32_MAX. Returns the number of hits.
+        size_t pick(const Ray* rays, size_t count, const math::float4x4& model, const InstanceBatch& batch, PickHit* hits) const;
+
+    private:
+
+        BoxArray _bounds;
+        BVH _bvh;
+
+        float _halfExtent = 0.5f;
+
+};
+
+#endif
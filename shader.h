@@ -0,0 +1,380 @@
+#ifndef SHADER_H
+#define SHADER_H
+
+#include "mathlib.h"
+
+#define INSTANCE_FORMAT_MATRIX 0
+#define INSTANCE_FORMAT_AFFINE 1
+#define INSTANCE_FORMAT_QUATERNION 2
+#define INSTANCE_FORMAT_PROCEDURAL 3
+
+#ifndef INSTANCE_FORMAT
+    #define INSTANCE_FORMAT INSTANCE_FORMAT_MATRIX
+#endif
+
+#define SHADER_STRINGIFY_(x) #x
+#define SHADER_STRINGIFY(x) SHADER_STRINGIFY_(x)
+
+#define SHADER_EMIT(...) __VA_ARGS__
+#define SHADER_SOURCE(...) #__VA_ARGS__ "\n"
+
+#define SHADER_DEFINES \
+    "#define INSTANCE_FORMAT_MATRIX " SHADER_STRINGIFY(INSTANCE_FORMAT_MATRIX) "\n" \
+    "#define INSTANCE_FORMAT_AFFINE " SHADER_STRINGIFY(INSTANCE_FORMAT_AFFINE) "\n" \
+    "#define INSTANCE_FORMAT_QUATERNION " SHADER_STRINGIFY(INSTANCE_FORMAT_QUATERNION) "\n" \
+    "#define INSTANCE_FORMAT_PROCEDURAL " SHADER_STRINGIFY(INSTANCE_FORMAT_PROCEDURAL) "\n" \
+    "#define INSTANCE_FORMAT " SHADER_STRINGIFY(INSTANCE_FORMAT) "\n"
+
+// Procedural instances: the whole grid animation as a function of the grid id and a few uniforms.
+// The code is written once and expanded twice, as C++ below and as MSL source through
+// SHADER_PROCEDURAL_SOURCE, so it may only use what both languages share: scalar floats, uint,
+// fixed-size arrays, sin and cos. It reproduces InstanceGrid, animate and the transform kernels:
+// pivot-rotation * translate(p) * rotateY(angle * cos(y)) * rotateZ(angle * sin(x)) * scale(s),
+// where the pivot rotation is rotateY(-angle) * rotateX(angle / 2) about pivot.
+#define SHADER_PROCEDURAL(X) X( \
+    struct ProceduralUniforms { \
+        float angle; \
+        float scale; \
+        uint rows; \
+        uint columns; \
+        uint depth; \
+        float origin[3]; \
+        float pivot[3]; \
+    }; \
+    struct ProceduralTransform { \
+        float rows[3][4]; \
+    }; \
+    inline ProceduralTransform proceduralTransform(ProceduralUniforms u, uint id) { \
+        uint xI = id % u.rows; \
+        uint yI = (id / u.rows) % u.columns; \
+        uint zI = id / (u.rows * u.columns); \
+        float s = u.scale; \
+        float p[3] = { \
+            u.origin[0] + (float(xI) - float(u.rows) / 2.0f) * (2.0f * s) + s, \
+            u.origin[1] + (float(yI) - float(u.columns) / 2.0f) * (2.0f * s) + s, \
+            u.origin[2] + (float(zI) - float(u.depth) / 2.0f) * (2.0f * s) \
+        }; \
+        float angleY = u.angle * cos(float(yI)); \
+        float angleZ = u.angle * sin(float(xI)); \
+        float sy = sin(angleY), cy = cos(angleY), sz = sin(angleZ), cz = cos(angleZ); \
+        float local[3][3] = { \
+            {s * cy * cz, s * cy * sz, s * sy}, \
+            {-s * sz, s * cz, 0.0f}, \
+            {-s * sy * cz, -s * sy * sz, s * cy} \
+        }; \
+        float s1 = sin(-u.angle), c1 = cos(-u.angle), s2 = sin(u.angle * 0.5f), c2 = cos(u.angle * 0.5f); \
+        float rotY[3][3] = {{c1, 0.0f, s1}, {0.0f, 1.0f, 0.0f}, {-s1, 0.0f, c1}}; \
+        float rotX[3][3] = {{1.0f, 0.0f, 0.0f}, {0.0f, c2, s2}, {0.0f, -s2, c2}}; \
+        float model[3][3]; \
+        for (int r = 0; r < 3; r++) { \
+            for (int c = 0; c < 3; c++) { \
+                model[r][c] = rotY[r][0] * rotX[0][c] + rotY[r][1] * rotX[1][c] + rotY[r][2] * rotX[2][c]; \
+            } \
+        } \
+        float q[3] = {p[0] - u.pivot[0], p[1] - u.pivot[1], p[2] - u.pivot[2]}; \
+        ProceduralTransform t; \
+        for (int r = 0; r < 3; r++) { \
+            for (int c = 0; c < 3; c++) { \
+                t.rows[r][c] = model[r][0] * local[0][c] + model[r][1] * local[1][c] + model[r][2] * local[2][c]; \
+            } \
+            t.rows[r][3] = model[r][0] * q[0] + model[r][1] * q[1] + model[r][2] * q[2] + u.pivot[r]; \
+        } \
+        return t; \
+    } \
+)
+
+#define SHADER_PROCEDURAL_SOURCE SHADER_PROCEDURAL(SHADER_SOURCE)
+
+// The mandelbrotSet texture as a function of the pixel and the animation frame, shared the same way
+// by the compute kernel and the CPU renderer in mandelbrot.h. The literals are floats in both
+// languages; MSL reads 0.62 as a float where C++ would read a double.
+//
+// Both options end the loop early for points that will never escape, and count them as
+// mandelbrotMaxIterations() like the full loop would. MandelbrotSkipBulbs tests c against the main
+// cardioid and the period-2 bulb. MandelbrotSkipCycles is Brent's cycle detection: z is compared
+// with a saved point that jumps to z whenever the steps since the last jump reach a power of two.
+// The step is a fixed function of z, so an orbit that returns to a float it has already visited
+// repeats forever; the test is exact equality and changes no result. mandelbrotEscape also returns
+// the steps actually taken.
+//
+// The compute kernel only runs the loop itself: it takes the zoom and the shades from the CPU
+// (mandelbrot.h), and is built without fast math, so the GPU and CPU images have the same bytes.
+#define SHADER_MANDELBROT(X) X( \
+    struct MandelbrotPoint { \
+        float x; \
+        float y; \
+    }; \
+    struct MandelbrotEscape { \
+        uint iter; \
+        uint steps; \
+    }; \
+    enum MandelbrotOption : uint { \
+        MandelbrotSkipBulbs = 1, \
+        MandelbrotSkipCycles = 2 \
+    }; \
+    inline uint mandelbrotMaxIterations() { \
+        return 1000; \
+    } \
+    inline float mandelbrotZoom(uint frame) { \
+        constexpr float animFreq = 0.01f; \
+        constexpr float animSpeed = 4.0f; \
+        constexpr float animScaleLow = 0.62f; \
+        constexpr float animScale = 0.38f; \
+        float zoom = animScaleLow + animScale * cos(animFreq * float(frame)); \
+        return pow(zoom, animSpeed); \
+    } \
+    inline MandelbrotPoint mandelbrotPoint(float zoom, uint x, uint y, uint width, uint height) { \
+        constexpr float mbPixelOffsetX = -0.2f; \
+        constexpr float mbPixelOffsetY = -0.35f; \
+        constexpr float mbOriginX = -1.2f; \
+        constexpr float mbOriginY = -0.32f; \
+        constexpr float mbScaleX = 2.2f; \
+        constexpr float mbScaleY = 2.0f; \
+        MandelbrotPoint c; \
+        c.x = zoom * mbScaleX * (float(x) / float(width) + mbPixelOffsetX) + mbOriginX; \
+        c.y = zoom * mbScaleY * (float(y) / float(height) + mbPixelOffsetY) + mbOriginY; \
+        return c; \
+    } \
+    inline bool mandelbrotInterior(MandelbrotPoint c) { \
+        float xq = c.x - 0.25f; \
+        float y2 = c.y * c.y; \
+        float q = xq * xq + y2; \
+        if (q * (q + xq) <= 0.25f * y2) { \
+            return true; \
+        } \
+        float xb = c.x + 1.0f; \
+        return xb * xb + y2 <= 0.0625f; \
+    } \
+    inline MandelbrotEscape mandelbrotEscape(MandelbrotPoint c, uint options) { \
+        uint maxIter = mandelbrotMaxIterations(); \
+        if ((options & MandelbrotSkipBulbs) && mandelbrotInterior(c)) { \
+            return MandelbrotEscape{maxIter, 0}; \
+        } \
+        float tempX = 0.0f; \
+        float x = 0.0f; \
+        float y = 0.0f; \
+        float cycleX = 0.0f; \
+        float cycleY = 0.0f; \
+        uint cyclePower = 1; \
+        uint cycleSteps = 0; \
+        uint iter = 0; \
+        while (x * x + y * y <= 4.0f && iter < maxIter) { \
+            tempX = x * x - y * y + c.x; \
+            y = 2.0f * x * y + c.y; \
+            x = tempX; \
+            iter += 1; \
+            if (options & MandelbrotSkipCycles) { \
+                if (x == cycleX && y == cycleY) { \
+                    return MandelbrotEscape{maxIter, iter}; \
+                } \
+                cycleSteps += 1; \
+                if (cycleSteps == cyclePower) { \
+                    cycleX = x; \
+                    cycleY = y; \
+                    cyclePower *= 2; \
+                    cycleSteps = 0; \
+                } \
+            } \
+        } \
+        return MandelbrotEscape{iter, iter}; \
+    } \
+    inline uint mandelbrotIterations(MandelbrotPoint c, uint options) { \
+        return mandelbrotEscape(c, options).iter; \
+    } \
+    inline float mandelbrotShade(uint iter) { \
+        return 0.5f + 0.5f * cos(3.0f + float(iter) * 0.15f); \
+    } \
+)
+
+#define SHADER_MANDELBROT_SOURCE SHADER_MANDELBROT(SHADER_SOURCE)
+
+namespace shader {
+
+    using std::cos;
+    using std::pow;
+    using std::sin;
+
+    using uint = uint32_t;
+
+    SHADER_PROCEDURAL(SHADER_EMIT)
+
+    SHADER_MANDELBROT(SHADER_EMIT)
+
+    struct VertexData {
+
+        math::float3 position;
+        math::float3 normal;
+        math::float2 coord;
+
+    };
+
+    struct InstanceData {
+
+        math::float4x4 instanceTransform;
+        math::float3x3 instanceNormalTransform;
+
+    };
+
+    // Compact layout: the top three rows of the instance transform. The normal transform is
+    // rebuilt from the rows in vertexCore.
+    struct AffineInstanceData {
+
+        float rows[3][4];
+
+    };
+
+    // Rigid transform with uniform scale: rotation quaternion, translation and scale, expanded
+    // to a matrix in the vertex stage.
+    struct QuatInstanceData {
+
+        float rotation[4];
+        float position[3];
+        float scale;
+
+    };
+
+    // Attributes that never change for an instance, indexed by its grid id rather than its slot
+    // in the per-frame stream. Written once per grid.
+    struct StaticInstanceData {
+
+        uint32_t instanceColor;
+
+    };
+
+    struct CameraData {
+
+        math::float4x4 perspectiveTransform;
+        math::float4x4 worldTransform;
+        math::float3x3 worldNormalTransform;
+
+    };
+
+    static_assert(sizeof(VertexData) == 48, "VertexData must match the MSL layout");
+    static_assert(sizeof(InstanceData) == 112, "InstanceData must match the MSL layout");
+    static_assert(sizeof(AffineInstanceData) == 48, "AffineInstanceData must match the MSL layout");
+    static_assert(sizeof(QuatInstanceData) == 32, "QuatInstanceData must match the MSL layout");
+    static_assert(sizeof(StaticInstanceData) == 4, "StaticInstanceData must match the MSL layout");
+    static_assert(sizeof(ProceduralUniforms) == 44, "ProceduralUniforms must match the MSL layout");
+    static_assert(sizeof(CameraData) == 176, "CameraData must match the MSL layout");
+
+#if INSTANCE_FORMAT == INSTANCE_FORMAT_AFFINE
+    using Instance = AffineInstanceData;
+#elif INSTANCE_FORMAT == INSTANCE_FORMAT_QUATERNION
+    using Instance = QuatInstanceData;
+#elif INSTANCE_FORMAT == INSTANCE_FORMAT_PROCEDURAL
+    using Instance = ProceduralTransform;
+#else
+    using Instance = InstanceData;
+#endif
+
+    inline uint32_t packColor(const math::float4& c) {
+
+        auto unorm = [](float f) {
+            f = f < 0.f ? 0.f : (f > 1.f ? 1.f : f);
+            return (uint32_t) (f * 255.f + 0.5f);
+        };
+
+        return unorm(c.x) | (unorm(c.y) << 8) | (unorm(c.z) << 16) | (unorm(c.w) << 24);
+    }
+
+    inline math::float4 unpackColor(uint32_t c) {
+        return math::float4(
+            (float) (c & 0xFF) / 255.f,
+            (float) ((c >> 8) & 0xFF) / 255.f,
+            (float) ((c >> 16) & 0xFF) / 255.f,
+            (float) (c >> 24) / 255.f
+        );
+    }
+
+    inline void setTransform(InstanceData& ins, const math::affine& transform) {
+
+        const math::float4x4 matrix = math::toMatrix(transform);
+
+        ins.instanceTransform = matrix;
+        ins.instanceNormalTransform = math::discard(matrix);
+    }
+
+    inline void setTransform(AffineInstanceData& ins, const math::affine& transform) {
+        for (size_t r = 0; r < 3; r++) {
+            ins.rows[r][0] = transform.rows[r].x;
+            ins.rows[r][1] = transform.rows[r].y;
+            ins.rows[r][2] = transform.rows[r].z;
+            ins.rows[r][3] = transform.rows[r].w;
+        }
+    }
+
+    inline void setTransform(QuatInstanceData& ins, const math::quat& rotation, const math::float3& position, float scale) {
+
+        ins.rotation[0] = rotation.x;
+        ins.rotation[1] = rotation.y;
+        ins.rotation[2] = rotation.z;
+        ins.rotation[3] = rotation.w;
+
+        ins.position[0] = position.x;
+        ins.position[1] = position.y;
+        ins.position[2] = position.z;
+
+        ins.scale = scale;
+    }
+
+    // Assumes the linear part is a rotation times a uniform scale.
+    inline void setTransform(QuatInstanceData& ins, const math::affine& transform) {
+
+        const math::float3 c0(transform.rows[0].x, transform.rows[1].x, transform.rows[2].x);
+        const math::float3 c1(transform.rows[0].y, transform.rows[1].y, transform.rows[2].y);
+        const math::float3 c2(transform.rows[0].z, transform.rows[1].z, transform.rows[2].z);
+
+        const float scale = math::length(c0);
+        const float inv = 1.f / scale;
+
+        const math::quat rotation = math::toQuat(math::float3x3(c0 * inv, c1 * inv, c2 * inv));
+        const math::float3 position(transform.rows[0].w, transform.rows[1].w, transform.rows[2].w);
+
+        setTransform(ins, rotation, position, scale);
+    }
+
+    // Converts a transform from the InstanceData path into the quaternion encoding.
+    inline QuatInstanceData encode(const math::float4x4& transform) {
+
+        QuatInstanceData ins;
+
+        setTransform(ins, math::toAffine(transform));
+
+        return ins;
+    }
+
+    // CPU reference of what vertexCore reconstructs from the compact layout.
+    inline InstanceData decode(const AffineInstanceData& ins) {
+
+        const float (*r)[4] = ins.rows;
+
+        InstanceData out;
+
+        out.instanceTransform = math::fromRows(
+            math::float4(r[0][0], r[0][1], r[0][2], r[0][3]),
+            math::float4(r[1][0], r[1][1], r[1][2], r[1][3]),
+            math::float4(r[2][0], r[2][1], r[2][2], r[2][3]),
+            math::float4(0.f, 0.f, 0.f, 1.f)
+        );
+        out.instanceNormalTransform = math::discard(out.instanceTransform);
+
+        return out;
+    }
+
+    // CPU reference of the vertex-stage expansion.
+    inline InstanceData decode(const QuatInstanceData& ins) {
+
+        const math::quat q(ins.rotation[0], ins.rotation[1], ins.rotation[2], ins.rotation[3]);
+        const math::float3 t(ins.position[0], ins.position[1], ins.position[2]);
+
+        InstanceData out;
+
+        out.instanceTransform = math::toMatrix(math::trs(t, q, ins.scale));
+        out.instanceNormalTransform = math::discard(out.instanceTransform);
+
+        return out;
+    }
+
+}
+
+#endif
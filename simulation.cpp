@@ -0,0 +1,176 @@
+#include "simulation.h"
+
+#include <cstdlib>
+#include <utility>
+
+#pragma region Simulation {
+
+    Simulation::Simulation(const math::float3& pivot, float angularSpeed, double hz, bool animateInstances) : _pivot(pivot), _angularSpeed(angularSpeed), _hz(hz), _period(std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(1.0 / hz))), _animateInstances(animateInstances) {}
+
+    Simulation::~Simulation() {
+        stop();
+    }
+
+    void Simulation::start(const InstanceGrid& grid) {
+
+        stop();
+
+        _grid = &grid;
+
+        const size_t count = _animateInstances ? grid.count() : 0;
+
+        // Carry on from the last step taken, whenever that was.
+        _epoch = Clock::now() - _steps * _period;
+
+        _mailbox.reset({0, _epoch, 0.f, std::vector<float>(count), std::vector<float>(count)});
+
+        step(_mailbox.back());
+        _mailbox.publish();
+        _mailbox.update();
+
+        _previous = _mailbox.front();
+
+        _stopping = false;
+        _thread = std::thread(&Simulation::run, this);
+    }
+
+    void Simulation::stop() {
+
+        if (!_thread.joinable()) {
+            return;
+        }
+
+        {
+            std::lock_guard<std::mutex> guard(_lock);
+            _stopping = true;
+        }
+
+        _wake.notify_all();
+        _thread.join();
+    }
+
+    float Simulation::sample(Clock::time_point now) {
+
+        _reads++;
+
+        if (_mailbox.pending()) {
+
+            // The state being left behind is where the blend starts. Swapping hands its old
+            // storage to the writer, which overwrites all of it in the next step.
+            std::swap(_previous, _mailbox.front());
+
+            _mailbox.update();
+            _freshReads++;
+        }
+
+        const SimulationState& current = _mailbox.front();
+
+        const std::chrono::duration<double> span = current.time - _previous.time;
+
+        if (span.count() <= 0.0) {
+            return 1.f;
+        }
+
+        const double alpha = std::chrono::duration<double>(now - _period - _previous.time) / span;
+
+        return alpha < 0.0 ? 0.f : (alpha > 1.0 ? 1.f : (float) alpha);
+    }
+
+    float Simulation::angle(float alpha) const {
+        return _previous.angle + (_mailbox.front().angle - _previous.angle) * alpha;
+    }
+
+    void Simulation::interpolate(float alpha, size_t begin, size_t end, float* angleY, float* angleZ) const {
+
+        const SimulationState& current = _mailbox.front();
+
+        const float* y0 = _previous.angleY.data();
+        const float* z0 = _previous.angleZ.data();
+        const float* y1 = current.angleY.data();
+        const float* z1 = current.angleZ.data();
+
+        for (size_t i = begin; i < end; i++) {
+            angleY[i] = y0[i] + (y1[i] - y0[i]) * alpha;
+            angleZ[i] = z0[i] + (z1[i] - z0[i]) * alpha;
+        }
+    }
+
+    math::float4x4 Simulation::model(float angle) const {
+
+        const math::float4x4 trans = math::translate(_pivot);
+        const math::float4x4 rotY = math::rotateY(-angle);
+        const math::float4x4 rotX = math::rotateX(angle * 0.5);
+        const math::float4x4 inverTrans = math::translate({
+            -_pivot.x, -_pivot.y, -_pivot.z
+        });
+
+        return trans * rotY * rotX * inverTrans;
+    }
+
+    Simulation::Stats Simulation::stats() const {
+
+        std::lock_guard<std::mutex> guard(_lock);
+
+        return {_hz, _stepTime, _reads, _freshReads};
+    }
+
+    void Simulation::step(SimulationState& state) {
+
+        const float angle = (float) (_angularSpeed * (double) _steps / _hz);
+
+        state.step = _steps;
+        state.time = _epoch + _steps * _period;
+        state.angle = angle;
+
+        if (_animateInstances) {
+            _grid -> animate(angle, 0, _grid -> count(), state.angleY.data(), state.angleZ.data());
+        }
+    }
+
+    void Simulation::run() {
+
+        std::unique_lock<std::mutex> guard(_lock);
+
+        while (!_wake.wait_until(guard, _epoch + (_steps + 1) * _period, [this]() { return _stopping; })) {
+
+            guard.unlock();
+
+            const Clock::time_point start = Clock::now();
+
+            // The clock only moves in whole steps. A state depends on nothing but its step, so the
+            // steps a stall made us miss are skipped rather than replayed one by one.
+            const uint64_t due = (uint64_t) ((start - _epoch) / _period);
+
+            _steps = due > _steps ? due : _steps + 1;
+
+            step(_mailbox.back());
+            _mailbox.publish();
+
+            const Clock::time_point end = Clock::now();
+
+            guard.lock();
+
+            _stepTime.record((uint64_t) std::chrono::duration_cast<std::chrono::microseconds>(end - start).count());
+        }
+    }
+
+    bool parseSimulationRate(const char* text, double& hz) {
+
+        if (*text < '0' || *text > '9') {
+            return false;
+        }
+
+        char* end;
+
+        unsigned long value = strtoul(text, &end, 10);
+
+        if (*end != '\0' || value < 1 || value > 1000) {
+            return false;
+        }
+
+        hz = (double) value;
+
+        return true;
+    }
+
+#pragma endregion Simulation }
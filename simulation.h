@@ -0,0 +1,122 @@
+#ifndef SIMULATION_H
+#define SIMULATION_H
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "instances.h"
+#include "mailbox.h"
+#include "pacer.h"
+
+// Everything the renderer needs from one simulation step.
+struct SimulationState {
+
+    uint64_t step;
+
+    // Wall-clock time the step stands for.
+    std::chrono::steady_clock::time_point time;
+
+    float angle;
+
+    // Per-instance angles indexed by grid id; empty when the instances are not animated on the CPU.
+    std::vector<float> angleY;
+    std::vector<float> angleZ;
+
+};
+
+// Advances the animation on its own thread with a fixed timestep and hands each step to the
+// renderer through a TripleBuffer, so a slow frame never holds up the simulation and a slow step
+// never holds up a frame. The renderer draws a point between the two newest steps, one step in
+// the past, so the simulation rate is independent of the display rate.
+class Simulation {
+
+    public:
+
+        using Clock = std::chrono::steady_clock;
+
+        struct Stats {
+
+            double hz;
+            Histogram stepTime;
+            uint64_t reads;
+            uint64_t freshReads;
+
+        };
+
+        // The model rotates about pivot at angularSpeed radians a second, advanced in steps of
+        // 1 / hz seconds. The per-instance angles are only filled in when animateInstances is set.
+        Simulation(const math::float3& pivot, float angularSpeed, double hz, bool animateInstances);
+
+        ~Simulation();
+
+        Simulation(const Simulation&) = delete;
+        Simulation& operator=(const Simulation&) = delete;
+
+        // Publishes the state for the current time, then starts stepping grid on the simulation
+        // thread. grid must stay alive and unchanged until stop(). Called on the reader thread.
+        void start(const InstanceGrid& grid);
+
+        void stop();
+
+        // Reader side, one thread only: picks up the newest state and returns where now, less one
+        // step, falls between previous() and current(), clamped to [0, 1].
+        float sample(Clock::time_point now);
+
+        const SimulationState& previous() const {
+            return _previous;
+        }
+
+        const SimulationState& current() const {
+            return _mailbox.front();
+        }
+
+        float angle(float alpha) const;
+
+        // Blends the per-instance angles of [begin, end) between previous() and current().
+        void interpolate(float alpha, size_t begin, size_t end, float* angleY, float* angleZ) const;
+
+        math::float4x4 model(float angle) const;
+
+        // Reader side; stepTime covers the steps taken on the simulation thread.
+        Stats stats() const;
+
+    private:
+
+        void step(SimulationState& state);
+
+        void run();
+
+        math::float3 _pivot;
+        float _angularSpeed;
+        double _hz;
+        Clock::duration _period;
+        bool _animateInstances;
+
+        const InstanceGrid* _grid = nullptr;
+
+        // Step n stands for _epoch + n * _period.
+        Clock::time_point _epoch;
+        uint64_t _steps = 0;
+
+        TripleBuffer<SimulationState> _mailbox;
+        SimulationState _previous;
+
+        std::thread _thread;
+        mutable std::mutex _lock;
+        std::condition_variable _wake;
+        bool _stopping = false;
+
+        Histogram _stepTime;
+        uint64_t _reads = 0;
+        uint64_t _freshReads = 0;
+
+};
+
+// Parses a simulation rate in whole steps a second, 1 to 1000.
+bool parseSimulationRate(const char* text, double& hz);
+
+#endif
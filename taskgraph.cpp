@@ -0,0 +1,199 @@
+#include "taskgraph.h"
+
+#include <algorithm>
+
+#pragma region TaskGraph {
+
+    // Small per-thread numbers for the trace, in order of first use.
+    static uint32_t threadIndex() {
+
+        static std::atomic<uint32_t> next{0};
+        static thread_local uint32_t index = next.fetch_add(1, std::memory_order_relaxed);
+
+        return index;
+    }
+
+    static double micros(std::chrono::steady_clock::duration duration) {
+        return std::chrono::duration<double, std::micro>(duration).count();
+    }
+
+    size_t TaskGraph::add(const char* name, std::initializer_list<uint32_t> reads, std::initializer_list<uint32_t> writes, std::function<void()> fn) {
+
+        const uint32_t index = (uint32_t) _nodes.size();
+
+        Node& node = _nodes.emplace_back();
+
+        node.name = name;
+        node.fn = std::move(fn);
+
+        for (uint32_t resource : reads) {
+
+            if (resource >= _access.size()) {
+                _access.resize(resource + 1);
+            }
+
+            if (_access[resource].writer >= 0) {
+                dependOn(index, (uint32_t) _access[resource].writer);
+            }
+        }
+
+        for (uint32_t resource : writes) {
+
+            if (resource >= _access.size()) {
+                _access.resize(resource + 1);
+            }
+
+            Access& access = _access[resource];
+
+            if (access.writer >= 0) {
+                dependOn(index, (uint32_t) access.writer);
+            }
+
+            for (uint32_t reader : access.readers) {
+                dependOn(index, reader);
+            }
+
+            access.writer = index;
+            access.readers.clear();
+        }
+
+        // Recorded after the writes so a node that reads and writes a resource does not wait on itself.
+        for (uint32_t resource : reads) {
+
+            std::vector<uint32_t>& readers = _access[resource].readers;
+
+            if (std::find(readers.begin(), readers.end(), index) == readers.end() && _access[resource].writer != (int64_t) index) {
+                readers.push_back(index);
+            }
+        }
+
+        if (_nodes[index].predecessors.empty()) {
+            _roots.push_back(index);
+        }
+
+        _pending.reset(new std::atomic<uint32_t>[_nodes.size()]);
+        _chain.resize(_nodes.size());
+
+        return index;
+    }
+
+    void TaskGraph::dependOn(uint32_t node, uint32_t predecessor) {
+
+        std::vector<uint32_t>& predecessors = _nodes[node].predecessors;
+
+        // A resource listed twice by the same node would otherwise make it wait on itself.
+        if (predecessor == node || std::find(predecessors.begin(), predecessors.end(), predecessor) != predecessors.end()) {
+            return;
+        }
+
+        predecessors.push_back(predecessor);
+
+        _nodes[predecessor].successors.push_back(node);
+        _nodes[predecessor].ready.resize(_nodes[predecessor].successors.size());
+    }
+
+    void TaskGraph::execute(ThreadPool& pool) {
+
+        for (size_t i = 0; i < _nodes.size(); i++) {
+            _pending[i].store((uint32_t) _nodes[i].predecessors.size(), std::memory_order_relaxed);
+        }
+
+        _thread = threadIndex();
+        _begin = Clock::now();
+
+        runAll(pool, _roots.data(), _roots.size());
+
+        _end = Clock::now();
+
+        // Nodes were added in dependency order, so one forward pass finds the longest chains.
+        double work = 0.0;
+        double criticalPath = 0.0;
+
+        for (size_t i = 0; i < _nodes.size(); i++) {
+
+            const double duration = micros(_nodes[i].end - _nodes[i].begin);
+
+            double longest = 0.0;
+
+            for (uint32_t predecessor : _nodes[i].predecessors) {
+                longest = std::max(longest, _chain[predecessor]);
+            }
+
+            _chain[i] = longest + duration;
+
+            work += duration;
+            criticalPath = std::max(criticalPath, _chain[i]);
+        }
+
+        _stats.executions++;
+        _stats.wall += micros(_end - _begin);
+        _stats.work += work;
+        _stats.criticalPath += criticalPath;
+    }
+
+    void TaskGraph::runAll(ThreadPool& pool, const uint32_t* nodes, size_t count) {
+
+        if (count == 1) {
+            run(pool, nodes[0]);
+            return;
+        }
+
+        pool.parallelFor(0, count, 1, [this, &pool, nodes](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; i++) {
+                run(pool, nodes[i]);
+            }
+        });
+    }
+
+    // Each node is run by the thread that released its last predecessor, which then carries on
+    // with whatever that node released in turn. Nothing waits on a node, so nodes are free to
+    // call back into the pool.
+    void TaskGraph::run(ThreadPool& pool, uint32_t index) {
+
+        Node& node = _nodes[index];
+
+        node.thread = threadIndex();
+        node.begin = Clock::now();
+
+        node.fn();
+
+        node.end = Clock::now();
+
+        size_t ready = 0;
+
+        for (uint32_t successor : node.successors) {
+            if (_pending[successor].fetch_sub(1, std::memory_order_acq_rel) == 1) {
+                node.ready[ready++] = successor;
+            }
+        }
+
+        runAll(pool, node.ready.data(), ready);
+    }
+
+    void TaskGraph::writeTrace(FILE* file) const {
+
+        fprintf(file, "{\"traceEvents\": [\n");
+
+        for (size_t i = 0; i < _nodes.size(); i++) {
+
+            const Node& node = _nodes[i];
+
+            fprintf(file, "    {\"name\": \"%s\", \"cat\": \"frame\", \"ph\": \"X\", \"pid\": 0, \"tid\": %u, \"ts\": %.3f, \"dur\": %.3f, \"args\": {\"after\": [",
+                node.name,
+                node.thread,
+                micros(node.begin - _begin),
+                micros(node.end - node.begin)
+            );
+
+            for (size_t p = 0; p < node.predecessors.size(); p++) {
+                fprintf(file, "%s\"%s\"", p > 0 ? ", " : "", _nodes[node.predecessors[p]].name);
+            }
+
+            fprintf(file, "], \"chain\": %.3f}},\n", _chain[i]);
+        }
+
+        fprintf(file, "    {\"name\": \"graph\", \"cat\": \"frame\", \"ph\": \"X\", \"pid\": 0, \"tid\": %u, \"ts\": 0, \"dur\": %.3f}\n", _thread, micros(_end - _begin));
+        fprintf(file, "]}\n");
+    }
+
+#pragma endregion TaskGraph }
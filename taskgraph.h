@@ -0,0 +1,107 @@
+#ifndef TASKGRAPH_H
+#define TASKGRAPH_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <functional>
+#include <initializer_list>
+#include <memory>
+#include <vector>
+
+#include "threadpool.h"
+
+// A fixed set of tasks run once per execute(), ordered by the resources they declare. A node
+// runs after every earlier node that writes something it reads or writes, and after every
+// earlier node that reads something it writes; anything else may overlap. Resources are small
+// integers chosen by the caller.
+class TaskGraph {
+
+    public:
+
+        struct Stats {
+
+            uint64_t executions;
+
+            // Summed over executions, in microseconds: elapsed time, time spent in nodes, and the
+            // longest chain of dependent nodes.
+            double wall;
+            double work;
+            double criticalPath;
+
+        };
+
+        TaskGraph() = default;
+
+        TaskGraph(const TaskGraph&) = delete;
+        TaskGraph& operator=(const TaskGraph&) = delete;
+
+        size_t add(const char* name, std::initializer_list<uint32_t> reads, std::initializer_list<uint32_t> writes, std::function<void()> fn);
+
+        // Runs every node once on pool and returns when all are done. Nodes may use pool themselves.
+        void execute(ThreadPool& pool);
+
+        size_t size() const {
+            return _nodes.size();
+        }
+
+        Stats stats() const {
+            return _stats;
+        }
+
+        // The last execute() in Chrome's trace event format, for chrome://tracing or Perfetto.
+        void writeTrace(FILE* file) const;
+
+    private:
+
+        using Clock = std::chrono::steady_clock;
+
+        struct Node {
+
+            const char* name;
+            std::function<void()> fn;
+
+            std::vector<uint32_t> predecessors;
+            std::vector<uint32_t> successors;
+
+            // Successors this node released in the last execute(); sized to successors.
+            std::vector<uint32_t> ready;
+
+            Clock::time_point begin;
+            Clock::time_point end;
+            uint32_t thread = 0;
+
+        };
+
+        struct Access {
+
+            int64_t writer = -1;
+            std::vector<uint32_t> readers;
+
+        };
+
+        void dependOn(uint32_t node, uint32_t predecessor);
+
+        void runAll(ThreadPool& pool, const uint32_t* nodes, size_t count);
+
+        void run(ThreadPool& pool, uint32_t index);
+
+        std::vector<Node> _nodes;
+        std::vector<Access> _access;
+        std::vector<uint32_t> _roots;
+
+        std::unique_ptr<std::atomic<uint32_t>[]> _pending;
+
+        // Longest chain ending at each node in the last execute(), in microseconds.
+        std::vector<double> _chain;
+
+        Clock::time_point _begin;
+        Clock::time_point _end;
+        uint32_t _thread = 0;
+
+        Stats _stats = {};
+
+};
+
+#endif
@@ -0,0 +1,1814 @@
+#include <algorithm>
+#include <atomic>
+#include <cfloat>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <mutex>
+#include <numeric>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <stdlib.h>
+
+#include "arena.h"
+#include "cube.h"
+#include "culling.h"
+#include "instances.h"
+#include "mailbox.h"
+#include "mandelbrot.h"
+#include "mandelbrotcache.h"
+#include "pacer.h"
+#include "simulation.h"
+#include "taskgraph.h"
+#include "threadpool.h"
+#include "upload.h"
+
+// Headless checks of the parts of the renderer that need no Metal device. Builds on Linux as well
+// as macOS; see todo.txt for the command line. Exits non-zero when any check fails.
+
+#pragma region Harness {
+
+    static int failures = 0;
+
+    static void check(bool ok, const char* what, const char* file, int line) {
+        if (!ok) {
+            fprintf(stderr, "%s:%d: check failed: %s\n", file, line, what);
+            failures++;
+        }
+    }
+
+    #define CHECK(cond) check((cond), #cond, __FILE__, __LINE__)
+
+#pragma endregion Harness }
+
+#pragma region Trigonometry {
+
+    struct SincosError {
+
+        double ulps;
+        double absolute;
+
+    };
+
+    // Error of value in units in the last place of reference rounded to float.
+    static double ulpError(float value, double reference) {
+
+        const float magnitude = (float) std::fabs(reference);
+
+        return std::fabs(value - reference) / (std::nextafter(magnitude, INFINITY) - magnitude);
+    }
+
+    static void accumulate(SincosError& error, float s, float c, float x) {
+
+        const double rs = std::sin((double) x);
+        const double rc = std::cos((double) x);
+
+        error.ulps = std::fmax(error.ulps, std::fmax(ulpError(s, rs), ulpError(c, rc)));
+        error.absolute = std::fmax(error.absolute, std::fmax(std::fabs(s - rs), std::fabs(c - rc)));
+    }
+
+    // The scalar and vfloat sincos at 2^21 + 1 evenly spaced points of [-limit, limit] against
+    // double-precision sin and cos.
+    template <math::Precision P>
+    static void sincosErrors(float limit, SincosError& scalar, SincosError& packet) {
+
+        using math::vfloat;
+
+        constexpr int steps = 1 << 20;
+
+        scalar = {};
+        packet = {};
+
+        alignas(64) float xs[vfloat::lanes], ss[vfloat::lanes], cs[vfloat::lanes];
+
+        size_t filled = 0;
+
+        for (int i = -steps; i <= steps; i++) {
+
+            const float x = limit * (float) i / (float) steps;
+
+            float s, c;
+
+            math::sincos<P>(x, s, c);
+            accumulate(scalar, s, c, x);
+
+            xs[filled++] = x;
+
+            if (filled == vfloat::lanes || i == steps) {
+
+                vfloat vs, vc;
+
+                math::sincos<P>(vfloat::load(xs), vs, vc);
+
+                vs.store(ss);
+                vc.store(cs);
+
+                for (size_t l = 0; l < filled; l++) {
+                    accumulate(packet, ss[l], cs[l], xs[l]);
+                }
+
+                filled = 0;
+            }
+        }
+    }
+
+    // The bounds documented next to math::sincos.
+    static void testSincosAccuracy() {
+
+        SincosError scalar, packet;
+
+        sincosErrors<math::Precision::Accurate>(64.f, scalar, packet);
+
+        CHECK(scalar.ulps <= 2.0 && packet.ulps <= 2.0);
+
+        sincosErrors<math::Precision::Accurate>(2048.f, scalar, packet);
+
+        CHECK(scalar.ulps <= 21.0 && packet.ulps <= 21.0);
+
+        sincosErrors<math::Precision::Accurate>(8192.f, scalar, packet);
+
+        CHECK(scalar.absolute <= 1e-7 && packet.absolute <= 1e-7);
+
+        sincosErrors<math::Precision::Fast>(1024.f, scalar, packet);
+
+        CHECK(scalar.ulps <= 27.0 && packet.ulps <= 27.0);
+
+        sincosErrors<math::Precision::Fast>(8192.f, scalar, packet);
+
+        CHECK(scalar.absolute <= 1.4e-6 && packet.absolute <= 1.4e-6);
+
+        // Beyond the reduction's range both forms hand over to libm.
+        float s, c;
+
+        math::sincos(1e5f, s, c);
+
+        CHECK(s == sinf(1e5f) && c == cosf(1e5f));
+    }
+
+    // The array form against the scalar one for every count up to three packets and a bit, from
+    // every offset within a packet, with an argument beyond the reduction's range in the mix.
+    template <math::Precision P>
+    static size_t sincosArrayMismatches() {
+
+        using math::vfloat;
+
+        constexpr size_t most = 3 * vfloat::lanes + 3;
+
+        std::mt19937 random(11);
+        std::uniform_real_distribution<float> angle(-100.f, 100.f);
+
+        std::vector<float> x(most + vfloat::lanes);
+
+        for (float& v : x) {
+            v = angle(random);
+        }
+
+        x[vfloat::lanes + 1] = 9000.f;
+
+        size_t mismatches = 0;
+
+        for (size_t offset = 0; offset < vfloat::lanes; offset++) {
+            for (size_t count = 0; count <= most; count++) {
+
+                std::vector<float> s(count + 1, -2.f), c(count + 1, -2.f);
+
+                math::sincos<P>(x.data() + offset, s.data(), c.data(), count);
+
+                for (size_t i = 0; i < count; i++) {
+
+                    float rs, rc;
+
+                    math::sincos<P>(x[offset + i], rs, rc);
+
+                    // Bit-identical with GCC; a compiler that fuses the scalar form's multiply-adds
+                    // and not the packet's may round the last bit differently.
+                    mismatches += std::fabs(s[i] - rs) > 2e-7f || std::fabs(c[i] - rc) > 2e-7f;
+                }
+
+                // Nothing past the end is written.
+                mismatches += s[count] != -2.f || c[count] != -2.f;
+            }
+        }
+
+        return mismatches;
+    }
+
+    static void testSincosArray() {
+        CHECK(sincosArrayMismatches<math::Precision::Accurate>() == 0);
+        CHECK(sincosArrayMismatches<math::Precision::Fast>() == 0);
+    }
+
+#pragma endregion Trigonometry }
+
+#pragma region Boxes {
+
+    // Boxes in [-10, 10] with every kind of bound the batch operations must treat as the scalar
+    // Box methods do: a NaN in one bound of every seventh, points and zero-width slabs, and boxes
+    // inverted on one axis.
+    static void fillBoxes(const BoxBatch& boxes, uint32_t seed, bool inverted) {
+
+        std::mt19937 random(seed);
+        std::uniform_real_distribution<float> place(-10.f, 10.f);
+        std::uniform_real_distribution<float> size(0.f, 3.f);
+
+        float* mins[3] = {boxes.minX, boxes.minY, boxes.minZ};
+        float* maxs[3] = {boxes.maxX, boxes.maxY, boxes.maxZ};
+
+        for (size_t i = 0; i < boxes.count; i++) {
+
+            for (size_t a = 0; a < 3; a++) {
+                mins[a][i] = place(random);
+                maxs[a][i] = mins[a][i] + size(random);
+            }
+
+            const size_t axis = random() % 3;
+
+            if (i % 7 == 3) {
+                (random() % 2 ? mins : maxs)[axis][i] = NAN;
+            } else if (i % 11 == 5) {
+                maxs[axis][i] = mins[axis][i];
+            } else if (i % 11 == 6) {
+                for (size_t a = 0; a < 3; a++) {
+                    maxs[a][i] = mins[a][i];
+                }
+            } else if (inverted && i % 13 == 4) {
+                std::swap(mins[axis][i], maxs[axis][i]);
+                mins[axis][i] += 0.5f;
+            }
+        }
+    }
+
+    static Box3 boxAt(const BoxBatch& boxes, size_t i) {
+
+        const float lo[3] = {boxes.minX[i], boxes.minY[i], boxes.minZ[i]};
+        const float hi[3] = {boxes.maxX[i], boxes.maxY[i], boxes.maxZ[i]};
+
+        return Box3(lo, hi);
+    }
+
+    static bool sameFloat(float a, float b) {
+        return a == b || (std::isnan(a) && std::isnan(b));
+    }
+
+    // Counts that leave the packet loop, the scalar tail or both to run.
+    static const size_t BOX_COUNTS[] = {0, 1, math::vfloat::lanes - 1, math::vfloat::lanes, 1003};
+
+    static void testBoxOverlap() {
+
+        std::vector<uint32_t> hits(1003);
+
+        size_t mismatches = 0;
+
+        for (size_t count : BOX_COUNTS) {
+
+            BoxArray array;
+
+            array.resize(count);
+
+            const BoxBatch boxes = array.batch();
+
+            fillBoxes(boxes, 3 + (uint32_t) count, true);
+
+            const float lo[3] = {-2.f, -3.f, 1.f}, hi[3] = {4.f, 2.f, 6.f};
+            const float point[3] = {0.5f, 0.5f, 0.5f};
+            const float nanLo[3] = {NAN, -3.f, 1.f};
+
+            for (const Box3& query : {Box3(lo, hi), Box3(point, point), Box3(nanLo, hi), Box3(hi, lo)}) {
+
+                const size_t n = overlapBoxes(query, boxes, hits.data());
+
+                size_t k = 0;
+
+                for (size_t i = 0; i < count; i++) {
+                    if (query.overlaps(boxAt(boxes, i))) {
+                        mismatches += k >= n || hits[k] != i;
+                        k++;
+                    }
+                }
+
+                mismatches += k != n;
+            }
+        }
+
+        CHECK(mismatches == 0);
+    }
+
+    static void testBoxMerge() {
+
+        size_t mismatches = 0;
+
+        for (size_t count : BOX_COUNTS) {
+
+            BoxArray array;
+
+            array.resize(count);
+
+            const BoxBatch boxes = array.batch();
+
+            fillBoxes(boxes, 5 + (uint32_t) count, true);
+
+            Box3 expected(FLT_MAX, -FLT_MAX);
+
+            for (size_t i = 0; i < count; i++) {
+                expected = expected.merge(boxAt(boxes, i));
+            }
+
+            const Box3 merged = mergeBoxes(boxes);
+
+            for (size_t a = 0; a < 3; a++) {
+                mismatches += !sameFloat(merged.getMin(a), expected.getMin(a)) || !sameFloat(merged.getMax(a), expected.getMax(a));
+            }
+
+            CHECK(count > 0 || merged.empty());
+        }
+
+        CHECK(mismatches == 0);
+    }
+
+    // Against the bounds of the eight transformed corners, and a NaN bound poisoning the whole
+    // box in either path. Inverted boxes have no corners to bound and are left out.
+    static void testBoxTransform() {
+
+        const math::float4x4 transform = math::translate({1.f, -2.f, 3.f}) * math::rotateY(0.7f) * math::rotateX(-1.1f) * math::scale({2.f, 0.5f, 1.5f});
+
+        float error = 0.f;
+        size_t mismatches = 0;
+
+        for (size_t count : BOX_COUNTS) {
+
+            BoxArray in, out;
+
+            in.resize(count);
+            out.resize(count);
+
+            const BoxBatch source = in.batch();
+            const BoxBatch target = out.batch();
+
+            fillBoxes(source, 7 + (uint32_t) count, false);
+
+            transformBoxes(transform, source, target);
+
+            for (size_t i = 0; i < count; i++) {
+
+                const Box3 box = boxAt(source, i);
+                const Box3 result = boxAt(target, i);
+
+                bool poisoned = false;
+
+                for (size_t a = 0; a < 3; a++) {
+                    poisoned = poisoned || std::isnan(box.getMin(a)) || std::isnan(box.getMax(a));
+                }
+
+                if (poisoned) {
+                    for (size_t a = 0; a < 3; a++) {
+                        mismatches += !std::isnan(result.getMin(a)) || !std::isnan(result.getMax(a));
+                    }
+                    continue;
+                }
+
+                float lo[3] = {FLT_MAX, FLT_MAX, FLT_MAX}, hi[3] = {-FLT_MAX, -FLT_MAX, -FLT_MAX};
+
+                for (int corner = 0; corner < 8; corner++) {
+
+                    const math::float4 p = transform * math::float4(
+                        corner & 1 ? box.getMax(0) : box.getMin(0),
+                        corner & 2 ? box.getMax(1) : box.getMin(1),
+                        corner & 4 ? box.getMax(2) : box.getMin(2),
+                        1.f
+                    );
+
+                    for (size_t a = 0; a < 3; a++) {
+                        lo[a] = std::fmin(lo[a], p[a]);
+                        hi[a] = std::fmax(hi[a], p[a]);
+                    }
+                }
+
+                for (size_t a = 0; a < 3; a++) {
+                    error = std::fmax(error, std::fmax(std::fabs(result.getMin(a) - lo[a]), std::fabs(result.getMax(a) - hi[a])));
+                }
+            }
+        }
+
+        CHECK(mismatches == 0);
+
+        // Coordinates reach about 40 after the transform, so a few ulps of those.
+        CHECK(error <= 2e-5f);
+    }
+
+    // Against the slab test of each box on its own, for rays with zero direction components and
+    // origins on slab planes, where 0 * inf puts NaN in the slabs.
+    static void testBoxRays() {
+
+        struct RayCase {
+
+            math::float3 origin;
+            math::float3 dir;
+
+        };
+
+        const RayCase rays[] = {
+            {{-20.f, 0.3f, -0.2f}, {1.f, 0.05f, 0.02f}},
+            {{0.f, 0.f, 0.f}, {0.f, 1.f, 0.f}},
+            {{1.f, -20.f, 2.f}, {0.f, 1.f, 0.f}},
+            {{-15.f, -15.f, -15.f}, {1.f, 1.f, 1.f}},
+            {{0.f, 0.f, 30.f}, {0.f, 0.f, -1.f}},
+        };
+
+        std::vector<uint32_t> hits(1003);
+        std::vector<float> t(1003);
+
+        size_t mismatches = 0;
+
+        for (size_t count : BOX_COUNTS) {
+
+            BoxArray array;
+
+            array.resize(count);
+
+            const BoxBatch boxes = array.batch();
+
+            fillBoxes(boxes, 11 + (uint32_t) count, true);
+
+            // Put some box faces exactly on the axis-aligned rays' origins.
+            for (size_t i = 0; i < count; i += 5) {
+                boxes.minX[i] = 0.f;
+                boxes.maxY[i] = 0.f;
+            }
+
+            for (const RayCase& ray : rays) {
+
+                const math::float3 inv(1.f / ray.dir.x, 1.f / ray.dir.y, 1.f / ray.dir.z);
+
+                const size_t n = intersectBoxes(ray.origin, inv, 0.f, 100.f, boxes, hits.data(), t.data());
+
+                size_t k = 0;
+
+                for (size_t i = 0; i < count; i++) {
+
+                    const Box3 box = boxAt(boxes, i);
+                    const float o[3] = {ray.origin.x, ray.origin.y, ray.origin.z};
+                    const float d[3] = {inv.x, inv.y, inv.z};
+
+                    float near = 0.f, far = 100.f;
+
+                    for (size_t a = 0; a < 3; a++) {
+
+                        const float t0 = (box.getMin(a) - o[a]) * d[a];
+                        const float t1 = (box.getMax(a) - o[a]) * d[a];
+
+                        near = fmaxf(near, fminf(t0, t1));
+                        far = fminf(far, fmaxf(t0, t1));
+                    }
+
+                    if (near <= far) {
+                        mismatches += k >= n || hits[k] != i || t[k] != near;
+                        k++;
+                    }
+                }
+
+                mismatches += k != n;
+            }
+        }
+
+        CHECK(mismatches == 0);
+    }
+
+#pragma endregion Boxes }
+
+#pragma region RingAllocator {
+
+    static void testRingAlignment() {
+
+        RingAllocator ring(1024);
+        size_t offset;
+
+        ring.beginFrame();
+
+        CHECK(ring.allocate(10, 1, offset) && offset == 0);
+        CHECK(ring.allocate(16, 256, offset) && offset == 256);
+
+        // The padding up to the aligned start belongs to the frame too.
+        CHECK(ring.stats().used == 272);
+
+        ring.endFrame();
+    }
+
+    static void testRingWrap() {
+
+        RingAllocator ring(1024);
+        size_t offset;
+
+        const uint64_t first = ring.beginFrame();
+
+        CHECK(ring.allocate(600, 1, offset) && offset == 0);
+
+        ring.endFrame();
+        ring.beginFrame();
+
+        CHECK(ring.allocate(300, 1, offset) && offset == 600);
+
+        ring.endFrame();
+        ring.retire(first);
+        ring.beginFrame();
+
+        // [900, 1024) is too short, so the allocation skips it and starts over at 0, below the tail.
+        CHECK(ring.stats().used == 300);
+        CHECK(ring.allocate(200, 1, offset) && offset == 0);
+        CHECK(ring.stats().used == 300 + 124 + 200);
+
+        ring.endFrame();
+    }
+
+    static void testRingReclaim() {
+
+        RingAllocator ring(1024);
+        size_t offset;
+
+        uint64_t frame = 0;
+
+        for (int i = 0; i < 3; i++) {
+
+            frame = ring.beginFrame();
+
+            CHECK(ring.allocate(200, 8, offset));
+
+            ring.endFrame();
+        }
+
+        CHECK(ring.stats().used == 600);
+
+        // Retiring the newest frame releases every frame before it as well.
+        ring.retire(frame);
+        ring.beginFrame();
+
+        CHECK(ring.stats().used == 0);
+        CHECK(ring.allocate(1024, 1, offset) && offset == 0);
+        CHECK(ring.stats().highWater == 1024);
+        CHECK(ring.stats().frameHighWater == 200);
+
+        ring.endFrame();
+    }
+
+    static void testRingFailures() {
+
+        RingAllocator ring(1024);
+        size_t offset = 0;
+
+        ring.beginFrame();
+
+        CHECK(ring.allocate(1000, 1, offset));
+
+        // Neither the rest of the end nor the space before the tail holds it; offset is left alone.
+        offset = 12345;
+
+        CHECK(!ring.allocate(100, 1, offset));
+        CHECK(offset == 12345);
+        CHECK(ring.stats().failures == 1);
+
+        CHECK(ring.allocate(24, 1, offset) && offset == 1000);
+        CHECK(!ring.allocate(1, 1, offset));
+        CHECK(ring.stats().failures == 2);
+
+        // An empty allocation always fits.
+        CHECK(ring.allocate(0, 1, offset));
+        CHECK(ring.stats().failures == 2);
+
+        ring.endFrame();
+    }
+
+    static void testRingWaitForRetired() {
+
+        RingAllocator ring(1024);
+        size_t offset;
+
+        const uint64_t first = ring.beginFrame();
+
+        CHECK(ring.allocate(800, 1, offset));
+
+        ring.endFrame();
+        ring.beginFrame();
+
+        CHECK(!ring.allocate(800, 1, offset));
+
+        // The GPU's completion handler, late.
+        std::thread gpu([&ring, first]() {
+            std::this_thread::sleep_for(std::chrono::milliseconds(20));
+            ring.retire(first);
+        });
+
+        ring.waitForRetired();
+        gpu.join();
+
+        CHECK(ring.stats().used == 0);
+        CHECK(ring.allocate(800, 1, offset) && offset == 0);
+        CHECK(ring.stats().failures == 1);
+
+        ring.endFrame();
+    }
+
+    // Random frames against a GPU that lags up to four frames behind: live allocations must stay
+    // aligned, in bounds and disjoint, and every refusal must be counted.
+    static void testRingRandomized() {
+
+        std::mt19937 random(15);
+
+        for (int round = 0; round < 100; round++) {
+
+            const size_t capacity = 1024 + random() % 8192;
+
+            RingAllocator ring(capacity);
+
+            struct Live {
+
+                uint64_t frame;
+                size_t begin;
+                size_t end;
+
+            };
+
+            std::vector<Live> live;
+            uint64_t refused = 0;
+            uint64_t retired = 0;
+
+            for (int f = 0; f < 500; f++) {
+
+                const uint64_t frame = ring.beginFrame();
+
+                if (frame > 4 + random() % 3) {
+                    retired = frame - 4;
+                    ring.retire(retired);
+                }
+
+                live.erase(std::remove_if(live.begin(), live.end(), [retired](const Live& l) { return l.frame <= retired; }), live.end());
+
+                const int count = random() % 6;
+
+                for (int a = 0; a < count; a++) {
+
+                    const size_t size = random() % 400;
+                    const size_t alignment = (size_t) 1 << (random() % 9);
+
+                    size_t offset;
+
+                    if (!ring.allocate(size, alignment, offset)) {
+                        refused++;
+                        continue;
+                    }
+
+                    CHECK(offset % alignment == 0);
+                    CHECK(offset + size <= capacity);
+
+                    for (const Live& l : live) {
+                        CHECK(size == 0 || l.begin == l.end || offset + size <= l.begin || l.end <= offset);
+                    }
+
+                    live.push_back({frame, offset, offset + size});
+                }
+
+                ring.endFrame();
+            }
+
+            CHECK(ring.stats().failures == refused);
+        }
+    }
+
+#pragma endregion RingAllocator }
+
+#pragma region DirtyRanges {
+
+    struct Flushed {
+
+        size_t offset;
+        size_t length;
+
+    };
+
+    static std::vector<Flushed> flushAll(DirtyRanges& dirty) {
+
+        std::vector<Flushed> ranges;
+
+        dirty.flush([&ranges](size_t offset, size_t length) {
+            ranges.push_back({offset, length});
+        });
+
+        return ranges;
+    }
+
+    static void testDirtyOverlap() {
+
+        DirtyRanges dirty;
+
+        dirty.mark(100, 50);
+        dirty.mark(120, 100);
+        dirty.mark(0, 10);
+        dirty.mark(130, 10);
+
+        const std::vector<Flushed> ranges = flushAll(dirty);
+
+        CHECK(ranges.size() == 2);
+        CHECK(ranges[0].offset == 0 && ranges[0].length == 10);
+        CHECK(ranges[1].offset == 100 && ranges[1].length == 120);
+
+        CHECK(dirty.empty());
+        CHECK(dirty.stats().bytesMarked == 170);
+        CHECK(dirty.stats().bytesFlushed == 130);
+    }
+
+    static void testDirtyAdjacency() {
+
+        DirtyRanges dirty;
+
+        // Touching ranges join even without a threshold; a one-byte gap does not.
+        dirty.mark(0, 64);
+        dirty.mark(64, 64);
+        dirty.mark(129, 10);
+
+        const std::vector<Flushed> ranges = flushAll(dirty);
+
+        CHECK(ranges.size() == 2);
+        CHECK(ranges[0].offset == 0 && ranges[0].length == 128);
+        CHECK(ranges[1].offset == 129 && ranges[1].length == 10);
+    }
+
+    static void testDirtyThreshold() {
+
+        DirtyRanges dirty(256);
+
+        // Gaps up to the threshold are flushed with the ranges around them, in either order.
+        dirty.mark(1000, 16);
+        dirty.mark(0, 16);
+        dirty.mark(272, 16);
+        dirty.mark(4096, 16);
+        dirty.mark(528, 16);
+
+        std::vector<Flushed> ranges = flushAll(dirty);
+
+        CHECK(ranges.size() == 3);
+        CHECK(ranges[0].offset == 0 && ranges[0].length == 544);
+        CHECK(ranges[1].offset == 1000 && ranges[1].length == 16);
+        CHECK(ranges[2].offset == 4096 && ranges[2].length == 16);
+
+        // A range reaching into two neighbours merges all three.
+        dirty.mark(0, 16);
+        dirty.mark(1000, 16);
+        dirty.mark(200, 700);
+
+        ranges = flushAll(dirty);
+
+        CHECK(ranges.size() == 1);
+        CHECK(ranges[0].offset == 0 && ranges[0].length == 1016);
+
+        // Empty marks are ignored.
+        dirty.mark(10000, 0);
+
+        CHECK(dirty.empty());
+    }
+
+    static void testDirtyFlushCount() {
+
+        DirtyRanges dirty(256);
+
+        // One frame of the renderer: the camera, then instances and ids in 256-aligned slots.
+        for (int frame = 0; frame < 4; frame++) {
+
+            dirty.mark(0, 176);
+            dirty.mark(256, 4096);
+            dirty.mark(4352, 256);
+
+            CHECK(flushAll(dirty).size() == 1);
+        }
+
+        CHECK(dirty.stats().flushes == 4);
+        CHECK(dirty.stats().bytesMarked == 4 * (176 + 4096 + 256));
+        CHECK(dirty.stats().bytesFlushed == 4 * 4608);
+
+        // With no threshold the gap after the camera keeps it apart.
+        DirtyRanges exact;
+
+        exact.mark(0, 176);
+        exact.mark(256, 4096);
+        exact.mark(4352, 256);
+
+        CHECK(flushAll(exact).size() == 2);
+        CHECK(exact.stats().flushes == 2);
+    }
+
+    // Random marks against a byte map: every marked byte is flushed exactly once, and the ranges
+    // come out sorted with more than the threshold between them.
+    static void testDirtyRandomized() {
+
+        std::mt19937 random(16);
+
+        for (int round = 0; round < 200; round++) {
+
+            const size_t threshold = random() % 3 == 0 ? 0 : random() % 128;
+            const size_t span = 4096;
+
+            DirtyRanges dirty(threshold);
+            std::vector<uint8_t> marked(span, 0);
+
+            const int count = 1 + random() % 40;
+
+            for (int m = 0; m < count; m++) {
+
+                const size_t offset = random() % span;
+                const size_t size = random() % (span - offset + 1) % 200;
+
+                dirty.mark(offset, size);
+                std::fill(marked.begin() + offset, marked.begin() + offset + size, 1);
+            }
+
+            std::vector<uint8_t> flushed(span, 0);
+            size_t previousEnd = 0;
+            bool first = true;
+
+            dirty.flush([&](size_t offset, size_t length) {
+
+                CHECK(length > 0 && offset + length <= span);
+                CHECK(first || offset > previousEnd + threshold);
+
+                for (size_t i = offset; i < offset + length; i++) {
+                    CHECK(flushed[i] == 0);
+                    flushed[i] = 1;
+                }
+
+                // The ends are always marked bytes: the threshold only fills gaps.
+                CHECK(marked[offset] && marked[offset + length - 1]);
+
+                previousEnd = offset + length;
+                first = false;
+            });
+
+            for (size_t i = 0; i < span; i++) {
+                CHECK(!marked[i] || flushed[i]);
+            }
+        }
+    }
+
+#pragma endregion DirtyRanges }
+
+#pragma region ThreadPool {
+
+    // parallelFor called from inside a chunk, two levels deep, over counts that are not multiples
+    // of the grains: every index of every inner range must be visited exactly once, whichever
+    // thread ends up running it.
+    static void testNestedParallelFor() {
+
+        constexpr size_t outer = 37;
+        constexpr size_t middle = 11;
+        constexpr size_t inner = 253;
+
+        for (unsigned threads : {1u, 2u, 4u, 7u}) {
+
+            ThreadPool pool(threads);
+
+            std::vector<std::atomic<uint32_t>> visits(outer * middle * inner);
+
+            for (int repeat = 0; repeat < 4; repeat++) {
+
+                pool.parallelFor(0, outer, 1, [&](size_t ob, size_t oe) {
+                    for (size_t o = ob; o < oe; o++) {
+
+                        pool.parallelFor(0, middle, 2, [&](size_t mb, size_t me) {
+                            for (size_t m = mb; m < me; m++) {
+
+                                const size_t base = (o * middle + m) * inner;
+
+                                pool.parallelFor(base, base + inner, 16, [&](size_t ib, size_t ie) {
+                                    for (size_t i = ib; i < ie; i++) {
+                                        visits[i].fetch_add(1, std::memory_order_relaxed);
+                                    }
+                                });
+                            }
+                        });
+                    }
+                });
+
+                size_t wrong = 0;
+
+                for (std::atomic<uint32_t>& count : visits) {
+                    wrong += count.exchange(0, std::memory_order_relaxed) != 1;
+                }
+
+                CHECK(wrong == 0);
+            }
+        }
+    }
+
+#pragma endregion ThreadPool }
+
+#pragma region StaticInstances {
+
+    // The colour draw() computed for every visible instance each frame before colours moved into
+    // the static buffer, sinf and all.
+    static math::float4 perFrameColor(uint32_t id, size_t count) {
+
+        const float r = id / (float) count;
+        const float b = sinf(M_PI * 2.0f * r);
+
+        return {r, 1.0f - r, b, 1.0f};
+    }
+
+    // Channels of a packed colour that differ from the packed reference, other than by one step
+    // where the reference sits on a rounding boundary to within math::sincos's absolute error.
+    static size_t strayChannels(uint32_t packed, const math::float4& reference) {
+
+        const uint32_t expected = shader::packColor(reference);
+
+        size_t stray = 0;
+
+        for (size_t c = 0; c < 4; c++) {
+
+            const int got = (packed >> (8 * c)) & 0xFF;
+            const int want = (expected >> (8 * c)) & 0xFF;
+
+            if (got == want) {
+                continue;
+            }
+
+            const float clamped = std::fmin(std::fmax(reference[c], 0.f), 1.f);
+            const float boundary = std::fmax(got, want) - 0.5f;
+
+            stray += std::abs(got - want) != 1 || std::fabs(clamped * 255.f - boundary) > 255.f * 2e-6f;
+        }
+
+        return stray;
+    }
+
+    static void testStaticColours() {
+
+        ThreadPool pool(2);
+
+        InstanceGrid grid(GridSize{50, 40, 30}, 0.2f, {0.f, 0.f, -10.f});
+
+        const size_t count = grid.count();
+
+        std::vector<shader::StaticInstanceData> colors(count);
+
+        buildStaticInstances(count, colors.data());
+
+        size_t stray = 0;
+        float error = 0.f;
+
+        for (uint32_t id = 0; id < count; id++) {
+
+            const math::float4 reference = perFrameColor(id, count);
+            const math::float4 unpacked = shader::unpackColor(colors[id].instanceColor);
+
+            stray += strayChannels(colors[id].instanceColor, reference);
+
+            for (size_t c = 0; c < 4; c++) {
+                const float clamped = std::fmin(std::fmax(reference[c], 0.f), 1.f);
+                error = std::fmax(error, std::fabs(unpacked[c] - clamped));
+            }
+        }
+
+        // math::sincos is within 1.4e-6 of sinf, so the bytes are draw's own but for the odd one
+        // tipped across a rounding boundary, and every channel is within half a step of it.
+        CHECK(stray == 0);
+        CHECK(error <= 0.5f / 255.f + 2e-6f);
+
+        // A frame's visible instances, looked up by the culler's ids as vertexCore does.
+        grid.animate(1.3f);
+
+        InstanceCuller culler;
+
+        const Frustum frustum = extractFrustum(math::perspective(45.f * M_PI / 180.f, 1.f, 0.03f, 500.f));
+        const size_t visible = culler.cull(frustum, math::identity(), grid.batch(), 0.8660254f, &pool);
+
+        CHECK(visible > 0 && visible < count);
+
+        stray = 0;
+
+        for (size_t k = 0; k < visible; k++) {
+            const uint32_t id = culler.ids()[k];
+            stray += strayChannels(colors[id].instanceColor, perFrameColor(id, count));
+        }
+
+        CHECK(stray == 0);
+    }
+
+#pragma endregion StaticInstances }
+
+#pragma region Procedural {
+
+    // proceduralTransform, the CPU expansion of what vertexCore evaluates in the procedural format,
+    // against the affine records the instance kernels build from the animated grid.
+    static void testProceduralTransforms() {
+
+        const GridSize size = {23, 17, 11};
+        const float scale = 0.2f;
+        const math::float3 origin = {0.f, 0.f, -10.f};
+
+        InstanceGrid grid(size, scale, origin);
+        Simulation simulation(origin, 0.12f, 60.0, true);
+
+        std::vector<shader::AffineInstanceData> records(grid.count());
+
+        const InstanceKernel active = instanceKernel();
+        const InstanceKernel kernels[] = {InstanceKernel::Scalar, InstanceKernel::AVX2, InstanceKernel::AVX512};
+
+        float error = 0.f;
+
+        for (float angle : {0.f, 0.37f, 2.5f, 40.f}) {
+
+            grid.animate(angle);
+
+            const shader::ProceduralUniforms uniforms = {
+                angle,
+                scale,
+                (uint32_t) size.rows, (uint32_t) size.columns, (uint32_t) size.depth,
+                {origin.x, origin.y, origin.z},
+                {origin.x, origin.y, origin.z}
+            };
+
+            for (InstanceKernel kernel : kernels) {
+
+                if (!selectInstanceKernel(kernel)) {
+                    continue;
+                }
+
+                buildInstanceTransforms(simulation.model(angle), grid.batch(), records.data());
+
+                for (uint32_t id = 0; id < grid.count(); id++) {
+
+                    const shader::ProceduralTransform t = shader::proceduralTransform(uniforms, id);
+
+                    for (size_t r = 0; r < 3; r++) {
+                        for (size_t c = 0; c < 4; c++) {
+                            error = std::fmax(error, std::fabs(t.rows[r][c] - records[id].rows[r][c]));
+                        }
+                    }
+                }
+            }
+        }
+
+        selectInstanceKernel(active);
+
+        // Translations reach about 10, so this is about ten ulps of the largest entries.
+        CHECK(error <= 1e-5f);
+    }
+
+#pragma endregion Procedural }
+
+#pragma region Encodings {
+
+    // Largest element-wise difference of two instance records decoded to the matrix layout,
+    // transform and normal transform alike.
+    static float recordError(const shader::InstanceData& a, const shader::InstanceData& b) {
+
+        float error = 0.f;
+
+        for (size_t c = 0; c < 4; c++) {
+            for (size_t r = 0; r < 4; r++) {
+                error = std::fmax(error, std::fabs(a.instanceTransform.columns[c][r] - b.instanceTransform.columns[c][r]));
+            }
+        }
+
+        for (size_t c = 0; c < 3; c++) {
+            for (size_t r = 0; r < 3; r++) {
+                error = std::fmax(error, std::fabs(a.instanceNormalTransform.columns[c][r] - b.instanceNormalTransform.columns[c][r]));
+            }
+        }
+
+        return error;
+    }
+
+    // encode and decode of the quaternion layout against the grid's animated matrix records, and
+    // the quaternion records every kernel builds, over a range whose ends are not lane multiples.
+    static void testQuaternionRecords() {
+
+        const math::float3 origin = {0.f, 0.f, -10.f};
+
+        InstanceGrid grid(GridSize{19, 13, 7}, 0.2f, origin);
+        Simulation simulation(origin, 0.12f, 60.0, true);
+
+        const size_t count = grid.count();
+        const size_t begin = 3;
+
+        std::vector<shader::InstanceData> matrices(count);
+        std::vector<shader::QuatInstanceData> quats(count);
+
+        const InstanceKernel active = instanceKernel();
+        const InstanceKernel kernels[] = {InstanceKernel::Scalar, InstanceKernel::AVX2, InstanceKernel::AVX512};
+
+        float roundTrip = 0.f;
+        float built = 0.f;
+        size_t passes = 0;
+        size_t untouched = 0;
+
+        for (float angle : {0.f, 0.37f, 2.5f, 40.f}) {
+
+            grid.animate(angle);
+
+            const math::float4x4 model = simulation.model(angle);
+
+            for (InstanceKernel kernel : kernels) {
+
+                if (!selectInstanceKernel(kernel)) {
+                    continue;
+                }
+
+                buildInstanceTransforms(model, grid.batch(), matrices.data());
+
+                shader::QuatInstanceData guard = {};
+
+                guard.scale = -1.f;
+
+                std::fill(quats.begin(), quats.end(), guard);
+
+                buildInstanceTransforms(model, grid.batch(), begin, count, quats.data());
+
+                passes++;
+
+                for (size_t i = 0; i < begin; i++) {
+                    untouched += quats[i].scale == -1.f;
+                }
+
+                for (size_t i = begin; i < count; i++) {
+                    roundTrip = std::fmax(roundTrip, recordError(shader::decode(shader::encode(matrices[i].instanceTransform)), matrices[i]));
+                    built = std::fmax(built, recordError(shader::decode(quats[i]), matrices[i]));
+                }
+            }
+        }
+
+        selectInstanceKernel(active);
+
+        // Nothing before the range is written.
+        CHECK(untouched == begin * passes);
+
+        // The rotation and scale parts of a round trip come back within a few ulps of 1, and the
+        // kernels' translations, which reach about 10, within five ulps of those.
+        CHECK(roundTrip <= 1e-6f);
+        CHECK(built <= 5e-6f);
+    }
+
+    // The affine records every kernel builds, decoded to the matrix layout, against the matrix
+    // records the scalar kernel builds, normal transform included, over the same range.
+    static void testAffineRecords() {
+
+        const math::float3 origin = {0.f, 0.f, -10.f};
+
+        InstanceGrid grid(GridSize{19, 13, 7}, 0.2f, origin);
+        Simulation simulation(origin, 0.12f, 60.0, true);
+
+        const size_t count = grid.count();
+        const size_t begin = 3;
+
+        std::vector<shader::InstanceData> matrices(count);
+        std::vector<shader::AffineInstanceData> affines(count);
+
+        const InstanceKernel active = instanceKernel();
+        const InstanceKernel kernels[] = {InstanceKernel::Scalar, InstanceKernel::AVX2, InstanceKernel::AVX512};
+
+        float error = 0.f;
+        size_t passes = 0;
+        size_t untouched = 0;
+
+        for (float angle : {0.f, 0.37f, 2.5f, 40.f}) {
+
+            grid.animate(angle);
+
+            const math::float4x4 model = simulation.model(angle);
+
+            selectInstanceKernel(InstanceKernel::Scalar);
+            buildInstanceTransforms(model, grid.batch(), matrices.data());
+
+            for (InstanceKernel kernel : kernels) {
+
+                if (!selectInstanceKernel(kernel)) {
+                    continue;
+                }
+
+                shader::AffineInstanceData guard;
+
+                std::fill_n(&guard.rows[0][0], 12, -1.f);
+                std::fill(affines.begin(), affines.end(), guard);
+
+                buildInstanceTransforms(model, grid.batch(), begin, count, affines.data());
+
+                passes++;
+
+                for (size_t i = 0; i < begin; i++) {
+                    untouched += affines[i].rows[0][0] == -1.f;
+                }
+
+                for (size_t i = begin; i < count; i++) {
+                    error = std::fmax(error, recordError(shader::decode(affines[i]), matrices[i]));
+                }
+            }
+        }
+
+        selectInstanceKernel(active);
+
+        // Nothing before the range is written.
+        CHECK(untouched == begin * passes);
+
+        // The kernels round their products differently; translations near 10 stay within five
+        // ulps, and the normal transform the decode rebuilds from the rows is the matrix's own.
+        CHECK(error <= 5e-6f);
+    }
+
+#pragma endregion Encodings }
+
+#pragma region Mandelbrot {
+
+    // Every CPU kernel with every skip option writes the bytes the scalar kernel writes with none,
+    // over a size that is not a multiple of any kernel's lanes, alone and in bands on a pool.
+    static void testMandelbrotKernels() {
+
+        constexpr uint32_t width = 77;
+        constexpr uint32_t height = 53;
+
+        static constexpr MandelbrotKernel kernels[] = {MandelbrotKernel::Scalar, MandelbrotKernel::AVX2, MandelbrotKernel::AVX512};
+        static constexpr uint32_t options[] = {0, shader::MandelbrotSkipBulbs, shader::MandelbrotSkipCycles, shader::MandelbrotSkipBulbs | shader::MandelbrotSkipCycles};
+
+        const MandelbrotKernel active = mandelbrotKernel();
+
+        ThreadPool pool(3);
+
+        std::vector<uint32_t> reference(width * height), image(width * height);
+
+        size_t differing = 0;
+
+        for (uint32_t frame : {0u, 1u, 1234u, 2500u, MANDELBROT_CYCLE - 1}) {
+
+            selectMandelbrotKernel(MandelbrotKernel::Scalar);
+            renderMandelbrot(width, height, frame, 0, reference.data());
+
+            for (MandelbrotKernel kernel : kernels) {
+
+                if (!selectMandelbrotKernel(kernel)) {
+                    continue;
+                }
+
+                for (uint32_t option : options) {
+                    for (ThreadPool* threads : {(ThreadPool*) nullptr, &pool}) {
+
+                        std::fill(image.begin(), image.end(), 0xDEADBEEFu);
+
+                        renderMandelbrot(width, height, frame, option, image.data(), threads);
+
+                        differing += memcmp(reference.data(), image.data(), reference.size() * sizeof(uint32_t)) != 0;
+                    }
+                }
+            }
+        }
+
+        selectMandelbrotKernel(active);
+
+        CHECK(differing == 0);
+    }
+
+    static bool sameImage(const uint32_t* a, const uint32_t* b, size_t pixels) {
+        return memcmp(a, b, pixels * sizeof(uint32_t)) == 0;
+    }
+
+    // A store in a directory of its own for each encoding: prebaked and flushed, then read back
+    // frame by frame after reopening against the renderer; then the newest entry, the last bytes
+    // of the file, is damaged and must be caught and rendered again. A grey-run store has room
+    // left to replace it. A prebaked raw store fills its mapping exactly, so the replacement
+    // cannot be kept and counts as a store failure instead.
+    static void testMandelbrotCache() {
+
+        constexpr uint32_t width = 24;
+        constexpr uint32_t height = 16;
+        constexpr uint32_t options = shader::MandelbrotSkipBulbs | shader::MandelbrotSkipCycles;
+        constexpr size_t pixels = width * height;
+
+        std::vector<uint32_t> reference(MANDELBROT_CYCLE * pixels);
+
+        for (uint32_t frame = 0; frame < MANDELBROT_CYCLE; frame++) {
+            renderMandelbrot(width, height, frame, options, &reference[frame * pixels]);
+        }
+
+        for (MandelbrotCache::Encoding encoding : {MandelbrotCache::Encoding::Raw, MandelbrotCache::Encoding::GreyRuns}) {
+
+            std::string directory = (std::filesystem::temp_directory_path() / "perseus-tests-XXXXXX").string();
+
+            if (!mkdtemp(directory.data())) {
+                CHECK(false);
+                return;
+            }
+
+            const std::string path = MandelbrotCache::storePath(directory.c_str(), width, height, options, encoding);
+
+            {
+                MandelbrotCache cache(width, height, options, 0, path.c_str(), encoding);
+
+                CHECK(cache.hasStore());
+
+                cache.prebake();
+
+                while (cache.prebaking()) {
+                    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+                }
+
+                cache.flush();
+
+                const MandelbrotCache::Stats stats = cache.stats();
+
+                CHECK(cache.baked() == MANDELBROT_CYCLE);
+                CHECK(stats.storeFrames == MANDELBROT_CYCLE && stats.storeFailures == 0);
+            }
+
+            // Every frame served from the store, and as rendered.
+            auto serve = [&](MandelbrotCache& cache) {
+
+                size_t differing = 0;
+
+                for (uint32_t frame = 0; frame < MANDELBROT_CYCLE; frame++) {
+                    differing += !sameImage(cache.frame(frame), &reference[frame * pixels], pixels);
+                }
+
+                return differing;
+            };
+
+            {
+                MandelbrotCache cache(width, height, options, 0, path.c_str(), encoding);
+
+                CHECK(serve(cache) == 0);
+                CHECK(cache.stats().storeHits == MANDELBROT_CYCLE && cache.stats().misses == 0);
+            }
+
+            // Flip the last byte of the newest entry.
+            {
+                FILE* file = fopen(path.c_str(), "r+b");
+
+                CHECK(file != nullptr);
+
+                if (file) {
+
+                    fseek(file, -1, SEEK_END);
+
+                    const int last = fgetc(file);
+
+                    fseek(file, -1, SEEK_END);
+                    fputc(last ^ 0x5A, file);
+                    fclose(file);
+                }
+            }
+
+            const bool room = encoding == MandelbrotCache::Encoding::GreyRuns;
+
+            {
+                MandelbrotCache cache(width, height, options, 0, path.c_str(), encoding);
+
+                CHECK(serve(cache) == 0);
+                CHECK(cache.stats().misses == 1);
+
+                cache.flush();
+
+                const MandelbrotCache::Stats stats = cache.stats();
+
+                CHECK(stats.storeFrames == MANDELBROT_CYCLE);
+                CHECK(stats.storeFailures == (room ? 0u : 1u));
+            }
+
+            {
+                MandelbrotCache cache(width, height, options, 0, path.c_str(), encoding);
+
+                CHECK(serve(cache) == 0);
+                CHECK(cache.stats().misses == (room ? 0u : 1u));
+            }
+
+            std::filesystem::remove_all(directory);
+        }
+    }
+
+#pragma endregion Mandelbrot }
+
+#pragma region FramePacer {
+
+    // Buckets double from [0, 2), so percentiles are bucket bounds capped at the largest sample.
+    static void testHistogram() {
+
+        Histogram histogram;
+
+        CHECK(histogram.count() == 0 && histogram.mean() == 0.0 && histogram.percentile(0.5) == 0);
+
+        for (uint64_t v = 1; v <= 100; v++) {
+            histogram.record(v);
+        }
+
+        CHECK(histogram.count() == 100 && histogram.max() == 100);
+        CHECK(histogram.mean() == 50.5);
+        CHECK(histogram.bucket(0) == 1 && histogram.bucket(1) == 2 && histogram.bucket(5) == 32 && histogram.bucket(6) == 37);
+        CHECK(histogram.percentile(0.5) == 64);
+        CHECK(histogram.percentile(0.99) == 100);
+
+        // Anything past the last bucket's lower bound lands in the last bucket.
+        histogram.record(UINT64_MAX / 2);
+
+        CHECK(histogram.bucket(Histogram::BUCKETS - 1) == 1);
+    }
+
+    // A producer beginning frames as fast as it can against a consumer completing them on its own
+    // thread after short, uneven delays: right after each begin(), no more than framesInFlight
+    // frames may have been begun and not yet handed back.
+    static void testFramePacerLimit() {
+
+        constexpr uint64_t frames = 300;
+
+        for (unsigned framesInFlight = 1; framesInFlight <= FramePacer::MAX_FRAMES_IN_FLIGHT; framesInFlight++) {
+
+            FramePacer pacer(framesInFlight);
+
+            std::mutex lock;
+            std::condition_variable ready;
+            std::vector<uint64_t> queue;
+            std::atomic<uint64_t> completed{0};
+
+            std::thread consumer([&]() {
+
+                for (uint64_t f = 0; f < frames; f++) {
+
+                    uint64_t ticket;
+
+                    {
+                        std::unique_lock<std::mutex> guard(lock);
+
+                        ready.wait(guard, [&]() {
+                            return !queue.empty();
+                        });
+
+                        ticket = queue.front();
+                        queue.erase(queue.begin());
+                    }
+
+                    std::this_thread::sleep_for(std::chrono::microseconds(f % 3 == 0 ? 200 : 20));
+
+                    // Counted before the slot is released, so the producer never sees it early.
+                    completed.fetch_add(1, std::memory_order_release);
+                    pacer.complete(ticket);
+                }
+            });
+
+            uint64_t overruns = 0;
+            uint64_t deepest = 0;
+
+            for (uint64_t f = 0; f < frames; f++) {
+
+                const uint64_t ticket = pacer.begin();
+                const uint64_t ahead = f + 1 - completed.load(std::memory_order_acquire);
+
+                overruns += ahead > framesInFlight;
+                deepest = ahead > deepest ? ahead : deepest;
+
+                {
+                    std::lock_guard<std::mutex> guard(lock);
+                    queue.push_back(ticket);
+                }
+
+                ready.notify_one();
+            }
+
+            pacer.drain();
+            consumer.join();
+
+            const FramePacer::Stats stats = pacer.stats();
+
+            CHECK(overruns == 0);
+
+            // The consumer is slower, so the producer does reach the limit.
+            CHECK(deepest == framesInFlight);
+            CHECK(stats.framesInFlight == framesInFlight);
+            CHECK(stats.blocked.count() == frames && stats.latency.count() == frames);
+        }
+
+        // Out-of-range limits are clamped.
+        CHECK(FramePacer(0).framesInFlight() == 1);
+        CHECK(FramePacer(9).framesInFlight() == FramePacer::MAX_FRAMES_IN_FLIGHT);
+    }
+
+#pragma endregion FramePacer }
+
+#pragma region TripleBuffer {
+
+    // Writer and reader on their own threads: every value the reader picks up must be one whole
+    // publish, and the sequence numbers it sees must only go up.
+    template <size_t WORDS>
+    static void stressTripleBuffer(uint64_t publishes) {
+
+        struct Snapshot {
+
+            uint64_t sequence;
+            uint64_t words[WORDS];
+
+        };
+
+        // Both sides sleep halfway through now and then, so they interleave even on one core.
+        auto fill = [](Snapshot& snapshot, uint64_t sequence) {
+
+            snapshot.sequence = sequence;
+
+            for (size_t i = 0; i < WORDS; i++) {
+
+                if (i == WORDS / 2 && sequence % 16 == 0) {
+                    std::this_thread::sleep_for(std::chrono::microseconds(1));
+                }
+
+                snapshot.words[i] = sequence * 0x9e3779b97f4a7c15ull + i;
+            }
+        };
+
+        TripleBuffer<Snapshot> mailbox;
+
+        Snapshot empty;
+
+        fill(empty, 0);
+        mailbox.reset(empty);
+
+        std::thread writer([&mailbox, &fill, publishes]() {
+            for (uint64_t sequence = 1; sequence <= publishes; sequence++) {
+                fill(mailbox.back(), sequence);
+                mailbox.publish();
+            }
+        });
+
+        uint64_t last = 0;
+        uint64_t reads = 0;
+        uint64_t torn = 0;
+        uint64_t backwards = 0;
+
+        while (last < publishes) {
+
+            if (!mailbox.update()) {
+                std::this_thread::yield();
+                continue;
+            }
+
+            const Snapshot& snapshot = mailbox.front();
+            const uint64_t sequence = snapshot.sequence;
+
+            reads++;
+
+            for (size_t i = 0; i < WORDS; i++) {
+
+                if (i == WORDS / 2 && reads % 4 == 0) {
+                    std::this_thread::sleep_for(std::chrono::microseconds(1));
+                }
+
+                torn += snapshot.words[i] != sequence * 0x9e3779b97f4a7c15ull + i;
+            }
+
+            backwards += sequence <= last;
+            last = sequence;
+
+            // The reader owns front() until the next update and may scribble on it.
+            mailbox.front().words[0] = ~0ull;
+        }
+
+        writer.join();
+
+        CHECK(reads > 0);
+        CHECK(torn == 0);
+        CHECK(backwards == 0);
+        CHECK(!mailbox.update());
+    }
+
+    static void testTripleBufferSmall() {
+        stressTripleBuffer<64>(200000);
+    }
+
+    static void testTripleBufferLarge() {
+        stressTripleBuffer<4096>(5000);
+    }
+
+#pragma endregion TripleBuffer }
+
+#pragma region SteadyState {
+
+    // The CPU side of Render::draw without Metal: the same frame graph stages over the same pool,
+    // arenas, upload ring, dirty ranges and pacer, with a plain array standing in for the mapped
+    // upload buffer and completions arriving three frames late as they would from the GPU. Once
+    // warmed up, a frame must not touch the heap.
+    static void testSteadyStateAllocations() {
+
+        // The counter only moves when built with -DPERSEUS_COUNT_ALLOCATIONS.
+        const uint64_t probe = heapAllocations();
+
+        char* volatile probeBlock = new char[16];
+        delete[] probeBlock;
+
+        if (heapAllocations() == probe) {
+            fprintf(stderr, "build tests.cpp with -DPERSEUS_COUNT_ALLOCATIONS to count heap allocations\n");
+            CHECK(false);
+            return;
+        }
+
+        enum Resource : uint32_t { Model, Camera, Upload, Visible };
+
+        constexpr size_t alignment = 256;
+        constexpr unsigned framesInFlight = 3;
+        constexpr size_t instanceGrain = std::lcm(cacheLineGrain<shader::Instance>(), (size_t) 16);
+
+        const math::float3 origin = {0.f, 0.f, -10.f};
+
+        ThreadPool pool(4);
+        InstanceGrid grid(GridSize{50, 50, 40}, 0.2f, origin);
+        Simulation simulation(origin, 0.12f, 1000.0, true);
+        InstanceCuller culler;
+        FramePacer pacer(framesInFlight);
+        DirtyRanges dirty(alignment);
+        FrameArena arenas[FramePacer::MAX_FRAMES_IN_FLIGHT];
+        TaskGraph graph;
+
+        std::vector<float> angleY(grid.count()), angleZ(grid.count());
+
+        const size_t frameSize = alignUp(sizeof(shader::CameraData), alignment)
+            + alignUp(grid.count() * sizeof(shader::Instance), alignment)
+            + alignUp(grid.count() * sizeof(uint32_t), alignment);
+
+        RingAllocator ring((framesInFlight + 1) * frameSize);
+        std::unique_ptr<uint8_t[]> mapped(new uint8_t[ring.capacity()]);
+
+        struct Frame {
+
+            FrameArena* arena;
+            float alpha;
+            math::float4x4 model;
+            shader::CameraData camera;
+            size_t visible;
+
+        } frame = {};
+
+        auto allocateUpload = [&ring](size_t size) {
+
+            size_t offset = 0;
+
+            if (!ring.allocate(size, alignment, offset)) {
+                ring.waitForRetired();
+                CHECK(ring.allocate(size, alignment, offset));
+            }
+
+            return offset;
+        };
+
+        graph.add("simulation", {}, {Model}, [&]() {
+            frame.alpha = simulation.sample(Simulation::Clock::now());
+            frame.model = simulation.model(simulation.angle(frame.alpha));
+        });
+
+        graph.add("camera", {}, {Camera, Upload}, [&]() {
+
+            const size_t offset = allocateUpload(sizeof(shader::CameraData));
+
+            frame.camera.perspectiveTransform = math::perspective(45.f * M_PI / 180.f, 1.f, 0.03f, 500.0f);
+            frame.camera.worldTransform = math::identity();
+            frame.camera.worldNormalTransform = math::discard(frame.camera.worldTransform);
+
+            *reinterpret_cast<shader::CameraData*>(mapped.get() + offset) = frame.camera;
+
+            dirty.mark(offset, sizeof(shader::CameraData));
+        });
+
+        graph.add("instances", {Model, Camera}, {Upload, Visible}, [&]() {
+
+            const float alpha = frame.alpha;
+
+            pool.parallelFor(0, grid.count(), cacheLineGrain<float>(), [&](size_t begin, size_t end) {
+                simulation.interpolate(alpha, begin, end, angleY.data(), angleZ.data());
+            });
+
+            const Frustum frustum = extractFrustum(frame.camera.perspectiveTransform * frame.camera.worldTransform);
+            const size_t visible = culler.cull(frustum, frame.model, grid.batch(angleY.data(), angleZ.data()), 0.8660254f, &pool, frame.arena -> resource());
+            const InstanceBatch batch = culler.visible();
+
+            const size_t insOffset = allocateUpload(visible * sizeof(shader::Instance));
+
+            shader::Instance* instances = reinterpret_cast<shader::Instance*>(mapped.get() + insOffset);
+
+            pool.parallelFor(0, visible, instanceGrain, [&](size_t begin, size_t end) {
+                streamInstanceTransforms(frame.model, batch, begin, end, instances);
+            });
+
+            dirty.mark(insOffset, visible * sizeof(shader::Instance));
+
+            const size_t idOffset = allocateUpload(visible * sizeof(uint32_t));
+
+            streamCopy(mapped.get() + idOffset, culler.ids(), visible * sizeof(uint32_t));
+            dirty.mark(idOffset, visible * sizeof(uint32_t));
+
+            frame.visible = visible;
+        });
+
+        graph.add("flush", {}, {Upload}, [&]() {
+
+            ring.endFrame();
+
+            dirty.flush([](size_t, size_t) {});
+        });
+
+        simulation.start(grid);
+
+        struct InFlight {
+
+            uint64_t frame;
+            uint64_t ticket;
+
+        } inFlight[framesInFlight];
+
+        constexpr int warmup = 30;
+        constexpr int measured = 100;
+
+        uint64_t before = 0;
+
+        for (int f = 0; f < warmup + measured; f++) {
+
+            if (f == warmup) {
+                before = heapAllocations();
+            }
+
+            // The completion handler of the frame drawn framesInFlight frames ago.
+            if (f >= (int) framesInFlight) {
+
+                const InFlight& done = inFlight[f % framesInFlight];
+
+                ring.retire(done.frame);
+                arenas[done.frame % FramePacer::MAX_FRAMES_IN_FLIGHT].reset();
+                pacer.complete(done.ticket);
+            }
+
+            const uint64_t ticket = pacer.begin();
+            const uint64_t number = ring.beginFrame();
+
+            frame.arena = &arenas[number % FramePacer::MAX_FRAMES_IN_FLIGHT];
+
+            graph.execute(pool);
+
+            inFlight[f % framesInFlight] = {number, ticket};
+        }
+
+        const uint64_t allocations = heapAllocations() - before;
+
+        simulation.stop();
+
+        CHECK(frame.visible > 0);
+        CHECK(allocations == 0);
+
+        if (allocations) {
+            fprintf(stderr, "%llu heap allocations in %d steady frames\n", (unsigned long long) allocations, measured);
+        }
+    }
+
+#pragma endregion SteadyState }
+
+struct Test {
+
+    const char* name;
+    void (*run)();
+
+};
+
+static const Test TESTS[] = {
+    {"sincos accuracy", testSincosAccuracy},
+    {"sincos arrays", testSincosArray},
+    {"box overlap", testBoxOverlap},
+    {"box merge", testBoxMerge},
+    {"box transform", testBoxTransform},
+    {"box rays", testBoxRays},
+    {"ring alignment", testRingAlignment},
+    {"ring wrap", testRingWrap},
+    {"ring reclaim", testRingReclaim},
+    {"ring failures", testRingFailures},
+    {"ring waitForRetired", testRingWaitForRetired},
+    {"ring randomized", testRingRandomized},
+    {"dirty overlap", testDirtyOverlap},
+    {"dirty adjacency", testDirtyAdjacency},
+    {"dirty threshold", testDirtyThreshold},
+    {"dirty flush count", testDirtyFlushCount},
+    {"dirty randomized", testDirtyRandomized},
+    {"nested parallelFor", testNestedParallelFor},
+    {"static colours", testStaticColours},
+    {"procedural transforms", testProceduralTransforms},
+    {"affine records", testAffineRecords},
+    {"quaternion records", testQuaternionRecords},
+    {"mandelbrot kernels", testMandelbrotKernels},
+    {"mandelbrot cache", testMandelbrotCache},
+    {"histogram", testHistogram},
+    {"frame pacer limit", testFramePacerLimit},
+    {"triple buffer 64 words", testTripleBufferSmall},
+    {"triple buffer 4096 words", testTripleBufferLarge},
+    {"steady-state allocations", testSteadyStateAllocations},
+};
+
+int main() {
+
+    for (const Test& test : TESTS) {
+
+        const int before = failures;
+
+        test.run();
+
+        fprintf(stderr, "%-32s %s\n", test.name, failures == before ? "ok" : "FAILED");
+    }
+
+    return failures ? 1 : 0;
+}
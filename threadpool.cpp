@@ -0,0 +1,154 @@
+#include "threadpool.h"
+
+// The pool whose worker is running on this thread, if any, and that worker's queue.
+static thread_local const ThreadPool* workerPool = nullptr;
+static thread_local size_t workerQueue = 0;
+
+ThreadPool::ThreadPool(unsigned threads) {
+
+    if (threads == 0) {
+        threads = std::thread::hardware_concurrency();
+    }
+
+    const size_t workers = threads > 1 ? threads - 1 : 0;
+
+    // One queue per worker and a last one for the calling thread. The count is fixed before
+    // any worker starts since they read it while the rest are still being spawned.
+    _queueCount = workers + 1;
+    _queues.reset(new Queue[_queueCount]);
+    _workers.reserve(workers);
+
+    for (size_t i = 0; i < workers; i++) {
+        _workers.emplace_back([this, i]() {
+            work(i);
+        });
+    }
+}
+
+ThreadPool::~ThreadPool() {
+
+    {
+        std::lock_guard<std::mutex> guard(_sleepLock);
+        _stop = true;
+    }
+
+    _wake.notify_all();
+
+    for (std::thread& worker : _workers) {
+        worker.join();
+    }
+}
+
+void ThreadPool::run(Job& job, size_t begin, size_t end, size_t chunk) {
+
+    const size_t queues = _queueCount;
+    const size_t chunks = (end - begin + chunk - 1) / chunk;
+
+    job.pending.store(chunks, std::memory_order_relaxed);
+
+    for (size_t q = 0; q < queues; q++) {
+
+        std::lock_guard<std::mutex> guard(_queues[q].lock);
+
+        for (size_t c = q; c < chunks; c += queues) {
+            size_t b = begin + c * chunk;
+            _queues[q].tasks.push_back({&job, b, b + chunk < end ? b + chunk : end});
+        }
+    }
+
+    _queued.fetch_add(chunks, std::memory_order_release);
+
+    {
+        std::lock_guard<std::mutex> guard(_sleepLock);
+    }
+
+    _wake.notify_all();
+
+    // A worker calling in, as task graph nodes do, waits on its own queue; any other thread shares
+    // the last one.
+    const size_t self = workerPool == this ? workerQueue : queues - 1;
+
+    while (job.pending.load(std::memory_order_acquire) > 0) {
+        if (!runOne(self)) {
+            std::this_thread::yield();
+        }
+    }
+}
+
+bool ThreadPool::runOne(size_t self) {
+
+    const size_t queues = _queueCount;
+
+    Task task;
+    bool found = false;
+
+    {
+        Queue& own = _queues[self];
+
+        std::lock_guard<std::mutex> guard(own.lock);
+
+        if (own.front < own.tasks.size()) {
+
+            task = own.tasks.back();
+            own.tasks.pop_back();
+            found = true;
+
+            if (own.front == own.tasks.size()) {
+                own.tasks.clear();
+                own.front = 0;
+            }
+        }
+    }
+
+    for (size_t k = 1; !found && k < queues; k++) {
+
+        Queue& victim = _queues[(self + k) % queues];
+
+        std::lock_guard<std::mutex> guard(victim.lock);
+
+        if (victim.front < victim.tasks.size()) {
+
+            task = victim.tasks[victim.front++];
+            found = true;
+
+            if (victim.front == victim.tasks.size()) {
+                victim.tasks.clear();
+                victim.front = 0;
+            }
+        }
+    }
+
+    if (!found) {
+        return false;
+    }
+
+    _queued.fetch_sub(1, std::memory_order_relaxed);
+
+    task.job -> invoke(task.job -> context, task.begin, task.end);
+    task.job -> pending.fetch_sub(1, std::memory_order_release);
+
+    return true;
+}
+
+void ThreadPool::work(size_t self) {
+
+    workerPool = this;
+    workerQueue = self;
+
+    while (true) {
+
+        if (runOne(self)) {
+            continue;
+        }
+
+        std::unique_lock<std::mutex> guard(_sleepLock);
+
+        _wake.wait(guard, [this]() {
+            return _stop || _queued.load(std::memory_order_acquire) > 0;
+        });
+
+        if (_stop) {
+            return;
+        }
+    }
+}
@@ -0,0 +1,122 @@
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <numeric>
+#include <thread>
+#include <vector>
+
+static constexpr size_t CACHE_LINE = 64;
+
+// Smallest element count whose size is a whole number of cache lines. Chunks that start at
+// multiples of it never share a line with their neighbours in a line-aligned array of T.
+template <typename T>
+constexpr size_t cacheLineGrain() {
+    return CACHE_LINE / std::gcd(sizeof(T), CACHE_LINE);
+}
+
+// Work-stealing pool. Each worker owns a deque, popping its newest task and stealing the oldest
+// from the others when it runs dry; the calling thread works through its own deque while it waits.
+class ThreadPool {
+
+    public:
+
+        // threads = 0 uses the hardware concurrency; the count includes the calling thread.
+        explicit ThreadPool(unsigned threads = 0);
+
+        ~ThreadPool();
+
+        ThreadPool(const ThreadPool&) = delete;
+        ThreadPool& operator=(const ThreadPool&) = delete;
+
+        unsigned size() const {
+            return (unsigned) _queueCount;
+        }
+
+        // Calls fn(chunkBegin, chunkEnd) over [begin, end) and returns when every chunk is done.
+        // Chunk boundaries fall on multiples of grain from begin.
+        template <typename Fn>
+        void parallelFor(size_t begin, size_t end, size_t grain, Fn&& fn);
+
+    private:
+
+        struct Job {
+
+            void (*invoke)(void*, size_t, size_t);
+            void* context;
+
+            std::atomic<size_t> pending;
+
+        };
+
+        struct Task {
+
+            Job* job;
+            size_t begin;
+            size_t end;
+
+        };
+
+        // Tasks [front, size) are pending. Steals advance front instead of erasing, and a drained
+        // queue is cleared, so the vector keeps its capacity from one parallelFor to the next.
+        struct alignas(CACHE_LINE) Queue {
+
+            std::mutex lock;
+            std::vector<Task> tasks;
+            size_t front = 0;
+
+        };
+
+        void run(Job& job, size_t begin, size_t end, size_t chunk);
+
+        bool runOne(size_t self);
+
+        void work(size_t self);
+
+        std::vector<std::thread> _workers;
+        std::unique_ptr<Queue[]> _queues;
+        size_t _queueCount;
+
+        std::mutex _sleepLock;
+        std::condition_variable _wake;
+        std::atomic<size_t> _queued{0};
+        bool _stop = false;
+
+};
+
+template <typename Fn>
+void ThreadPool::parallelFor(size_t begin, size_t end, size_t grain, Fn&& fn) {
+
+    if (begin >= end) {
+        return;
+    }
+
+    grain = grain > 0 ? grain : 1;
+
+    // About four chunks per thread leaves room for stealing to even out the load.
+    const size_t count = end - begin;
+    const size_t target = (count + size() * 4 - 1) / (size() * 4);
+    const size_t chunk = (target + grain - 1) / grain * grain;
+
+    if (_queueCount == 1 || count <= chunk) {
+        fn(begin, end);
+        return;
+    }
+
+    using F = std::remove_reference_t<Fn>;
+
+    Job job;
+
+    job.invoke = [](void* context, size_t b, size_t e) {
+        (*static_cast<F*>(context))(b, e);
+    };
+    job.context = (void*) std::addressof(fn);
+
+    run(job, begin, end, chunk);
+}
+
+#endif
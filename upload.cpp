@@ -0,0 +1,208 @@
+#include "upload.h"
+
+#include <algorithm>
+#include <cstring>
+#include <thread>
+
+#if defined(__x86_64__) || defined(__i386__)
+    #include <immintrin.h>
+#endif
+
+#pragma region Streaming {
+
+    void streamCopy(void* dst, const void* src, size_t size) {
+
+#if defined(__x86_64__) || defined(__i386__)
+        uint8_t* d = static_cast<uint8_t*>(dst);
+        const uint8_t* s = static_cast<const uint8_t*>(src);
+
+        // Regular stores up to the first 16-byte boundary, then four streaming stores per line.
+        size_t head = (16 - (reinterpret_cast<uintptr_t>(d) & 15)) & 15;
+
+        head = head < size ? head : size;
+
+        memcpy(d, s, head);
+
+        d += head;
+        s += head;
+        size -= head;
+
+        for (; size >= 64; d += 64, s += 64, size -= 64) {
+            _mm_stream_si128(reinterpret_cast<__m128i*>(d), _mm_loadu_si128(reinterpret_cast<const __m128i*>(s)));
+            _mm_stream_si128(reinterpret_cast<__m128i*>(d + 16), _mm_loadu_si128(reinterpret_cast<const __m128i*>(s + 16)));
+            _mm_stream_si128(reinterpret_cast<__m128i*>(d + 32), _mm_loadu_si128(reinterpret_cast<const __m128i*>(s + 32)));
+            _mm_stream_si128(reinterpret_cast<__m128i*>(d + 48), _mm_loadu_si128(reinterpret_cast<const __m128i*>(s + 48)));
+        }
+
+        for (; size >= 16; d += 16, s += 16, size -= 16) {
+            _mm_stream_si128(reinterpret_cast<__m128i*>(d), _mm_loadu_si128(reinterpret_cast<const __m128i*>(s)));
+        }
+
+        memcpy(d, s, size);
+
+        // Streaming stores are weakly ordered; make them visible before the buffer is handed on.
+        _mm_sfence();
+#else
+        memcpy(dst, src, size);
+#endif
+    }
+
+#pragma endregion Streaming }
+
+#pragma region RingAllocator {
+
+    RingAllocator::RingAllocator(size_t capacity) : _capacity(capacity) {}
+
+    void RingAllocator::reset(size_t capacity) {
+
+        _capacity = capacity;
+        _head = 0;
+        _tail = 0;
+        _used = 0;
+        _frameBytes = 0;
+
+        _regions.clear();
+    }
+
+    void RingAllocator::reclaim() {
+
+        const uint64_t completed = _completed.load(std::memory_order_acquire);
+
+        size_t retired = 0;
+
+        for (; retired < _regions.size() && _regions[retired].frame <= completed; retired++) {
+            _tail = (_tail + _regions[retired].bytes) % _capacity;
+            _used -= _regions[retired].bytes;
+        }
+
+        _regions.erase(_regions.begin(), _regions.begin() + retired);
+
+        if (_used == 0) {
+            _head = 0;
+            _tail = 0;
+        }
+    }
+
+    uint64_t RingAllocator::beginFrame() {
+
+        if (_capacity > 0) {
+            reclaim();
+        }
+
+        _frameBytes = 0;
+
+        return ++_frame;
+    }
+
+    bool RingAllocator::allocate(size_t size, size_t alignment, size_t& offset) {
+
+        if (_used == _capacity && size > 0) {
+            _failures++;
+            return false;
+        }
+
+        size_t start = alignUp(_head, alignment);
+        size_t end = start + size;
+
+        if (_head >= _tail) {
+
+            // Free space is [head, capacity) followed by [0, tail); skip the end when it is too short.
+            if (end > _capacity) {
+
+                if (size > _tail) {
+                    _failures++;
+                    return false;
+                }
+
+                start = 0;
+                end = size;
+            }
+        } else if (end > _tail) {
+            _failures++;
+            return false;
+        }
+
+        const size_t consumed = start >= _head ? end - _head : _capacity - _head + end;
+
+        _head = end;
+        _used += consumed;
+        _frameBytes += consumed;
+
+        _highWater = _used > _highWater ? _used : _highWater;
+
+        offset = start;
+
+        return true;
+    }
+
+    void RingAllocator::endFrame() {
+
+        if (_frameBytes > 0) {
+            _regions.push_back({_frame, _frameBytes});
+        }
+
+        _frameHighWater = _frameBytes > _frameHighWater ? _frameBytes : _frameHighWater;
+        _frameBytes = 0;
+    }
+
+    void RingAllocator::waitForRetired() {
+
+        if (_capacity == 0) {
+            return;
+        }
+
+        reclaim();
+
+        while (!_regions.empty()) {
+            std::this_thread::yield();
+            reclaim();
+        }
+    }
+
+    void RingAllocator::retire(uint64_t frame) {
+
+        uint64_t completed = _completed.load(std::memory_order_relaxed);
+
+        while (completed < frame && !_completed.compare_exchange_weak(completed, frame, std::memory_order_release, std::memory_order_relaxed)) {}
+    }
+
+    RingAllocator::Stats RingAllocator::stats() const {
+        return {_capacity, _used, _highWater, _frameHighWater, _failures};
+    }
+
+#pragma endregion RingAllocator }
+
+#pragma region DirtyRanges {
+
+    void DirtyRanges::mark(size_t offset, size_t size) {
+
+        if (size == 0) {
+            return;
+        }
+
+        _stats.bytesMarked += size;
+
+        size_t begin = offset;
+        size_t end = offset + size;
+
+        // Ranges are disjoint and sorted, so those within reach of [begin, end) are contiguous.
+        auto first = std::lower_bound(_ranges.begin(), _ranges.end(), begin, [this](const Range& range, size_t value) {
+            return range.end + _threshold < value;
+        });
+
+        auto last = first;
+
+        for (; last != _ranges.end() && last -> begin <= end + _threshold; ++last) {
+            begin = std::min(begin, last -> begin);
+            end = std::max(end, last -> end);
+        }
+
+        if (first == last) {
+            _ranges.insert(first, {begin, end});
+        } else {
+            *first = {begin, end};
+            _ranges.erase(first + 1, last);
+        }
+    }
+
+#pragma endregion DirtyRanges }
@@ -0,0 +1,152 @@
+#ifndef UPLOAD_H
+#define UPLOAD_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+constexpr size_t alignUp(size_t value, size_t alignment) {
+    return (value + alignment - 1) / alignment * alignment;
+}
+
+// Copies into memory the CPU only writes, such as a write-combined mapping, with non-temporal
+// stores in whole cache lines where the target allows, so the destination never passes through
+// the cache. Plain memcpy where no streaming stores are available.
+void streamCopy(void* dst, const void* src, size_t size);
+
+// Offsets into one persistently mapped upload buffer, handed out front to back and wrapping at
+// the end. Each frame's sub-allocations form one region that is reclaimed once the GPU reports the
+// frame complete. Only retire() may be called from another thread.
+class RingAllocator {
+
+    public:
+
+        struct Stats {
+
+            size_t capacity;
+            size_t used;
+            size_t highWater;
+            size_t frameHighWater;
+            uint64_t failures;
+
+        };
+
+        explicit RingAllocator(size_t capacity = 0);
+
+        // Forgets every region, including those still in flight; use with a fresh buffer.
+        void reset(size_t capacity);
+
+        // Reclaims the regions of retired frames and opens a new one. Returns its frame number.
+        uint64_t beginFrame();
+
+        // Reserves size bytes at an alignment (a power of two) within the current frame.
+        // Returns false, leaving offset untouched, when the live regions leave no room.
+        bool allocate(size_t size, size_t alignment, size_t& offset);
+
+        void endFrame();
+
+        // Blocks until every earlier frame has retired and reclaims their regions, leaving only the
+        // current frame's allocations live.
+        void waitForRetired();
+
+        // Marks every frame up to and including frame as finished on the GPU.
+        void retire(uint64_t frame);
+
+        Stats stats() const;
+
+        size_t capacity() const {
+            return _capacity;
+        }
+
+    private:
+
+        struct Region {
+
+            uint64_t frame;
+            size_t bytes;
+
+        };
+
+        void reclaim();
+
+        size_t _capacity = 0;
+        size_t _head = 0;
+        size_t _tail = 0;
+        size_t _used = 0;
+
+        uint64_t _frame = 0;
+        size_t _frameBytes = 0;
+
+        // Frames in flight, oldest first; a handful at most, so retiring erases from the front.
+        std::vector<Region> _regions;
+        std::atomic<uint64_t> _completed{0};
+
+        size_t _highWater = 0;
+        size_t _frameHighWater = 0;
+        uint64_t _failures = 0;
+
+};
+
+// Byte ranges written into a mapped buffer since the last flush, kept sorted and coalesced.
+// Ranges closer than the merge threshold are joined, trading a few redundant bytes for fewer
+// flush calls.
+class DirtyRanges {
+
+    public:
+
+        struct Stats {
+
+            uint64_t bytesMarked;
+            uint64_t bytesFlushed;
+            uint64_t flushes;
+
+        };
+
+        explicit DirtyRanges(size_t threshold = 0) : _threshold(threshold) {}
+
+        void mark(size_t offset, size_t size);
+
+        // Calls fn(offset, length) once per coalesced range, in ascending order, then clears.
+        template <typename Fn>
+        void flush(Fn&& fn);
+
+        bool empty() const {
+            return _ranges.empty();
+        }
+
+        Stats stats() const {
+            return _stats;
+        }
+
+    private:
+
+        struct Range {
+
+            size_t begin;
+            size_t end;
+
+        };
+
+        std::vector<Range> _ranges;
+        size_t _threshold;
+
+        Stats _stats = {};
+
+};
+
+template <typename Fn>
+void DirtyRanges::flush(Fn&& fn) {
+
+    for (const Range& range : _ranges) {
+
+        fn(range.begin, range.end - range.begin);
+
+        _stats.bytesFlushed += range.end - range.begin;
+        _stats.flushes++;
+    }
+
+    _ranges.clear();
+}
+
+#endif